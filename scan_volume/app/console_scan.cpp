@@ -0,0 +1,928 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/console_scan.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cwchar>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/multi_scanner.h"
+#include "app/query_engine.h"
+#include "app/scan_diff.h"
+#include "app/throttle.h"
+#include "app/top_entries.h"
+#include "app/utf16.h"
+#include "app/volume_scanner.h"
+
+#ifdef _WIN32
+#include "app/ntfs_backend.h"
+#endif
+
+namespace {
+
+enum Format {
+  Text,
+  Csv,
+  Json,
+};
+
+struct Arguments {
+  std::vector<std::wstring> targets;
+  size_t top;
+  size_t io_per_device;
+  Format format;
+  bool directories_only;
+  bool dedupe_hard_links;
+  bool usage;
+
+  // Set to scan in the background, with the rates given, if any. Zero means
+  // no limit.
+  bool background;
+  double ops_per_second;
+  double bytes_per_second;
+
+  // Set if any condition of |query| was given, to list the entries matching
+  // it instead of the largest ones.
+  bool find;
+  Query query;
+
+  // Snapshots to write the scan to, and to compare it with. Both need a
+  // single target.
+  std::wstring save;
+  std::wstring compare;
+};
+
+struct Summary {
+  DWORDLONG directories;
+  DWORDLONG files;
+  LONGLONG total;
+  LONGLONG allocated;
+};
+
+// A row of the usage by extension or attribute class.
+typedef std::pair<std::string, UsageHistogram::Bucket> UsageRow;
+
+// What is printed for each target.
+struct Report {
+  std::string target;
+  std::vector<std::string> directory_paths;
+  std::vector<const FileEntry*> directories;
+  std::vector<std::string> file_paths;
+  std::vector<const FileEntry*> files;
+  Summary summary;
+  std::vector<UsageRow> extensions;
+  std::vector<UsageRow> attribute_classes;
+};
+
+// Measured over the whole run, not for each target.
+struct Timing {
+  double seconds;
+  DWORDLONG peak_memory;
+};
+
+#ifdef _WIN32
+const wchar_t kSeparator = L'\\';
+#else
+const wchar_t kSeparator = L'/';
+#endif
+
+const size_t kDefaultTop = 20;
+
+const char* const kAttributeClassNames[] = {
+    "compressed", "sparse", "reparse point", "hidden",
+};
+
+const char* const kChangeNames[] = {
+    "added", "removed", "resized",
+};
+
+// Waits for the scans of every target to end.
+class ScanWaiter : public MultiScanner::Listener {
+ public:
+  explicit ScanWaiter(size_t count) : ended_(0), results_(count, S_OK) {}
+
+  void OnScanProgress(size_t index, VolumeScanner::Messages message,
+                      HRESULT result) override {
+    if (message != VolumeScanner::ScanEnd)
+      return;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    ++ended_;
+    results_[index] = result;
+    changed_.notify_all();
+  }
+
+  // Returns the result of the scan of each target.
+  const std::vector<HRESULT>& Wait() {
+    std::unique_lock<std::mutex> lock(lock_);
+    changed_.wait(lock, [this] { return ended_ == results_.size(); });
+    return results_;
+  }
+
+ private:
+  std::mutex lock_;
+  std::condition_variable changed_;
+  size_t ended_;
+  std::vector<HRESULT> results_;
+
+  ScanWaiter(const ScanWaiter&) = delete;
+  ScanWaiter& operator=(const ScanWaiter&) = delete;
+};
+
+bool ParseArguments(int argc, wchar_t** argv, Arguments* arguments) {
+  arguments->top = kDefaultTop;
+  arguments->io_per_device = std::thread::hardware_concurrency();
+  arguments->format = Text;
+  arguments->directories_only = false;
+  arguments->dedupe_hard_links = false;
+  arguments->usage = false;
+  arguments->background = false;
+  arguments->ops_per_second = 0.0;
+  arguments->bytes_per_second = 0.0;
+  arguments->find = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::wstring argument = argv[i];
+
+    if (argument == L"--top" && i + 1 < argc) {
+      wchar_t* end;
+      arguments->top = wcstoul(argv[++i], &end, 10);
+      if (*end != L'\0')
+        return false;
+    } else if (argument == L"--io-per-device" && i + 1 < argc) {
+      wchar_t* end;
+      arguments->io_per_device = wcstoul(argv[++i], &end, 10);
+      if (*end != L'\0' || arguments->io_per_device == 0)
+        return false;
+    } else if (argument == L"--format" && i + 1 < argc) {
+      std::wstring format = argv[++i];
+      if (format == L"text")
+        arguments->format = Text;
+      else if (format == L"csv")
+        arguments->format = Csv;
+      else if (format == L"json")
+        arguments->format = Json;
+      else
+        return false;
+    } else if (argument == L"--directories-only") {
+      arguments->directories_only = true;
+    } else if (argument == L"--dedupe-hard-links") {
+      arguments->dedupe_hard_links = true;
+    } else if (argument == L"--usage") {
+      arguments->usage = true;
+    } else if (argument == L"--background") {
+      arguments->background = true;
+    } else if ((argument == L"--ops-per-second" ||
+                argument == L"--bytes-per-second") &&
+               i + 1 < argc) {
+      wchar_t* end;
+      auto rate = wcstod(argv[++i], &end);
+      if (*end != L'\0' || !(rate > 0.0))
+        return false;
+      if (argument == L"--ops-per-second")
+        arguments->ops_per_second = rate;
+      else
+        arguments->bytes_per_second = rate;
+      arguments->background = true;
+    } else if (argument == L"--name" && i + 1 < argc) {
+      arguments->query.glob = argv[++i];
+      arguments->find = true;
+    } else if (argument == L"--contains" && i + 1 < argc) {
+      arguments->query.substring = argv[++i];
+      arguments->find = true;
+    } else if (argument == L"--extension" && i + 1 < argc) {
+      arguments->query.extension = argv[++i];
+      arguments->find = true;
+    } else if ((argument == L"--min-size" || argument == L"--max-size") &&
+               i + 1 < argc) {
+      wchar_t* end;
+      auto size = wcstoll(argv[++i], &end, 10);
+      if (*end != L'\0' || size < 0)
+        return false;
+      if (argument == L"--min-size")
+        arguments->query.min_size = size;
+      else
+        arguments->query.max_size = size;
+      arguments->find = true;
+    } else if (argument == L"--save" && i + 1 < argc) {
+      arguments->save = argv[++i];
+    } else if (argument == L"--compare" && i + 1 < argc) {
+      arguments->compare = argv[++i];
+    } else if (argument.compare(0, 2, L"--") == 0) {
+      return false;
+    } else {
+      arguments->targets.push_back(argument);
+    }
+  }
+
+  if (!arguments->save.empty() || !arguments->compare.empty()) {
+    if (arguments->targets.size() != 1 ||
+        (!arguments->compare.empty() && arguments->find))
+      return false;
+  }
+
+  return !arguments->targets.empty();
+}
+
+DWORDLONG GetPeakMemory() {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters{sizeof(counters)};
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    return static_cast<DWORDLONG>(usage.ru_maxrss) * 1024;
+#endif
+
+  return 0;
+}
+
+std::wstring GetPath(const FileEntry* entry) {
+  std::vector<const FileEntry*> chain;
+  for (auto cursor = entry; cursor != nullptr; cursor = cursor->parent)
+    chain.push_back(cursor);
+
+  std::wstring path;
+  for (auto i = chain.rbegin(), end = chain.rend(); i != end; ++i) {
+    if (!path.empty() && path.back() != kSeparator)
+      path.push_back(kSeparator);
+    path.append((*i)->name);
+  }
+
+  return path;
+}
+
+std::wstring GetPath(const FileTree& tree, DWORD index) {
+  std::vector<const FileTree::Node*> chain;
+  for (auto cursor = index; cursor != FileTree::kNone;
+       cursor = tree.node(cursor).parent)
+    chain.push_back(&tree.node(cursor));
+
+  std::wstring path;
+  for (auto i = chain.rbegin(), end = chain.rend(); i != end; ++i) {
+    if (!path.empty() && path.back() != kSeparator)
+      path.push_back(kSeparator);
+    path.append(tree.name(**i));
+  }
+
+  return path;
+}
+
+HRESULT LoadTree(const std::wstring& path, FileTree* tree) {
+#ifdef _WIN32
+  return tree->Load(path.c_str());
+#else
+  return tree->Load(EncodeUtf8(path).c_str());
+#endif
+}
+
+HRESULT SaveTree(const std::wstring& path, const FileTree& tree) {
+#ifdef _WIN32
+  return tree.Save(path.c_str());
+#else
+  return tree.Save(EncodeUtf8(path).c_str());
+#endif
+}
+
+#ifdef _WIN32
+
+// Asks the file system for the path of |entry|, whose name wasn't kept.
+bool QueryPath(HANDLE hint, const FileEntry* entry, std::wstring* path) {
+  HANDLE handle = OpenFileByFileId(hint, entry->id, FILE_READ_ATTRIBUTES);
+  if (handle == INVALID_HANDLE_VALUE)
+    return false;
+
+  std::wstring buffer(MAX_PATH, L'\0');
+  auto flags = FILE_NAME_NORMALIZED | VOLUME_NAME_DOS;
+  auto length = GetFinalPathNameByHandleW(
+      handle, &buffer[0], static_cast<DWORD>(buffer.size()), flags);
+  if (length >= buffer.size()) {
+    buffer.resize(length);
+    length = GetFinalPathNameByHandleW(
+        handle, &buffer[0], static_cast<DWORD>(buffer.size()), flags);
+  }
+
+  CloseHandle(handle);
+  handle = INVALID_HANDLE_VALUE;
+
+  if (length == 0 || length >= buffer.size())
+    return false;
+
+  buffer.resize(length);
+  if (buffer.compare(0, 4, L"\\\\?\\") == 0)
+    buffer.erase(0, 4);
+
+  *path = std::move(buffer);
+  return true;
+}
+
+#endif  // _WIN32
+
+std::string QuoteCsv(const std::string& text) {
+  std::string output("\"");
+  for (auto c : text) {
+    if (c == '"')
+      output.push_back('"');
+    output.push_back(c);
+  }
+  output.push_back('"');
+
+  return output;
+}
+
+std::string QuoteJson(const std::string& text) {
+  std::string output("\"");
+  for (auto c : text) {
+    auto code = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\') {
+      output.push_back('\\');
+      output.push_back(c);
+    } else if (code < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", code);
+      output.append(escape);
+    } else {
+      output.push_back(c);
+    }
+  }
+  output.push_back('"');
+
+  return output;
+}
+
+void PrintEntries(Format format, const char* kind,
+                  const std::vector<std::string>& paths,
+                  const std::vector<const FileEntry*>& entries) {
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto size = static_cast<long long>(entries[i]->size.QuadPart);
+    auto allocated = static_cast<long long>(entries[i]->allocated.QuadPart);
+
+    switch (format) {
+      case Text:
+        printf("%20lld %20lld  %s\n", size, allocated, paths[i].c_str());
+        break;
+
+      case Csv:
+        printf("%s,%lld,%lld,%s\n", kind, size, allocated,
+               QuoteCsv(paths[i]).c_str());
+        break;
+
+      case Json:
+        printf("    {\"path\": %s, \"size\": %lld, \"allocated\": %lld}%s\n",
+               QuoteJson(paths[i]).c_str(), size, allocated,
+               i + 1 < entries.size() ? "," : "");
+        break;
+    }
+  }
+}
+
+void PrintUsage(Format format, const char* kind,
+                const std::vector<UsageRow>& rows) {
+  for (size_t i = 0; i < rows.size(); ++i) {
+    auto& name = rows[i].first;
+    auto& bucket = rows[i].second;
+    auto files = static_cast<unsigned long long>(bucket.files);
+    auto size = static_cast<long long>(bucket.size);
+    auto allocated = static_cast<long long>(bucket.allocated);
+
+    switch (format) {
+      case Text:
+        printf("%20lld %20lld %12llu  %s\n", size, allocated, files,
+               name.empty() ? "(none)" : name.c_str());
+        break;
+
+      case Csv:
+        printf("%s,%lld,%lld,%s\n", kind, size, allocated,
+               QuoteCsv(name).c_str());
+        break;
+
+      case Json:
+        printf("    {\"name\": %s, \"files\": %llu, \"size\": %lld, "
+               "\"allocated\": %lld}%s\n",
+               QuoteJson(name).c_str(), files, size, allocated,
+               i + 1 < rows.size() ? "," : "");
+        break;
+    }
+  }
+}
+
+// Prints the report on the target at |index| of |count|. The timing follows
+// the last one, or in JSON, the object of a single target.
+void PrintReport(const Arguments& arguments, const Report& report,
+                 const Timing& timing, size_t index, size_t count) {
+  auto& target = report.target;
+  auto& summary = report.summary;
+  auto last = index + 1 == count;
+
+  switch (arguments.format) {
+    case Text:
+      printf("Largest directories under %s\n", target.c_str());
+      printf("%20s %20s  path\n", "size", "allocated");
+      PrintEntries(Text, nullptr, report.directory_paths, report.directories);
+      if (!arguments.directories_only) {
+        printf("\nLargest files under %s\n", target.c_str());
+        printf("%20s %20s  path\n", "size", "allocated");
+        PrintEntries(Text, nullptr, report.file_paths, report.files);
+      }
+      if (arguments.usage) {
+        printf("\nUsage by extension under %s\n", target.c_str());
+        printf("%20s %20s %12s  extension\n", "size", "allocated", "files");
+        PrintUsage(Text, nullptr, report.extensions);
+        printf("\nUsage by attribute under %s\n", target.c_str());
+        printf("%20s %20s %12s  attribute\n", "size", "allocated", "files");
+        PrintUsage(Text, nullptr, report.attribute_classes);
+      }
+      printf("\n%llu directories, %llu files, %lld bytes, %lld allocated\n",
+             static_cast<unsigned long long>(summary.directories),
+             static_cast<unsigned long long>(summary.files),
+             static_cast<long long>(summary.total),
+             static_cast<long long>(summary.allocated));
+      if (last) {
+        printf("Wall time %.3f s, peak memory %llu bytes\n", timing.seconds,
+               static_cast<unsigned long long>(timing.peak_memory));
+      } else {
+        printf("\n");
+      }
+      break;
+
+    case Csv:
+      PrintEntries(Csv, "directory", report.directory_paths,
+                   report.directories);
+      PrintEntries(Csv, "file", report.file_paths, report.files);
+      PrintUsage(Csv, "extension", report.extensions);
+      PrintUsage(Csv, "attribute", report.attribute_classes);
+      // Keep the standard output a plain table.
+      if (last) {
+        fprintf(stderr, "Wall time %.3f s, peak memory %llu bytes\n",
+                timing.seconds,
+                static_cast<unsigned long long>(timing.peak_memory));
+      }
+      break;
+
+    case Json:
+      printf("{\n  \"target\": %s,\n  \"directories\": [\n",
+             QuoteJson(target).c_str());
+      PrintEntries(Json, nullptr, report.directory_paths, report.directories);
+      printf("  ],\n  \"files\": [\n");
+      PrintEntries(Json, nullptr, report.file_paths, report.files);
+      printf("  ],\n");
+      if (arguments.usage) {
+        printf("  \"extensions\": [\n");
+        PrintUsage(Json, nullptr, report.extensions);
+        printf("  ],\n  \"attributes\": [\n");
+        PrintUsage(Json, nullptr, report.attribute_classes);
+        printf("  ],\n");
+      }
+      printf("  \"directory_count\": %llu,\n  \"file_count\": %llu,\n",
+             static_cast<unsigned long long>(summary.directories),
+             static_cast<unsigned long long>(summary.files));
+      printf("  \"total_size\": %lld,\n  \"total_allocated\": %lld",
+             static_cast<long long>(summary.total),
+             static_cast<long long>(summary.allocated));
+      if (count == 1) {
+        printf(",\n  \"wall_seconds\": %.3f,\n"
+               "  \"peak_memory_bytes\": %llu\n}\n",
+               timing.seconds,
+               static_cast<unsigned long long>(timing.peak_memory));
+      } else {
+        printf("\n}%s\n", last ? "" : ",");
+      }
+      break;
+  }
+}
+
+// Ranks the entries scanned by |scanner|, and names those to be reported.
+void Collect(const Arguments& arguments, const VolumeScanner& scanner,
+             Report* report) {
+  auto root = scanner.GetRoot();
+  auto& summary = report->summary;
+
+  report->target = EncodeUtf8(scanner.GetTarget());
+  summary.total = root->size.QuadPart;
+  summary.allocated = root->allocated.QuadPart;
+
+  // Rank everything in one pass without sorting the tree.
+  TopEntries top_directories(arguments.top);
+  TopEntries top_files(arguments.top);
+
+  std::vector<const FileEntry*> stack;
+  stack.push_back(root);
+  while (!stack.empty()) {
+    auto entry = stack.back();
+    stack.pop_back();
+
+    for (auto& child : entry->children) {
+      if (child->attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        ++summary.directories;
+        top_directories.Offer(child.get());
+        stack.push_back(child.get());
+      } else {
+        ++summary.files;
+        if (child->size.QuadPart >= 0)
+          top_files.Offer(child.get());
+      }
+    }
+  }
+
+  // Files were counted into their directories and dropped.
+  if (arguments.directories_only) {
+    ScanProgress progress;
+    scanner.GetProgress(&progress);
+    summary.files = progress.files_sized;
+  }
+
+  top_directories.Take(&report->directories);
+  top_files.Take(&report->files);
+
+  if (arguments.usage) {
+    auto& usage = scanner.GetUsage();
+    for (auto& extension : usage.extensions()) {
+      report->extensions.push_back(
+          UsageRow(EncodeUtf8(extension.first), extension.second));
+    }
+
+    // Rank extensions by size, and keep as many as entries.
+    std::sort(report->extensions.begin(), report->extensions.end(),
+              [](const UsageRow& a, const UsageRow& b) {
+                if (a.second.size != b.second.size)
+                  return a.second.size > b.second.size;
+                return a.first < b.first;
+              });
+    if (report->extensions.size() > arguments.top)
+      report->extensions.resize(arguments.top);
+
+    for (int i = 0; i < UsageHistogram::kAttributeClasses; ++i) {
+      auto attribute_class = static_cast<UsageHistogram::AttributeClass>(i);
+      report->attribute_classes.push_back(
+          UsageRow(kAttributeClassNames[i],
+                   usage.attribute_class(attribute_class)));
+    }
+  }
+
+  for (auto directory : report->directories)
+    report->directory_paths.push_back(EncodeUtf8(GetPath(directory)));
+
+#ifdef _WIN32
+  HANDLE hint = CreateFileW(
+      (scanner.GetTarget() + L'\\').c_str(), FILE_READ_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+#endif
+
+  for (auto file : report->files) {
+    auto path = GetPath(file);
+#ifdef _WIN32
+    if (file->name.empty() && !QueryPath(hint, file, &path))
+      path.push_back(L'?');
+#endif
+    report->file_paths.push_back(EncodeUtf8(path));
+  }
+
+#ifdef _WIN32
+  if (hint != INVALID_HANDLE_VALUE) {
+    CloseHandle(hint);
+    hint = INVALID_HANDLE_VALUE;
+  }
+#endif
+}
+
+// Prints the matches of a query as they come.
+class MatchPrinter : public QueryEngine::Listener {
+ public:
+  explicit MatchPrinter(Format format) : format_(format), count_(0) {}
+
+  bool OnMatches(const std::vector<const FileEntry*>& matches) override {
+    for (auto entry : matches) {
+      auto path = EncodeUtf8(GetPath(entry));
+      auto size = static_cast<long long>(entry->size.QuadPart);
+      auto allocated = static_cast<long long>(entry->allocated.QuadPart);
+
+      switch (format_) {
+        case Text:
+          printf("%20lld %20lld  %s\n", size, allocated, path.c_str());
+          break;
+
+        case Csv:
+          printf("match,%lld,%lld,%s\n", size, allocated,
+                 QuoteCsv(path).c_str());
+          break;
+
+        case Json:
+          printf("%s    {\"path\": %s, \"size\": %lld, \"allocated\": %lld}",
+                 count_ > 0 ? ",\n" : "", QuoteJson(path).c_str(), size,
+                 allocated);
+          break;
+      }
+
+      ++count_;
+    }
+
+    return true;
+  }
+
+  DWORDLONG count() const {
+    return count_;
+  }
+
+ private:
+  const Format format_;
+  DWORDLONG count_;
+
+  MatchPrinter(const MatchPrinter&) = delete;
+  MatchPrinter& operator=(const MatchPrinter&) = delete;
+};
+
+// Lists the entries matching the query of |arguments| under each target.
+void PrintMatches(const Arguments& arguments, const MultiScanner& scanner) {
+  TaskScheduler scheduler(std::thread::hardware_concurrency());
+  auto count = scanner.target_count();
+
+  // Several targets are reported as a JSON array, or under one CSV header.
+  if (arguments.format == Json && count > 1)
+    printf("[\n");
+  else if (arguments.format == Csv)
+    printf("type,size,allocated,path\n");
+
+  for (size_t i = 0; i < count; ++i) {
+    auto target = EncodeUtf8(scanner.scanner(i)->GetTarget());
+    QueryEngine engine(scanner.scanner(i)->GetRoot(), &scheduler);
+    MatchPrinter printer(arguments.format);
+
+    if (arguments.format == Text) {
+      printf("Matches under %s\n", target.c_str());
+      printf("%20s %20s  path\n", "size", "allocated");
+    } else if (arguments.format == Json) {
+      printf("{\n  \"target\": %s,\n  \"matches\": [\n",
+             QuoteJson(target).c_str());
+    }
+
+    engine.Run(arguments.query, &printer, nullptr);
+
+    auto matches = static_cast<unsigned long long>(printer.count());
+    if (arguments.format == Text) {
+      printf("\n%llu matches\n%s", matches, i + 1 < count ? "\n" : "");
+    } else if (arguments.format == Json) {
+      printf("%s  ],\n  \"match_count\": %llu\n}%s\n",
+             matches > 0 ? "\n" : "", matches, i + 1 < count ? "," : "");
+    }
+  }
+
+  if (arguments.format == Json && count > 1)
+    printf("]\n");
+}
+
+void PrintChanges(Format format, const char* kind, size_t count,
+                  const std::vector<ScanDiff::Change>& changes,
+                  const FileTree& before, const FileTree& after) {
+  count = std::min(count, changes.size());
+  for (size_t i = 0; i < count; ++i) {
+    auto& change = changes[i];
+    auto name = kChangeNames[change.kind];
+    auto growth = static_cast<long long>(change.growth);
+    auto allocated = static_cast<long long>(change.allocated_growth);
+    long long old_size = 0, new_size = 0;
+    if (change.before != FileTree::kNone)
+      old_size = std::max<LONGLONG>(before.node(change.before).size, 0);
+    if (change.after != FileTree::kNone)
+      new_size = std::max<LONGLONG>(after.node(change.after).size, 0);
+
+    // Removed entries are named as they were.
+    auto path = EncodeUtf8(change.after != FileTree::kNone
+                               ? GetPath(after, change.after)
+                               : GetPath(before, change.before));
+
+    switch (format) {
+      case Text:
+        printf("%+20lld %+20lld %20lld %20lld  %-8s %s\n", growth, allocated,
+               old_size, new_size, name, path.c_str());
+        break;
+
+      case Csv:
+        printf("%s,%s,%lld,%lld,%lld,%lld,%s\n", kind, name, growth,
+               allocated, old_size, new_size, QuoteCsv(path).c_str());
+        break;
+
+      case Json:
+        printf("    {\"path\": %s, \"change\": \"%s\", \"growth\": %lld, "
+               "\"allocated_growth\": %lld, \"before\": %lld, "
+               "\"after\": %lld}%s\n",
+               QuoteJson(path).c_str(), name, growth, allocated, old_size,
+               new_size, i + 1 < count ? "," : "");
+        break;
+    }
+  }
+}
+
+// Lists what changed from the snapshot |before| to the scan |after|.
+void PrintDiff(const Arguments& arguments, const FileTree& before,
+               const FileTree& after) {
+  TaskScheduler scheduler(std::thread::hardware_concurrency());
+  ScanDiff diff;
+  diff.Compare(before, after, &scheduler);
+
+  DWORDLONG counts[3] = {};
+  for (auto& change : diff.files())
+    ++counts[change.kind];
+
+  auto target = EncodeUtf8(arguments.targets.front());
+  auto snapshot = EncodeUtf8(arguments.compare);
+  auto top = arguments.top;
+  auto growth = static_cast<long long>(diff.growth());
+  auto allocated = static_cast<long long>(diff.allocated_growth());
+  auto added = static_cast<unsigned long long>(counts[ScanDiff::Added]);
+  auto removed = static_cast<unsigned long long>(counts[ScanDiff::Removed]);
+  auto resized = static_cast<unsigned long long>(counts[ScanDiff::Resized]);
+
+  switch (arguments.format) {
+    case Text:
+      printf("Largest changes to directories under %s since %s\n",
+             target.c_str(), snapshot.c_str());
+      printf("%20s %20s %20s %20s  %-8s path\n", "growth", "allocated",
+             "before", "after", "change");
+      PrintChanges(Text, nullptr, top, diff.directories(), before, after);
+      printf("\nLargest changes to files under %s since %s\n",
+             target.c_str(), snapshot.c_str());
+      printf("%20s %20s %20s %20s  %-8s path\n", "growth", "allocated",
+             "before", "after", "change");
+      PrintChanges(Text, nullptr, top, diff.files(), before, after);
+      printf("\n%llu files added, %llu removed, %llu resized, %+lld bytes, "
+             "%+lld allocated\n",
+             added, removed, resized, growth, allocated);
+      break;
+
+    case Csv:
+      printf("type,change,growth,allocated_growth,before,after,path\n");
+      PrintChanges(Csv, "directory", top, diff.directories(), before, after);
+      PrintChanges(Csv, "file", top, diff.files(), before, after);
+      break;
+
+    case Json:
+      printf("{\n  \"target\": %s,\n  \"snapshot\": %s,\n",
+             QuoteJson(target).c_str(), QuoteJson(snapshot).c_str());
+      printf("  \"directories\": [\n");
+      PrintChanges(Json, nullptr, top, diff.directories(), before, after);
+      printf("  ],\n  \"files\": [\n");
+      PrintChanges(Json, nullptr, top, diff.files(), before, after);
+      printf("  ],\n  \"files_added\": %llu,\n  \"files_removed\": %llu,\n",
+             added, removed);
+      printf("  \"files_resized\": %llu,\n  \"growth\": %lld,\n",
+             resized, growth);
+      printf("  \"allocated_growth\": %lld\n}\n", allocated);
+      break;
+  }
+}
+
+}  // namespace
+
+int RunConsoleScan(int argc, wchar_t** argv) {
+  Arguments arguments;
+  if (!ParseArguments(argc, argv, &arguments)) {
+    fprintf(stderr,
+            "usage: scan_volume [--top N] [--format text|csv|json] "
+            "[--directories-only] [--dedupe-hard-links] "
+            "[--io-per-device N] [--usage] [--name GLOB] [--contains TEXT] "
+            "[--extension EXT] [--min-size BYTES] [--max-size BYTES] "
+            "[--save FILE] [--compare FILE] [--background] "
+            "[--ops-per-second N] [--bytes-per-second N] TARGET...\n");
+    return 2;
+  }
+
+#ifdef _WIN32
+  SetConsoleOutputCP(CP_UTF8);
+#endif
+
+  auto start = std::chrono::steady_clock::now();
+
+  ScanOptions options;
+  options.directories_only = arguments.directories_only;
+  options.dedupe_hard_links = arguments.dedupe_hard_links;
+#ifdef _WIN32
+  // Only the few files reported need names, and those can be looked up by
+  // their IDs afterwards. Queries match the names of every file, and
+  // snapshots keep them for files that may be gone by the time they are
+  // compared.
+  options.keep_file_names = arguments.find || !arguments.save.empty() ||
+                            !arguments.compare.empty();
+#endif
+
+  std::unique_ptr<Throttle> throttle;
+  if (arguments.background)
+    throttle = std::make_unique<Throttle>(arguments.ops_per_second,
+                                          arguments.bytes_per_second);
+
+  MultiScanner scanner(arguments.io_per_device, throttle.get());
+  scanner.SetTargets(arguments.targets, options);
+
+  ScanWaiter waiter(scanner.target_count());
+  HRESULT result = scanner.Scan(&waiter);
+  if (FAILED(result)) {
+    fprintf(stderr, "scan failed: 0x%08X\n", static_cast<unsigned>(result));
+    return 1;
+  }
+
+  auto& results = waiter.Wait();
+  for (size_t i = 0; i < results.size(); ++i) {
+    if (FAILED(results[i]) || scanner.scanner(i)->GetRoot() == nullptr) {
+      fprintf(stderr, "scan of %s failed: 0x%08X\n",
+              EncodeUtf8(arguments.targets[i]).c_str(),
+              static_cast<unsigned>(results[i]));
+      return 1;
+    }
+
+    // The totals are short of whatever couldn't be read, so say how much.
+    ScanProgress progress;
+    scanner.scanner(i)->GetProgress(&progress);
+    if (progress.size_failures > 0)
+      fprintf(stderr, "warning: %llu entries under %s could not be read\n",
+              static_cast<unsigned long long>(progress.size_failures),
+              EncodeUtf8(arguments.targets[i]).c_str());
+  }
+
+  FileTree tree;
+  if (!arguments.save.empty() || !arguments.compare.empty())
+    tree.Build(scanner.scanner(0)->GetRoot());
+
+  if (!arguments.compare.empty()) {
+    FileTree previous;
+    result = LoadTree(arguments.compare, &previous);
+    if (FAILED(result)) {
+      fprintf(stderr, "cannot load %s: 0x%08X\n",
+              EncodeUtf8(arguments.compare).c_str(),
+              static_cast<unsigned>(result));
+      return 1;
+    }
+
+    PrintDiff(arguments, previous, tree);
+  }
+
+  // The snapshot compared with is unmapped by now, and may be replaced.
+  if (!arguments.save.empty()) {
+    result = SaveTree(arguments.save, tree);
+    if (FAILED(result)) {
+      fprintf(stderr, "cannot save %s: 0x%08X\n",
+              EncodeUtf8(arguments.save).c_str(),
+              static_cast<unsigned>(result));
+      return 1;
+    }
+  }
+
+  if (arguments.find || !arguments.compare.empty()) {
+    if (arguments.find)
+      PrintMatches(arguments, scanner);
+
+    // Keep the standard output the matches or changes alone, except in text.
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    fprintf(arguments.format == Text ? stdout : stderr,
+            "Wall time %.3f s, peak memory %llu bytes\n", seconds,
+            static_cast<unsigned long long>(GetPeakMemory()));
+    return 0;
+  }
+
+  std::vector<Report> reports(scanner.target_count());
+  for (size_t i = 0; i < reports.size(); ++i)
+    Collect(arguments, *scanner.scanner(i), &reports[i]);
+
+  Timing timing;
+  timing.seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  timing.peak_memory = GetPeakMemory();
+
+  // Several targets are reported in a JSON array followed by the timing of
+  // the whole run, or under one CSV header.
+  auto several = reports.size() > 1;
+  if (arguments.format == Json && several)
+    printf("{\n  \"targets\": [\n");
+  else if (arguments.format == Csv)
+    printf("type,size,allocated,path\n");
+
+  for (size_t i = 0; i < reports.size(); ++i)
+    PrintReport(arguments, reports[i], timing, i, reports.size());
+
+  if (arguments.format == Json && several) {
+    printf("  ],\n  \"wall_seconds\": %.3f,\n"
+           "  \"peak_memory_bytes\": %llu\n}\n",
+           timing.seconds,
+           static_cast<unsigned long long>(timing.peak_memory));
+  }
+
+  return 0;
+}
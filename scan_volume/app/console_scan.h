@@ -0,0 +1,29 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_CONSOLE_SCAN_H_
+#define SCAN_VOLUME_APP_CONSOLE_SCAN_H_
+
+// Scans the targets named on the command line at once without opening any
+// window, and prints the largest directories and files under each as text,
+// CSV or JSON, with their logical and allocated sizes, followed by the wall
+// time and peak memory of the run. With --directories-only, only directories
+// are kept while scanning. With --dedupe-hard-links, files with several links
+// are counted once. --io-per-device limits the reads in flight on each
+// physical device. --usage adds the bytes taken up by the largest extensions
+// and by each attribute class. Given --name, --contains, --extension,
+// --min-size or --max-size, lists every entry matching them instead, as it is
+// found. --save writes the scan of a single target to a snapshot, and
+// --compare lists what changed since one was taken instead. --background
+// scans at low priority, backing off as the devices get busy, and
+// --ops-per-second and --bytes-per-second cap its I/O on top of that. Returns
+// the exit code of the process.
+//
+//   scan_volume [--top N] [--format text|csv|json] [--directories-only]
+//               [--dedupe-hard-links] [--io-per-device N] [--usage]
+//               [--name GLOB] [--contains TEXT] [--extension EXT]
+//               [--min-size BYTES] [--max-size BYTES] [--save FILE]
+//               [--compare FILE] [--background] [--ops-per-second N]
+//               [--bytes-per-second N] TARGET...
+int RunConsoleScan(int argc, wchar_t** argv);
+
+#endif  // SCAN_VOLUME_APP_CONSOLE_SCAN_H_
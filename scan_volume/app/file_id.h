@@ -0,0 +1,82 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_FILE_ID_H_
+#define SCAN_VOLUME_APP_FILE_ID_H_
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "app/port.h"
+
+// The 128-bit ID of a file on its volume. 64-bit NTFS file reference numbers
+// occupy the low half with the high half zeroed.
+class FileId : public std::array<BYTE, 16> {
+ public:
+  FileId() {
+    fill(static_cast<value_type>(-1));
+  }
+
+  explicit FileId(const FILE_ID_128& id) {
+    operator=(id);
+  }
+
+  explicit FileId(const DWORDLONG& id) {
+    operator=(id);
+  }
+
+  FileId& operator=(const FILE_ID_128& id) {
+    memcpy(data(), id.Identifier, size());
+    return *this;
+  }
+
+  FileId& operator=(const DWORDLONG& id) {
+    fill(0);
+    memcpy(data(), &id, sizeof(id));
+    return *this;
+  }
+
+  bool operator==(const FileId& other) const {
+    return memcmp(data(), other.data(), size()) == 0;
+  }
+
+  bool operator<(const FileId& other) const {
+    auto a = rbegin(), b = other.rbegin();
+
+    for (size_t i = 0; i < size(); ++i) {
+      if (*a != *b)
+        return *a < *b;
+
+      ++a;
+      ++b;
+    }
+
+    return false;
+  }
+
+  DWORDLONG low() const {
+    DWORDLONG value;
+    memcpy(&value, data(), sizeof(value));
+    return value;
+  }
+
+  DWORDLONG high() const {
+    DWORDLONG value;
+    memcpy(&value, data() + sizeof(value), sizeof(value));
+    return value;
+  }
+};
+
+// Mixes both halves of a file ID, so that any bits of the hash can pick a
+// bucket.
+struct FileIdHash {
+  size_t operator()(const FileId& id) const {
+    auto hash = id.low() ^ (id.high() * 0x9E3779B97F4A7C15);
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCD;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash);
+  }
+};
+
+#endif  // SCAN_VOLUME_APP_FILE_ID_H_
@@ -0,0 +1,16 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/file_id_set.h"
+
+#include <limits>
+
+bool FileIdSet::Insert(const FileId& id) {
+  // Shards are picked by the high bits of the hash, and buckets within them
+  // by the low bits.
+  auto hash = FileIdHash()(id);
+  auto& shard =
+      shards_[hash >> (std::numeric_limits<size_t>::digits - kShardBits)];
+
+  std::lock_guard<std::mutex> guard(shard.lock);
+  return shard.ids.insert(id).second;
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_FILE_ID_SET_H_
+#define SCAN_VOLUME_APP_FILE_ID_SET_H_
+
+#include <mutex>
+#include <unordered_set>
+
+#include "app/file_id.h"
+
+// A set of file IDs that any number of threads insert into at once. IDs are
+// spread over shards by hash, each behind a lock of its own, so that threads
+// seldom wait on each other.
+class FileIdSet {
+ public:
+  FileIdSet() {}
+
+  // Adds |id| and returns true, or returns false if it was already there.
+  bool Insert(const FileId& id);
+
+ private:
+  static const int kShardBits = 6;
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_set<FileId, FileIdHash> ids;
+  };
+
+  Shard shards_[1 << kShardBits];
+
+  FileIdSet(const FileIdSet&) = delete;
+  FileIdSet& operator=(const FileIdSet&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_FILE_ID_SET_H_
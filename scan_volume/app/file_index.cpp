@@ -0,0 +1,137 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/file_index.h"
+
+#include "app/volume_scanner.h"
+
+FileIndex::FileIndex() : slots_used_(0), size_(0) {}
+
+FileEntry* FileIndex::Acquire(const FileId& id) {
+  auto pointer = Claim(id);
+  if (*pointer == nullptr) {
+    *pointer = new FileEntry();
+    (*pointer)->id = id;
+    ++size_;
+  }
+
+  return *pointer;
+}
+
+void FileIndex::Insert(FileEntry* entry) {
+  auto pointer = Claim(entry->id);
+  if (*pointer == nullptr)
+    ++size_;
+
+  *pointer = entry;
+}
+
+void FileIndex::Remove(const FileId& id) {
+  auto record = id.low() & kRecordNumberMask;
+  if (id.high() == 0 && record < records_.size()) {
+    auto& pointer = records_[static_cast<size_t>(record)];
+    if (pointer != nullptr && pointer->id == id) {
+      pointer = nullptr;
+      --size_;
+      return;
+    }
+  }
+
+  if (slots_.empty())
+    return;
+
+  auto mask = slots_.size() - 1;
+  auto hole = Probe(id);
+  if (slots_[hole].entry == nullptr)
+    return;
+
+  // Shift back the rest of the cluster so that no probe sequence is broken.
+  for (auto next = (hole + 1) & mask; slots_[next].entry != nullptr;
+       next = (next + 1) & mask) {
+    auto home = Hash(slots_[next].id) & mask;
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+
+  slots_[hole] = Slot{FileId(), nullptr};
+  --slots_used_;
+  --size_;
+}
+
+FileEntry* FileIndex::Find(const FileId& id) const {
+  auto record = id.low() & kRecordNumberMask;
+  if (id.high() == 0 && record < records_.size()) {
+    // The sequence number tells a reused MFT record from the file it held.
+    auto entry = records_[static_cast<size_t>(record)];
+    if (entry != nullptr && entry->id == id)
+      return entry;
+  }
+
+  return FindHashed(id);
+}
+
+void FileIndex::Reserve(size_t record_count) {
+  if (size_ == 0)
+    records_.resize(record_count, nullptr);
+}
+
+size_t FileIndex::Hash(const FileId& id) {
+  return FileIdHash()(id);
+}
+
+size_t FileIndex::Probe(const FileId& id) const {
+  auto mask = slots_.size() - 1;
+  auto index = Hash(id) & mask;
+  while (slots_[index].entry != nullptr && !(slots_[index].id == id))
+    index = (index + 1) & mask;
+
+  return index;
+}
+
+FileEntry* FileIndex::FindHashed(const FileId& id) const {
+  if (slots_.empty())
+    return nullptr;
+
+  return slots_[Probe(id)].entry;
+}
+
+FileEntry** FileIndex::Claim(const FileId& id) {
+  auto record = id.low() & kRecordNumberMask;
+  if (id.high() == 0 && record < records_.size()) {
+    // The record may be held by another sequence number, or have been left
+    // by one that is still in the hash table.
+    auto& pointer = records_[static_cast<size_t>(record)];
+    if (pointer != nullptr ? pointer->id == id : FindHashed(id) == nullptr)
+      return &pointer;
+  }
+
+  if ((slots_used_ + 1) * 2 > slots_.size())
+    Rehash(slots_.empty() ? kInitialSlots : slots_.size() * 2);
+
+  auto& slot = slots_[Probe(id)];
+  if (slot.entry == nullptr) {
+    slot.id = id;
+    ++slots_used_;
+  }
+
+  return &slot.entry;
+}
+
+void FileIndex::Rehash(size_t capacity) {
+  std::vector<Slot> slots(capacity, Slot{FileId(), nullptr});
+  auto mask = capacity - 1;
+
+  for (auto& slot : slots_) {
+    if (slot.entry == nullptr)
+      continue;
+
+    auto index = Hash(slot.id) & mask;
+    while (slots[index].entry != nullptr)
+      index = (index + 1) & mask;
+
+    slots[index] = slot;
+  }
+
+  slots_.swap(slots);
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_FILE_INDEX_H_
+#define SCAN_VOLUME_APP_FILE_INDEX_H_
+
+#include <vector>
+
+#include "app/file_id.h"
+
+struct FileEntry;
+
+// Maps file IDs to entries. NTFS file reference numbers are addressed
+// directly by their MFT record number; IDs that don't fit in 64 bits, such as
+// those of ReFS, fall back to an open-addressing hash table. IDs are always
+// compared whole: a reference to an MFT record already holding an entry under
+// another sequence number, such as a file that took the record over while
+// the volume was enumerated, goes to the hash table too, so that neither
+// entry is lost.
+class FileIndex {
+ public:
+  FileIndex();
+
+  // Returns the entry for |id|, creating an empty one if not present. The
+  // index never owns the entries it hands out.
+  FileEntry* Acquire(const FileId& id);
+
+  // Adds |entry| under its own ID, replacing any entry with the same ID.
+  void Insert(FileEntry* entry);
+
+  // Forgets the entry for |id|, if any, without deleting it.
+  void Remove(const FileId& id);
+
+  // Returns the entry for |id|, or nullptr if there is none.
+  FileEntry* Find(const FileId& id) const;
+
+  // Enables direct addressing of MFT record numbers below |record_count|. Must
+  // be called before the first Acquire.
+  void Reserve(size_t record_count);
+
+  // Returns the entry addressed directly by MFT record number |record|,
+  // whatever its sequence number, or nullptr if there is none.
+  FileEntry* Find(size_t record) const {
+    return record < records_.size() ? records_[record] : nullptr;
+  }
+
+  // Calls |function| with each entry until it returns false.
+  template <typename Function>
+  bool ForEach(Function function) const {
+    for (auto entry : records_) {
+      if (entry != nullptr && !function(entry))
+        return false;
+    }
+
+    for (auto& slot : slots_) {
+      if (slot.entry != nullptr && !function(slot.entry))
+        return false;
+    }
+
+    return true;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t record_count() const {
+    return records_.size();
+  }
+
+ private:
+  struct Slot {
+    FileId id;
+    FileEntry* entry;
+  };
+
+  static const DWORDLONG kRecordNumberMask = 0x0000FFFFFFFFFFFF;
+  static const size_t kInitialSlots = 1024;
+
+  static size_t Hash(const FileId& id);
+
+  // Returns the position of the hash slot holding |id|, or of the empty slot
+  // it would take. The table must not be empty.
+  size_t Probe(const FileId& id) const;
+
+  // Returns the entry for |id| in the hash table, or nullptr if there is
+  // none.
+  FileEntry* FindHashed(const FileId& id) const;
+
+  // Returns the place where the entry for |id| is kept, claiming a hash slot
+  // for it if its MFT record can't be addressed directly.
+  FileEntry** Claim(const FileId& id);
+  void Rehash(size_t capacity);
+
+  std::vector<FileEntry*> records_;
+  std::vector<Slot> slots_;
+  size_t slots_used_;
+  size_t size_;
+
+  FileIndex(const FileIndex&) = delete;
+  FileIndex& operator=(const FileIndex&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_FILE_INDEX_H_
@@ -0,0 +1,319 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/file_tree.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "app/mapped_file.h"
+
+// Snapshots start with this header, followed by the node array at
+// |node_offset| and the name pool at |name_offset|. All integers are
+// little-endian.
+struct FileTree::Header {
+  char magic[8];
+  DWORD version;
+  DWORD header_size;
+  DWORD node_size;
+  DWORD name_unit;
+  DWORDLONG node_count;
+  DWORDLONG node_offset;
+  DWORDLONG name_count;
+  DWORDLONG name_offset;
+};
+
+namespace {
+
+const char kMagic[8] = {'S', 'C', 'A', 'N', 'V', 'O', 'L', '\x1A'};
+const DWORD kVersion = 3;
+
+// Snapshots are read in place, so the nodes must be laid out alike
+// everywhere.
+static_assert(sizeof(FileTree::Node) == 56, "Node must be 56 bytes");
+
+#ifdef _WIN32
+const HRESULT kBadFormat = HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+#else
+const HRESULT kBadFormat = HRESULT_FROM_ERRNO(ENOEXEC);
+#endif
+
+// Passes the snapshot image of the given arrays to |write| piece by piece.
+template <typename Header, typename Node, typename Write>
+HRESULT Serialize(const Node* nodes, size_t node_count, const char16_t* names,
+                  size_t name_count, Write write) {
+  Header header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.header_size = sizeof(header);
+  header.node_size = sizeof(Node);
+  header.name_unit = sizeof(char16_t);
+  header.node_count = node_count;
+  header.node_offset = sizeof(header);
+  header.name_count = name_count;
+  header.name_offset = header.node_offset + node_count * sizeof(Node);
+
+  HRESULT result = write(&header, sizeof(header));
+  if (SUCCEEDED(result) && node_count > 0)
+    result = write(nodes, node_count * sizeof(Node));
+  if (SUCCEEDED(result) && name_count > 0)
+    result = write(names, name_count * sizeof(char16_t));
+
+  return result;
+}
+
+}  // namespace
+
+const FileTree::Node FileTree::kInvalidNode{kNone, 0, 0, 0, 0, 0, 0, 0,
+                                            FileId()};
+
+FileTree::FileTree()
+    : nodes_(nullptr), node_count_(0), names_(nullptr), name_count_(0) {}
+
+FileTree::~FileTree() {}
+
+void FileTree::Build(const FileEntry* root) {
+  Clear();
+
+  if (root == nullptr)
+    return;
+
+  std::vector<const FileEntry*> sources;
+  sources.push_back(root);
+  node_storage_.push_back(Node{kNone, 0, 0, root->attributes, 0, 0,
+                                root->size.QuadPart, root->allocated.QuadPart,
+                                root->id});
+
+  for (size_t index = 0; index < sources.size(); ++index) {
+    auto source = sources[index];
+
+    auto& node = node_storage_[index];
+    node.name_offset = static_cast<DWORD>(name_storage_.size());
+    node.first_child = static_cast<DWORD>(node_storage_.size());
+    node.child_count = static_cast<DWORD>(source->children.size());
+    AppendUtf16Units(source->name, &name_storage_);
+    node.name_length =
+        static_cast<DWORD>(name_storage_.size() - node.name_offset);
+
+    for (auto& child : source->children) {
+      sources.push_back(child.get());
+      node_storage_.push_back(Node{static_cast<DWORD>(index), 0, 0,
+                                   child->attributes, 0, 0,
+                                   child->size.QuadPart,
+                                   child->allocated.QuadPart, child->id});
+    }
+  }
+
+  node_storage_.shrink_to_fit();
+  name_storage_.shrink_to_fit();
+
+  nodes_ = node_storage_.data();
+  node_count_ = node_storage_.size();
+  names_ = name_storage_.data();
+  name_count_ = name_storage_.size();
+}
+
+std::unique_ptr<FileEntry> FileTree::Restore() const {
+  if (node_count_ == 0)
+    return nullptr;
+
+  // Children come after their parents, so each entry is made before it is
+  // filled in. Nodes no parent claims are left out.
+  auto root = std::make_unique<FileEntry>();
+  std::vector<FileEntry*> entries(node_count_, nullptr);
+  entries[0] = root.get();
+
+  for (DWORD index = 0; index < node_count_; ++index) {
+    auto entry = entries[index];
+    if (entry == nullptr)
+      continue;
+
+    auto& source = node(index);
+    entry->id = source.id;
+    entry->attributes = source.attributes;
+    AssignUtf16(name_data(source), source.name_length, &entry->name);
+    entry->size.QuadPart = source.size;
+    entry->allocated.QuadPart = source.allocated;
+
+    entry->children.reserve(source.child_count);
+    for (DWORD i = 0; i < source.child_count; ++i) {
+      auto child = source.first_child + i;
+      if (node(child).parent != index)
+        continue;
+
+      entry->children.push_back(std::make_unique<FileEntry>());
+      entries[child] = entry->children.back().get();
+      entries[child]->parent = entry;
+    }
+  }
+
+  return root;
+}
+
+void FileTree::Clear() {
+  Detach();
+
+  std::vector<Node>().swap(node_storage_);
+  std::vector<char16_t>().swap(name_storage_);
+}
+
+#ifdef _WIN32
+
+HRESULT FileTree::Save(const wchar_t* path) const {
+  auto temporary = std::wstring(path).append(L".tmp");
+  HANDLE file = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr,
+                            CREATE_ALWAYS,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return HRESULT_FROM_WIN32(GetLastError());
+
+  HRESULT result = Serialize<Header>(
+      nodes_, node_count_, names_, name_count_,
+      [file](const void* data, size_t size) {
+        auto cursor = static_cast<const char*>(data);
+        while (size > 0) {
+          DWORD request = static_cast<DWORD>(std::min<size_t>(size, 1 << 30));
+          DWORD bytes = 0;
+          if (!WriteFile(file, cursor, request, &bytes, nullptr))
+            return HRESULT_FROM_WIN32(GetLastError());
+
+          cursor += bytes;
+          size -= bytes;
+        }
+
+        return S_OK;
+      });
+
+  if (SUCCEEDED(result) && !FlushFileBuffers(file))
+    result = HRESULT_FROM_WIN32(GetLastError());
+
+  if (!CloseHandle(file) && SUCCEEDED(result))
+    result = HRESULT_FROM_WIN32(GetLastError());
+
+  if (SUCCEEDED(result) &&
+      !MoveFileExW(temporary.c_str(), path,
+                   MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    result = HRESULT_FROM_WIN32(GetLastError());
+
+  if (FAILED(result))
+    DeleteFileW(temporary.c_str());
+
+  return result;
+}
+
+HRESULT FileTree::Load(const wchar_t* path) {
+  auto file = std::make_unique<MappedFile>();
+  HRESULT result = file->Open(path);
+  if (FAILED(result))
+    return result;
+
+  return Attach(std::move(file));
+}
+
+#else  // _WIN32
+
+HRESULT FileTree::Save(const char* path) const {
+  auto temporary = std::string(path).append(".tmp");
+  int file =
+      open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (file == -1)
+    return HRESULT_FROM_ERRNO(errno);
+
+  HRESULT result = Serialize<Header>(
+      nodes_, node_count_, names_, name_count_,
+      [file](const void* data, size_t size) {
+        auto cursor = static_cast<const char*>(data);
+        while (size > 0) {
+          auto bytes = write(file, cursor, size);
+          if (bytes < 0)
+            return HRESULT_FROM_ERRNO(errno);
+
+          cursor += bytes;
+          size -= bytes;
+        }
+
+        return S_OK;
+      });
+
+  if (SUCCEEDED(result) && fsync(file) != 0)
+    result = HRESULT_FROM_ERRNO(errno);
+
+  if (close(file) != 0 && SUCCEEDED(result))
+    result = HRESULT_FROM_ERRNO(errno);
+
+  if (SUCCEEDED(result) && rename(temporary.c_str(), path) != 0)
+    result = HRESULT_FROM_ERRNO(errno);
+
+  if (FAILED(result))
+    unlink(temporary.c_str());
+
+  return result;
+}
+
+HRESULT FileTree::Load(const char* path) {
+  auto file = std::make_unique<MappedFile>();
+  HRESULT result = file->Open(path);
+  if (FAILED(result))
+    return result;
+
+  return Attach(std::move(file));
+}
+
+#endif  // _WIN32
+
+size_t FileTree::memory_usage() const {
+  if (file_ != nullptr)
+    return file_->size();
+
+  return node_storage_.capacity() * sizeof(Node) +
+         name_storage_.capacity() * sizeof(char16_t);
+}
+
+HRESULT FileTree::Attach(std::unique_ptr<MappedFile> file) {
+  auto data = static_cast<const char*>(file->data());
+  auto size = file->size();
+
+  Header header;
+  if (size < sizeof(header))
+    return kBadFormat;
+
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.header_size < sizeof(header) ||
+      header.node_size != sizeof(Node) || header.name_unit != sizeof(char16_t))
+    return kBadFormat;
+
+  // Only the layout is checked here; node() checks each node as it's read.
+  if (header.node_offset % alignof(Node) != 0 ||
+      header.node_offset > size ||
+      header.node_count > (size - header.node_offset) / sizeof(Node) ||
+      header.node_count >= kNone ||
+      header.name_offset % sizeof(char16_t) != 0 ||
+      header.name_offset > size ||
+      header.name_count > (size - header.name_offset) / sizeof(char16_t))
+    return kBadFormat;
+
+  Clear();
+
+  file_ = std::move(file);
+  nodes_ = reinterpret_cast<const Node*>(data + header.node_offset);
+  node_count_ = static_cast<size_t>(header.node_count);
+  names_ = reinterpret_cast<const char16_t*>(data + header.name_offset);
+  name_count_ = static_cast<size_t>(header.name_count);
+
+  return S_OK;
+}
+
+void FileTree::Detach() {
+  file_.reset();
+  nodes_ = nullptr;
+  node_count_ = 0;
+  names_ = nullptr;
+  name_count_ = 0;
+}
@@ -0,0 +1,133 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_FILE_TREE_H_
+#define SCAN_VOLUME_APP_FILE_TREE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/file_id.h"
+#include "app/port.h"
+#include "app/utf16.h"
+#include "app/volume_scanner.h"
+
+class MappedFile;
+
+// Arena-backed, read-only form of a FileEntry tree. Nodes live in a single
+// contiguous array in breadth-first order so that the children of each node
+// form a contiguous index range, and all names share a single UTF-16 pool,
+// so that snapshots read the same on every platform.
+//
+// Nodes refer to each other by index only, so the arrays can be written out
+// as a snapshot and later mapped back and browsed in place. Loading checks the
+// layout of a snapshot alone, and each node is checked as it is read, so
+// opening one takes the same time however many nodes it holds.
+class FileTree {
+ public:
+  static const DWORD kNone = MAXDWORD;
+
+  struct Node {
+    DWORD parent;
+    DWORD first_child;
+    DWORD child_count;
+    DWORD attributes;
+    DWORD name_offset;
+    DWORD name_length;
+    LONGLONG size;
+    LONGLONG allocated;
+
+    // Lets snapshots of the same volume be compared entry by entry.
+    FileId id;
+  };
+
+  FileTree();
+  ~FileTree();
+
+  // Replaces the contents with a copy of the tree rooted at |root|.
+  void Build(const FileEntry* root);
+  void Clear();
+
+  // Makes a FileEntry tree of the contents, for views built on one, or
+  // returns nullptr if there are none.
+  std::unique_ptr<FileEntry> Restore() const;
+
+  // Writes the tree next to |path| and then moves it over, so that a failed
+  // save leaves any snapshot already there intact.
+#ifdef _WIN32
+  HRESULT Save(const wchar_t* path) const;
+  HRESULT Load(const wchar_t* path);
+#else
+  HRESULT Save(const char* path) const;
+  HRESULT Load(const char* path);
+#endif
+
+  bool empty() const {
+    return node_count_ == 0;
+  }
+
+  size_t size() const {
+    return node_count_;
+  }
+
+  // Returns the node at |index|. One out of range, or whose parent doesn't
+  // come before it or whose children or name lie outside the tree, reads as a
+  // nameless, childless node of its own, so that walking a damaged snapshot
+  // always ends within it. Children are read through here too, as
+  // node(first_child + i) for each i below child_count.
+  const Node& node(DWORD index) const {
+    if (index < node_count_ && IsValid(nodes_[index], index))
+      return nodes_[index];
+
+    return kInvalidNode;
+  }
+
+  const Node* root() const {
+    return node_count_ == 0 ? nullptr : &node(0);
+  }
+
+  // Returns the |name_length| UTF-16 code units of the name of |node|.
+  const char16_t* name_data(const Node& node) const {
+    return names_ + node.name_offset;
+  }
+
+  std::wstring name(const Node& node) const {
+    std::wstring name;
+    AssignUtf16(name_data(node), node.name_length, &name);
+    return name;
+  }
+
+  // Returns the number of bytes held by the arena and the name pool, or by
+  // the mapped snapshot.
+  size_t memory_usage() const;
+
+ private:
+  struct Header;
+
+  static const Node kInvalidNode;
+
+  bool IsValid(const Node& node, DWORD index) const {
+    return (node.parent == kNone || node.parent < index) &&
+           node.first_child <= node_count_ &&
+           node.child_count <= node_count_ - node.first_child &&
+           node.name_offset <= name_count_ &&
+           node.name_length <= name_count_ - node.name_offset;
+  }
+
+  HRESULT Attach(std::unique_ptr<MappedFile> file);
+  void Detach();
+
+  std::vector<Node> node_storage_;
+  std::vector<char16_t> name_storage_;
+  std::unique_ptr<MappedFile> file_;
+
+  const Node* nodes_;
+  size_t node_count_;
+  const char16_t* names_;
+  size_t name_count_;
+
+  FileTree(const FileTree&) = delete;
+  FileTree& operator=(const FileTree&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_FILE_TREE_H_
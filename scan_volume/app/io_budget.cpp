@@ -0,0 +1,89 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/io_budget.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <winioctl.h>
+#else
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <climits>
+#include <cstdlib>
+#endif
+
+#include <algorithm>
+
+#include "app/utf16.h"
+
+IoBudget::IoBudget(size_t capacity)
+    : capacity_(std::max<size_t>(1, capacity)), available_(capacity_) {}
+
+void IoBudget::Acquire() {
+  std::unique_lock<std::mutex> lock(lock_);
+  released_.wait(lock, [this] { return available_ > 0; });
+  --available_;
+}
+
+void IoBudget::Release() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    ++available_;
+  }
+  released_.notify_one();
+}
+
+#ifdef _WIN32
+
+// Volumes are keyed by the number of the disk they are on. Volumes spanning
+// several disks are keyed by themselves.
+std::wstring GetDeviceKey(const std::wstring& target) {
+  auto path = std::wstring(L"\\\\.\\").append(target);
+  HANDLE handle = CreateFileW(path.c_str(), 0,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+    return target;
+
+  STORAGE_DEVICE_NUMBER number;
+  DWORD bytes = 0;
+  BOOL succeeded =
+      DeviceIoControl(handle, IOCTL_STORAGE_GET_DEVICE_NUMBER, nullptr, 0,
+                      &number, sizeof(number), &bytes, nullptr);
+
+  CloseHandle(handle);
+  handle = INVALID_HANDLE_VALUE;
+
+  if (!succeeded)
+    return target;
+
+  return L"disk" + std::to_wstring(number.DeviceNumber);
+}
+
+#else  // _WIN32
+
+// Targets are keyed by the block device they are on, with partitions keyed
+// by the disk that holds them.
+std::wstring GetDeviceKey(const std::wstring& target) {
+  struct stat file;
+  if (stat(EncodeUtf8(target).c_str(), &file) != 0)
+    return target;
+
+  auto link = "/sys/dev/block/" + std::to_string(major(file.st_dev)) + ":" +
+              std::to_string(minor(file.st_dev));
+  char resolved[PATH_MAX];
+  if (realpath(link.c_str(), resolved) == nullptr)
+    return target;
+
+  std::string device(resolved);
+  if (access((device + "/partition").c_str(), F_OK) == 0)
+    device.erase(device.rfind('/'));
+
+  // Block device names are plain ASCII.
+  auto name = device.substr(device.rfind('/') + 1);
+  return std::wstring(name.begin(), name.end());
+}
+
+#endif  // _WIN32
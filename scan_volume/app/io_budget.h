@@ -0,0 +1,60 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_IO_BUDGET_H_
+#define SCAN_VOLUME_APP_IO_BUDGET_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+// Caps the I/O requests in flight on one physical device, across every scan
+// of a volume on it. Scanning threads hold a slot of the budget around each
+// batch of requests, and wait for one when all are taken.
+class IoBudget {
+ public:
+  // Holds a slot of |budget| for its lifetime. A null budget is unlimited.
+  class Slot {
+   public:
+    explicit Slot(IoBudget* budget) : budget_(budget) {
+      if (budget_ != nullptr)
+        budget_->Acquire();
+    }
+
+    ~Slot() {
+      if (budget_ != nullptr)
+        budget_->Release();
+    }
+
+   private:
+    IoBudget* const budget_;
+
+    Slot(const Slot&) = delete;
+    Slot& operator=(const Slot&) = delete;
+  };
+
+  explicit IoBudget(size_t capacity);
+
+  void Acquire();
+  void Release();
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+ private:
+  const size_t capacity_;
+
+  std::mutex lock_;
+  std::condition_variable released_;
+  size_t available_;
+
+  IoBudget(const IoBudget&) = delete;
+  IoBudget& operator=(const IoBudget&) = delete;
+};
+
+// Returns a key that is the same for every target on the same physical
+// device, or the target itself if its device can't be told.
+std::wstring GetDeviceKey(const std::wstring& target);
+
+#endif  // SCAN_VOLUME_APP_IO_BUDGET_H_
@@ -0,0 +1,311 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/journal_replayer.h"
+
+#include "app/utf16.h"
+
+namespace {
+
+const DWORDLONG kRecordNumberMask = 0x0000FFFFFFFFFFFF;
+
+const DWORD kReasonDataOverwrite = 0x00000001;
+const DWORD kReasonDataExtend = 0x00000002;
+const DWORD kReasonDataTruncation = 0x00000004;
+const DWORD kReasonFileCreate = 0x00000100;
+const DWORD kReasonFileDelete = 0x00000200;
+const DWORD kReasonRenameOldName = 0x00001000;
+
+const DWORD kReasonDataChange = kReasonDataOverwrite | kReasonDataExtend |
+                                kReasonDataTruncation | kReasonFileCreate;
+
+bool IsDirectory(const FileEntry* entry) {
+  return (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+// Returns what |size| of an entry adds to that of its parent.
+LONGLONG Contribution(const LARGE_INTEGER& size) {
+  return size.QuadPart > 0 ? size.QuadPart : 0;
+}
+
+// Takes |entry| out of the children of its parent. The order of the siblings
+// isn't preserved.
+std::unique_ptr<FileEntry> Detach(FileEntry* entry) {
+  auto& siblings = entry->parent->children;
+  auto match = std::find_if(siblings.begin(), siblings.end(),
+                            [entry](const std::unique_ptr<FileEntry>& child) {
+                              return child.get() == entry;
+                            });
+
+  std::swap(*match, siblings.back());
+  auto detached = std::move(siblings.back());
+  siblings.pop_back();
+
+  return detached;
+}
+
+}  // namespace
+
+JournalReplayer::JournalReplayer(
+    const std::vector<std::unique_ptr<FileEntry>>& roots) {
+  std::vector<FileEntry*> entries;
+  for (auto& root : roots)
+    entries.push_back(root.get());
+
+  DWORDLONG record_count = 0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    auto entry = entries[i];
+    if (entry->id.high() == 0)
+      record_count = std::max(record_count,
+                              (entry->id.low() & kRecordNumberMask) + 1);
+
+    for (auto& child : entry->children)
+      entries.push_back(child.get());
+  }
+
+  // Address MFT records directly unless they are too sparse to pay off.
+  if (record_count <= entries.size() * 4)
+    entries_.Reserve(static_cast<size_t>(record_count));
+
+  for (auto entry : entries)
+    entries_.Insert(entry);
+}
+
+JournalReplayer::~JournalReplayer() {
+  Rollback();
+}
+
+HRESULT JournalReplayer::Apply(const void* data, size_t size) {
+  auto cursor = static_cast<const char*>(data);
+  UsnRecord record;
+
+  for (size_t length; size > 0; cursor += length, size -= length) {
+    HRESULT result = ReadUsnRecord(cursor, size, &record, &length);
+    if (FAILED(result))
+      return result;
+
+    // Range tracking records carry neither names nor parents.
+    if (result == S_FALSE)
+      continue;
+
+    result = ApplyChange(record);
+    if (FAILED(result))
+      return result;
+  }
+
+  return S_OK;
+}
+
+HRESULT JournalReplayer::ApplyChange(const UsnRecord& change) {
+  auto entry = entries_.Find(change.id);
+
+  // Roots keep the name of the target they were scanned as.
+  if (entry != nullptr && entry->parent == nullptr)
+    return S_OK;
+
+  if (change.reason & kReasonFileDelete) {
+    if (entry != nullptr)
+      Delete(entry);
+
+    return S_OK;
+  }
+
+  // The old name of a renamed file is followed by a record with the new one.
+  if (change.reason & kReasonRenameOldName)
+    return S_OK;
+
+  // A file made in a reused MFT record means the one it held is gone.
+  if (entry == nullptr && change.id.high() == 0) {
+    auto reused = entries_.Find(
+        static_cast<size_t>(change.id.low() & kRecordNumberMask));
+    if (reused != nullptr && reused->parent != nullptr)
+      Delete(reused);
+  }
+
+  auto parent = entries_.Find(change.parent);
+  if (parent == nullptr || !IsDirectory(parent))
+    return E_FAIL;
+
+  if (entry == nullptr) {
+    auto created = std::make_unique<FileEntry>();
+    created->id = change.id;
+    created->parent = parent;
+    entry = created.get();
+
+    parent->children.push_back(std::move(created));
+    entries_.Insert(entry);
+    undo_.emplace_back(Undo::Created, entry);
+  } else {
+    if (entry->parent != parent) {
+      for (auto ancestor = parent; ancestor != nullptr;
+           ancestor = ancestor->parent) {
+        if (ancestor == entry)
+          return E_FAIL;
+      }
+
+      Move(entry, parent);
+    }
+
+    undo_.emplace_back(Undo::Renamed, entry);
+    undo_.back().attributes = entry->attributes;
+    undo_.back().name = entry->name;
+  }
+
+  entry->attributes = change.attributes;
+  AssignUtf16(change.name, change.name_length, &entry->name);
+  unordered_.push_back(parent->id);
+
+  if ((change.reason & kReasonDataChange) && !IsDirectory(entry))
+    stale_.push_back(change.id);
+
+  return S_OK;
+}
+
+void JournalReplayer::Reorder() {
+  std::sort(unordered_.begin(), unordered_.end());
+  unordered_.erase(std::unique(unordered_.begin(), unordered_.end()),
+                   unordered_.end());
+
+  // Directories deleted since they were marked are no longer found.
+  for (auto& id : unordered_) {
+    auto directory = entries_.Find(id);
+    if (directory != nullptr && IsDirectory(directory))
+      SortChildren(directory);
+  }
+
+  unordered_.clear();
+}
+
+void JournalReplayer::Commit() {
+  std::vector<Undo>().swap(undo_);
+}
+
+void JournalReplayer::Delete(FileEntry* entry) {
+  Propagate(entry->parent, -Contribution(entry->size),
+            -Contribution(entry->allocated));
+  unordered_.push_back(entry->parent->id);
+
+  Undo undo(Undo::Deleted, entry);
+  undo.parent = entry->parent;
+
+  // Anything still under a deleted directory goes with it.
+  std::vector<FileEntry*> pending(1, entry);
+  while (!pending.empty()) {
+    auto doomed = pending.back();
+    pending.pop_back();
+
+    if (entries_.Find(doomed->id) == doomed) {
+      entries_.Remove(doomed->id);
+      undo.removed.push_back(doomed);
+    }
+
+    for (auto& child : doomed->children)
+      pending.push_back(child.get());
+  }
+
+  undo.subtree = Detach(entry);
+  undo_.push_back(std::move(undo));
+}
+
+void JournalReplayer::Move(FileEntry* entry, FileEntry* parent) {
+  auto size = Contribution(entry->size);
+  auto allocated = Contribution(entry->allocated);
+  Propagate(entry->parent, -size, -allocated);
+  unordered_.push_back(entry->parent->id);
+
+  undo_.emplace_back(Undo::Moved, entry);
+  undo_.back().parent = entry->parent;
+
+  auto detached = Detach(entry);
+  entry->parent = parent;
+  parent->children.push_back(std::move(detached));
+
+  Propagate(parent, size, allocated);
+}
+
+void JournalReplayer::SetSize(FileEntry* entry, LARGE_INTEGER size,
+                              LARGE_INTEGER allocated) {
+  auto size_delta = Contribution(size) - Contribution(entry->size);
+  auto allocated_delta =
+      Contribution(allocated) - Contribution(entry->allocated);
+  undo_.emplace_back(Undo::Resized, entry);
+  undo_.back().size = entry->size;
+  undo_.back().allocated = entry->allocated;
+
+  entry->size = size;
+  entry->allocated = allocated;
+  Propagate(entry->parent, size_delta, allocated_delta);
+}
+
+// A child of each directory on the way up changes size, so each is marked to
+// be reordered.
+void JournalReplayer::Propagate(FileEntry* directory, LONGLONG size,
+                                LONGLONG allocated) {
+  if (size == 0 && allocated == 0)
+    return;
+
+  undo_.emplace_back(Undo::Propagated, directory);
+  undo_.back().size.QuadPart = size;
+  undo_.back().allocated.QuadPart = allocated;
+
+  for (; directory != nullptr; directory = directory->parent) {
+    directory->size.QuadPart += size;
+    directory->allocated.QuadPart += allocated;
+    unordered_.push_back(directory->id);
+  }
+}
+
+// Changes are undone last to first, so each finds the tree as it left it.
+// Siblings come back in the order Reorder puts them in.
+void JournalReplayer::Rollback() {
+  for (auto undo = undo_.rbegin(); undo != undo_.rend(); ++undo) {
+    auto entry = undo->entry;
+
+    switch (undo->kind) {
+      case Undo::Created:
+        entries_.Remove(entry->id);
+        unordered_.push_back(entry->parent->id);
+        Detach(entry).reset();
+        break;
+
+      case Undo::Deleted:
+        for (auto removed : undo->removed)
+          entries_.Insert(removed);
+
+        undo->parent->children.push_back(std::move(undo->subtree));
+        unordered_.push_back(undo->parent->id);
+        break;
+
+      case Undo::Moved: {
+        unordered_.push_back(entry->parent->id);
+        auto detached = Detach(entry);
+        entry->parent = undo->parent;
+        undo->parent->children.push_back(std::move(detached));
+        unordered_.push_back(undo->parent->id);
+        break;
+      }
+
+      case Undo::Renamed:
+        entry->attributes = undo->attributes;
+        entry->name.swap(undo->name);
+        break;
+
+      case Undo::Resized:
+        entry->size = undo->size;
+        entry->allocated = undo->allocated;
+        break;
+
+      case Undo::Propagated:
+        for (auto directory = entry; directory != nullptr;
+             directory = directory->parent) {
+          directory->size.QuadPart -= undo->size.QuadPart;
+          directory->allocated.QuadPart -= undo->allocated.QuadPart;
+          unordered_.push_back(directory->id);
+        }
+        break;
+    }
+  }
+
+  undo_.clear();
+  stale_.clear();
+  Reorder();
+}
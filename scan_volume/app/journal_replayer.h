@@ -0,0 +1,119 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_JOURNAL_REPLAYER_H_
+#define SCAN_VOLUME_APP_JOURNAL_REPLAYER_H_
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/file_index.h"
+#include "app/port.h"
+#include "app/usn_record.h"
+#include "app/volume_scanner.h"
+
+// Brings a scanned tree up to date by replaying the records of an NTFS change
+// journal onto it. Names, parents and directory totals are updated in place,
+// and undone when the replayer goes away unless committed, so a replay that
+// fails or is canceled partway leaves the tree as it was.
+//
+// Records are decoded with ReadUsnRecord, so any stream of records can be
+// replayed on any platform.
+class JournalReplayer {
+ public:
+  // The entries under |roots| must carry the IDs they were scanned with.
+  explicit JournalReplayer(
+      const std::vector<std::unique_ptr<FileEntry>>& roots);
+
+  // Undoes everything applied since the last Commit.
+  ~JournalReplayer();
+
+  // Applies the records packed back to back in |data|, as returned by
+  // FSCTL_READ_USN_JOURNAL after its leading USN. Returns E_INVALIDARG at the
+  // first malformed record, and E_FAIL at the first record that doesn't fit
+  // the tree, in which case the tree should be scanned again.
+  HRESULT Apply(const void* data, size_t size);
+
+  // Calls |function| with each file whose data changed since the last call,
+  // and its size and allocated size to update. Negative values mark them as
+  // unknown.
+  template <typename Function>
+  void Resize(Function function) {
+    std::sort(stale_.begin(), stale_.end());
+    stale_.erase(std::unique(stale_.begin(), stale_.end()), stale_.end());
+
+    for (auto& id : stale_) {
+      auto entry = entries_.Find(id);
+      if (entry == nullptr || (entry->attributes & FILE_ATTRIBUTE_DIRECTORY))
+        continue;
+
+      auto size = entry->size, allocated = entry->allocated;
+      function(static_cast<const FileEntry*>(entry), &size, &allocated);
+      SetSize(entry, size, allocated);
+    }
+
+    stale_.clear();
+  }
+
+  // Puts the children of each directory whose children were added, removed,
+  // renamed or resized since the last call back in order with SortChildren.
+  void Reorder();
+
+  // Keeps everything applied so far.
+  void Commit();
+
+ private:
+  // What it takes to undo one change to the tree.
+  struct Undo {
+    enum Kind {
+      Created,
+      Deleted,
+      Moved,
+      Renamed,
+      Resized,
+      Propagated,
+    };
+
+    Undo(Kind kind, FileEntry* entry)
+        : kind(kind), entry(entry), parent(nullptr), attributes(), size(),
+          allocated() {}
+
+    Kind kind;
+
+    // The entry changed, or the directory totals were propagated from.
+    FileEntry* entry;
+
+    // The parent |entry| was deleted from or moved out of.
+    FileEntry* parent;
+
+    // What |entry| was before it was renamed.
+    DWORD attributes;
+    std::wstring name;
+
+    // What |entry| was before it was resized, or what was added up from it.
+    LARGE_INTEGER size;
+    LARGE_INTEGER allocated;
+
+    // The deleted subtree, and those in it that were taken out of the index.
+    std::unique_ptr<FileEntry> subtree;
+    std::vector<FileEntry*> removed;
+  };
+
+  HRESULT ApplyChange(const UsnRecord& change);
+  void Delete(FileEntry* entry);
+  void Move(FileEntry* entry, FileEntry* parent);
+  void SetSize(FileEntry* entry, LARGE_INTEGER size, LARGE_INTEGER allocated);
+  void Propagate(FileEntry* directory, LONGLONG size, LONGLONG allocated);
+  void Rollback();
+
+  FileIndex entries_;
+  std::vector<FileId> stale_;
+  std::vector<FileId> unordered_;
+  std::vector<Undo> undo_;
+
+  JournalReplayer(const JournalReplayer&) = delete;
+  JournalReplayer& operator=(const JournalReplayer&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_JOURNAL_REPLAYER_H_
@@ -0,0 +1,135 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/mapped_file.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+    : file_(INVALID_HANDLE_VALUE), mapping_(NULL), data_(nullptr), size_(0) {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+HRESULT MappedFile::Open(const wchar_t* path) {
+  Close();
+
+  file_ = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file_ == INVALID_HANDLE_VALUE)
+    return HRESULT_FROM_WIN32(GetLastError());
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file_, &size)) {
+    auto error = GetLastError();
+    Close();
+    return HRESULT_FROM_WIN32(error);
+  }
+
+  if (size.QuadPart == 0 ||
+      static_cast<ULONGLONG>(size.QuadPart) > SIZE_MAX) {
+    Close();
+    return HRESULT_FROM_WIN32(ERROR_BAD_FORMAT);
+  }
+
+  mapping_ = CreateFileMappingW(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ == NULL) {
+    auto error = GetLastError();
+    Close();
+    return HRESULT_FROM_WIN32(error);
+  }
+
+  data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+  if (data_ == nullptr) {
+    auto error = GetLastError();
+    Close();
+    return HRESULT_FROM_WIN32(error);
+  }
+
+  size_ = static_cast<size_t>(size.QuadPart);
+
+  return S_OK;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+
+  if (mapping_ != NULL) {
+    CloseHandle(mapping_);
+    mapping_ = NULL;
+  }
+
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+
+  size_ = 0;
+}
+
+#else  // _WIN32
+
+MappedFile::MappedFile() : file_(-1), data_(nullptr), size_(0) {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+HRESULT MappedFile::Open(const char* path) {
+  Close();
+
+  file_ = open(path, O_RDONLY | O_CLOEXEC);
+  if (file_ == -1)
+    return HRESULT_FROM_ERRNO(errno);
+
+  struct stat stat;
+  if (fstat(file_, &stat) != 0) {
+    auto error = errno;
+    Close();
+    return HRESULT_FROM_ERRNO(error);
+  }
+
+  if (stat.st_size == 0) {
+    Close();
+    return HRESULT_FROM_ERRNO(ENOEXEC);
+  }
+
+  auto data = mmap(nullptr, static_cast<size_t>(stat.st_size), PROT_READ,
+                   MAP_SHARED, file_, 0);
+  if (data == MAP_FAILED) {
+    auto error = errno;
+    Close();
+    return HRESULT_FROM_ERRNO(error);
+  }
+
+  data_ = data;
+  size_ = static_cast<size_t>(stat.st_size);
+
+  return S_OK;
+}
+
+void MappedFile::Close() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+    data_ = nullptr;
+  }
+
+  if (file_ != -1) {
+    close(file_);
+    file_ = -1;
+  }
+
+  size_ = 0;
+}
+
+#endif  // _WIN32
@@ -0,0 +1,45 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_MAPPED_FILE_H_
+#define SCAN_VOLUME_APP_MAPPED_FILE_H_
+
+#include <cstddef>
+
+#include "app/port.h"
+
+// Maps a whole file read-only into memory.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+#ifdef _WIN32
+  HRESULT Open(const wchar_t* path);
+#else
+  HRESULT Open(const char* path);
+#endif
+  void Close();
+
+  const void* data() const {
+    return data_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#else
+  int file_;
+#endif
+  void* data_;
+  size_t size_;
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_MAPPED_FILE_H_
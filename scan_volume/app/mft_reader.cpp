@@ -0,0 +1,536 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/mft_reader.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+#include "app/io_budget.h"
+#include "app/throttle.h"
+#include "app/utf16.h"
+
+namespace {
+
+const uint64_t kReferenceMask = 0x0000FFFFFFFFFFFF;
+const uint64_t kSparseRun = UINT64_MAX;
+const uint32_t kDirectoryAttribute = 0x00000010;
+
+const uint32_t kStandardInformation = 0x10;
+const uint32_t kAttributeList = 0x20;
+const uint32_t kFileName = 0x30;
+const uint32_t kData = 0x80;
+const uint32_t kEndOfAttributes = 0xFFFFFFFF;
+
+const uint16_t kRecordInUse = 0x0001;
+const uint16_t kRecordIsDirectory = 0x0002;
+
+const uint16_t kAttributeCompressed = 0x0001;
+const uint16_t kAttributeSparse = 0x8000;
+
+const uint8_t kDosNamespace = 2;
+
+// NTFS update sequence arrays always protect 512-byte strides regardless of
+// the physical sector size.
+const uint32_t kFixupStride = 512;
+
+template <typename T>
+T Get(const uint8_t* pointer) {
+  T value;
+  memcpy(&value, pointer, sizeof(value));
+  return value;
+}
+
+// Calls |function| with the type, header and length of each attribute in the
+// file record until it returns false.
+template <typename Function>
+void ForEachAttribute(const uint8_t* record, uint32_t record_size,
+                      Function function) {
+  uint32_t used = std::min(Get<uint32_t>(record + 0x18), record_size);
+
+  for (uint32_t offset = Get<uint16_t>(record + 0x14); offset + 16 <= used;) {
+    auto attribute = record + offset;
+    auto type = Get<uint32_t>(attribute);
+    if (type == kEndOfAttributes)
+      break;
+
+    auto length = Get<uint32_t>(attribute + 4);
+    if (length < 16 || length > used - offset)
+      break;
+
+    if (!function(type, attribute, length))
+      break;
+
+    offset += length;
+  }
+}
+
+// Returns the value of a resident attribute, or nullptr if it is malformed or
+// non-resident.
+const uint8_t* GetResidentValue(const uint8_t* attribute, uint32_t length,
+                                uint32_t* value_length) {
+  if (attribute[8] != 0 || length < 0x18)
+    return nullptr;
+
+  *value_length = Get<uint32_t>(attribute + 0x10);
+  uint32_t value_offset = Get<uint16_t>(attribute + 0x14);
+  if (value_offset > length || *value_length > length - value_offset)
+    return nullptr;
+
+  return attribute + value_offset;
+}
+
+}  // namespace
+
+MftReader::MftReader(NameMode names)
+#ifdef _WIN32
+    : handle_(INVALID_HANDLE_VALUE),
+#else
+    : handle_(-1),
+#endif
+      cluster_size_(0),
+      record_size_(0),
+      mft_offset_(0),
+      mft_size_(0),
+      names_(names) {
+}
+
+MftReader::~MftReader() {
+  Close();
+}
+
+#ifdef _WIN32
+
+bool MftReader::Open(const wchar_t* path) {
+  Close();
+
+  handle_ = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL);
+  if (handle_ == INVALID_HANDLE_VALUE)
+    return false;
+
+  return ReadBootSector() && ReadMftExtents();
+}
+
+void MftReader::Close() {
+  if (handle_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(handle_);
+    handle_ = INVALID_HANDLE_VALUE;
+  }
+}
+
+bool MftReader::ReadAt(uint64_t offset, void* buffer, size_t size) {
+  auto cursor = static_cast<char*>(buffer);
+
+  while (size > 0) {
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD request = static_cast<DWORD>(std::min<size_t>(size, 1 << 30));
+    DWORD bytes = 0;
+    if (!ReadFile(handle_, cursor, request, &bytes, &overlapped) || bytes == 0)
+      return false;
+
+    cursor += bytes;
+    offset += bytes;
+    size -= bytes;
+  }
+
+  return true;
+}
+
+#else  // _WIN32
+
+bool MftReader::Open(const char* path) {
+  Close();
+
+  handle_ = open(path, O_RDONLY | O_CLOEXEC);
+  if (handle_ == -1)
+    return false;
+
+  return ReadBootSector() && ReadMftExtents();
+}
+
+void MftReader::Close() {
+  if (handle_ != -1) {
+    close(handle_);
+    handle_ = -1;
+  }
+}
+
+bool MftReader::ReadAt(uint64_t offset, void* buffer, size_t size) {
+  auto cursor = static_cast<char*>(buffer);
+
+  while (size > 0) {
+    auto bytes = pread(handle_, cursor, size, static_cast<off_t>(offset));
+    if (bytes <= 0)
+      return false;
+
+    cursor += bytes;
+    offset += bytes;
+    size -= bytes;
+  }
+
+  return true;
+}
+
+#endif  // _WIN32
+
+bool MftReader::Read(std::vector<Record>* records,
+                     const std::atomic<bool>* cancel, Throttle* throttle,
+                     IoBudget* budget) {
+  if (record_size_ == 0)
+    return false;
+
+#ifdef _WIN32
+  if (throttle != nullptr)
+    LowerIoPriority(handle_);
+#endif
+
+  records->clear();
+  records->resize(static_cast<size_t>(mft_size_ / record_size_));
+
+  size_t chunk_size = kChunkRecords * record_size_;
+  chunk_size = (chunk_size + cluster_size_ - 1) / cluster_size_ * cluster_size_;
+  std::vector<uint8_t> buffer(chunk_size);
+
+  for (uint64_t offset = 0; offset < mft_size_; offset += chunk_size) {
+    if (cancel != nullptr && cancel->load(std::memory_order_relaxed))
+      return false;
+
+    auto length = std::min<uint64_t>(chunk_size, mft_size_ - offset);
+    auto aligned =
+        (length + cluster_size_ - 1) / cluster_size_ * cluster_size_;
+    {
+      IoBudget::Slot slot(budget);
+      Throttle::Operation operation(throttle, cancel);
+      if (!ReadMft(offset, buffer.data(), static_cast<size_t>(aligned)))
+        return false;
+
+      operation.set_bytes(aligned);
+    }
+
+    auto number = offset / record_size_;
+    for (uint64_t i = 0; i < length; i += record_size_, ++number)
+      ParseRecord(number, buffer.data() + i, records);
+  }
+
+  return true;
+}
+
+bool MftReader::ReadBootSector() {
+  uint8_t boot[4096];
+  if (!ReadAt(0, boot, sizeof(boot)))
+    return false;
+
+  if (memcmp(boot + 3, "NTFS    ", 8) != 0)
+    return false;
+
+  uint32_t sector_size = Get<uint16_t>(boot + 0x0B);
+  if (sector_size < 256 || sector_size > 4096 ||
+      (sector_size & (sector_size - 1)) != 0)
+    return false;
+
+  uint32_t sectors_per_cluster = boot[0x0D];
+  if (sectors_per_cluster > 0x80)
+    sectors_per_cluster = 1u << (256 - sectors_per_cluster);
+  if (sectors_per_cluster == 0)
+    return false;
+
+  cluster_size_ = sector_size * sectors_per_cluster;
+
+  auto clusters_per_record = static_cast<int8_t>(boot[0x40]);
+  if (clusters_per_record > 0)
+    record_size_ = clusters_per_record * cluster_size_;
+  else if (clusters_per_record > -31)
+    record_size_ = 1u << -clusters_per_record;
+
+  if (record_size_ < kFixupStride || record_size_ > 65536)
+    return false;
+
+  mft_offset_ = Get<uint64_t>(boot + 0x30) * cluster_size_;
+
+  return true;
+}
+
+bool MftReader::ReadMftExtents() {
+  extents_.clear();
+
+  // Record 0 describes $MFT itself. Until its runs are known, only the first
+  // record can be located, right at the start of the MFT.
+  size_t length = std::max(record_size_, cluster_size_);
+  std::vector<uint8_t> record(length);
+  if (!ReadAt(mft_offset_, record.data(), length) ||
+      memcmp(record.data(), "FILE", 4) != 0 || !ApplyFixup(record.data()))
+    return false;
+
+  std::vector<uint8_t> list;
+  bool valid = true;
+
+  ForEachAttribute(record.data(), record_size_, [&](uint32_t type,
+                                                    const uint8_t* attribute,
+                                                    uint32_t length) {
+    if (type == kData && attribute[8] != 0 && attribute[9] == 0 &&
+        length >= 0x40) {
+      auto vcn = Get<uint64_t>(attribute + 0x10);
+      if (vcn == 0)
+        mft_size_ = Get<uint64_t>(attribute + 0x30);
+
+      valid = DecodeRuns(attribute + Get<uint16_t>(attribute + 0x20),
+                         attribute + length, vcn, &extents_);
+    } else if (type == kAttributeList) {
+      uint32_t value_length = 0;
+      auto value = GetResidentValue(attribute, length, &value_length);
+      if (value != nullptr) {
+        list.assign(value, value + value_length);
+      } else if (attribute[8] != 0 && length >= 0x40) {
+        std::vector<Extent> runs;
+        valid = DecodeRuns(attribute + Get<uint16_t>(attribute + 0x20),
+                           attribute + length, 0, &runs);
+
+        for (auto& run : runs) {
+          auto offset = list.size();
+          list.resize(offset + run.length * cluster_size_);
+          valid = valid && ReadAt(run.lcn * cluster_size_, &list[offset],
+                                  static_cast<size_t>(run.length) *
+                                      cluster_size_);
+        }
+
+        list.resize(std::min<size_t>(
+            list.size(), static_cast<size_t>(Get<uint64_t>(attribute + 0x30))));
+      }
+    }
+
+    return valid;
+  });
+
+  if (!valid || extents_.empty() || mft_size_ == 0)
+    return false;
+
+  // A heavily fragmented $MFT keeps the rest of its runs in extension records
+  // named by its attribute list.
+  std::vector<uint64_t> extensions;
+  for (size_t offset = 0; offset + 0x1A <= list.size();) {
+    auto entry = &list[offset];
+    auto entry_length = Get<uint16_t>(entry + 4);
+    if (entry_length < 0x1A || entry_length > list.size() - offset)
+      break;
+
+    auto number = Get<uint64_t>(entry + 0x10) & kReferenceMask;
+    if (Get<uint32_t>(entry) == kData && entry[6] == 0 && number != 0)
+      extensions.push_back(number);
+
+    offset += entry_length;
+  }
+
+  std::sort(extensions.begin(), extensions.end());
+  extensions.erase(std::unique(extensions.begin(), extensions.end()),
+                   extensions.end());
+
+  for (auto number : extensions) {
+    if (!ReadRecord(number, &record))
+      return false;
+
+    ForEachAttribute(record.data(), record_size_, [&](uint32_t type,
+                                                      const uint8_t* attribute,
+                                                      uint32_t length) {
+      if (type == kData && attribute[8] != 0 && attribute[9] == 0 &&
+          length >= 0x40)
+        valid = DecodeRuns(attribute + Get<uint16_t>(attribute + 0x20),
+                           attribute + length,
+                           Get<uint64_t>(attribute + 0x10), &extents_);
+
+      return valid;
+    });
+
+    if (!valid)
+      return false;
+  }
+
+  std::sort(extents_.begin(), extents_.end(),
+            [](const Extent& a, const Extent& b) { return a.vcn < b.vcn; });
+
+  return true;
+}
+
+bool MftReader::ReadMft(uint64_t offset, void* buffer, size_t size) {
+  auto cursor = static_cast<uint8_t*>(buffer);
+
+  for (auto& extent : extents_) {
+    if (size == 0)
+      break;
+
+    auto begin = extent.vcn * cluster_size_;
+    auto end = begin + extent.length * cluster_size_;
+    if (offset < begin || end <= offset)
+      continue;
+
+    auto length = static_cast<size_t>(std::min<uint64_t>(size, end - offset));
+    if (extent.lcn == kSparseRun)
+      memset(cursor, 0, length);
+    else if (!ReadAt(extent.lcn * cluster_size_ + (offset - begin), cursor,
+                     length))
+      return false;
+
+    cursor += length;
+    offset += length;
+    size -= length;
+  }
+
+  return size == 0;
+}
+
+bool MftReader::ReadRecord(uint64_t number, std::vector<uint8_t>* buffer) {
+  auto offset = number * record_size_;
+  auto aligned = offset / cluster_size_ * cluster_size_;
+  size_t length = std::max(record_size_, cluster_size_);
+
+  buffer->resize(length);
+  if (!ReadMft(aligned, buffer->data(), length))
+    return false;
+
+  if (aligned != offset)
+    memmove(buffer->data(), buffer->data() + (offset - aligned), record_size_);
+
+  return memcmp(buffer->data(), "FILE", 4) == 0 && ApplyFixup(buffer->data());
+}
+
+bool MftReader::ApplyFixup(uint8_t* record) const {
+  uint32_t usa_offset = Get<uint16_t>(record + 4);
+  uint32_t usa_count = Get<uint16_t>(record + 6);
+  if (usa_count < 2 || usa_offset + usa_count * 2 > record_size_ ||
+      (usa_count - 1) * kFixupStride > record_size_)
+    return false;
+
+  auto usn = Get<uint16_t>(record + usa_offset);
+  for (uint32_t i = 1; i < usa_count; ++i) {
+    auto tail = record + i * kFixupStride - 2;
+    if (Get<uint16_t>(tail) != usn)
+      return false;
+
+    memcpy(tail, record + usa_offset + i * 2, 2);
+  }
+
+  return true;
+}
+
+void MftReader::ParseRecord(uint64_t number, uint8_t* record,
+                            std::vector<Record>* records) const {
+  if (memcmp(record, "FILE", 4) != 0 || !ApplyFixup(record))
+    return;
+
+  auto flags = Get<uint16_t>(record + 0x16);
+  if ((flags & kRecordInUse) == 0)
+    return;
+
+  auto base = Get<uint64_t>(record + 0x20) & kReferenceMask;
+  auto target = base != 0 ? base : number;
+  if (target >= records->size())
+    return;
+
+  auto& output = (*records)[static_cast<size_t>(target)];
+  if (base == 0) {
+    output.in_use = true;
+    output.directory = (flags & kRecordIsDirectory) != 0;
+    if (output.directory)
+      output.attributes |= kDirectoryAttribute;
+  }
+
+  ForEachAttribute(record, record_size_, [&](uint32_t type,
+                                             const uint8_t* attribute,
+                                             uint32_t length) {
+    uint32_t value_length = 0;
+    auto value = GetResidentValue(attribute, length, &value_length);
+
+    switch (type) {
+      case kStandardInformation:
+        if (value != nullptr && value_length >= 0x24)
+          output.attributes |= Get<uint32_t>(value + 0x20);
+        break;
+
+      case kFileName:
+        if (value != nullptr && value_length >= 0x42 &&
+            value[0x41] != kDosNamespace && output.parent == kNoRecord &&
+            0x42u + value[0x40] * 2u <= value_length) {
+          output.parent = Get<uint64_t>(value) & kReferenceMask;
+
+          auto name = value + 0x42;
+          size_t length = value[0x40], first = 0;
+          if (names_ == Extensions) {
+            for (first = length; first > 0; --first) {
+              if (Get<uint16_t>(name + (first - 1) * 2) == '.')
+                break;
+            }
+            first = first > 0 ? first - 1 : length;
+          }
+
+          AssignUtf16(name + first * 2, length - first, &output.name);
+        }
+        break;
+
+      case kData:
+        if (attribute[9] != 0) {
+          break;
+        } else if (value != nullptr) {
+          output.size = value_length;
+          output.allocated_size = (value_length + 7) & ~7ull;
+        } else if (attribute[8] != 0 && length >= 0x40 &&
+                   Get<uint64_t>(attribute + 0x10) == 0) {
+          output.size = Get<uint64_t>(attribute + 0x30);
+          output.allocated_size = Get<uint64_t>(attribute + 0x28);
+
+          auto attribute_flags = Get<uint16_t>(attribute + 0x0C);
+          if ((attribute_flags & (kAttributeCompressed | kAttributeSparse)) &&
+              length >= 0x48)
+            output.allocated_size = Get<uint64_t>(attribute + 0x40);
+        }
+        break;
+    }
+
+    return true;
+  });
+}
+
+bool MftReader::DecodeRuns(const uint8_t* runs, const uint8_t* end,
+                           uint64_t vcn, std::vector<Extent>* extents) {
+  int64_t lcn = 0;
+
+  while (runs < end && *runs != 0) {
+    size_t length_size = *runs & 0x0F;
+    size_t offset_size = *runs >> 4;
+    ++runs;
+
+    if (length_size == 0 || length_size > 8 || offset_size > 8 ||
+        static_cast<size_t>(end - runs) < length_size + offset_size)
+      return false;
+
+    uint64_t length = 0;
+    for (size_t i = 0; i < length_size; ++i)
+      length |= static_cast<uint64_t>(runs[i]) << (i * 8);
+    runs += length_size;
+
+    if (offset_size == 0) {
+      extents->push_back(Extent{vcn, kSparseRun, length});
+    } else {
+      int64_t delta = 0;
+      for (size_t i = 0; i < offset_size; ++i)
+        delta |= static_cast<int64_t>(runs[i]) << (i * 8);
+      if (offset_size < 8 && (runs[offset_size - 1] & 0x80))
+        delta |= static_cast<int64_t>(~0ull << (offset_size * 8));
+      runs += offset_size;
+
+      lcn += delta;
+      extents->push_back(Extent{vcn, static_cast<uint64_t>(lcn), length});
+    }
+
+    vcn += length;
+  }
+
+  return true;
+}
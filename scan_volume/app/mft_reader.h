@@ -0,0 +1,114 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_MFT_READER_H_
+#define SCAN_VOLUME_APP_MFT_READER_H_
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class IoBudget;
+class Throttle;
+
+// Streams the $MFT of an NTFS volume, or of an image file of one, and decodes
+// the names, parents and sizes of every file record in a single sequential
+// pass. Doesn't depend on the file system driver, so images can be read on
+// any platform.
+class MftReader {
+ public:
+  static const uint64_t kNoRecord = UINT64_MAX;
+
+  // What is kept of the name of each file.
+  enum NameMode {
+    FullNames,
+
+    // The last dot and what follows it alone, which is all tallying by
+    // extension needs. Those without a dot are left unnamed.
+    Extensions,
+  };
+
+  struct Record {
+    Record()
+        : parent(kNoRecord),
+          size(0),
+          allocated_size(0),
+          attributes(0),
+          in_use(false),
+          directory(false) {}
+
+    uint64_t parent;
+    uint64_t size;
+    uint64_t allocated_size;
+    uint32_t attributes;
+    bool in_use;
+    bool directory;
+    std::wstring name;
+  };
+
+  explicit MftReader(NameMode names = FullNames);
+  ~MftReader();
+
+#ifdef _WIN32
+  bool Open(const wchar_t* path);
+#else
+  bool Open(const char* path);
+#endif
+  void Close();
+
+  // Reads every file record into |records|, indexed by MFT record number.
+  // Attributes held in extension records are folded into their base record.
+  // Gives up between chunks once |cancel|, if given, is set. Reads a chunk at
+  // a time as |throttle|, if given, allows, holding a slot of |budget|, if
+  // given, for each chunk alone so that other scans of the device take turns.
+  bool Read(std::vector<Record>* records,
+            const std::atomic<bool>* cancel = nullptr,
+            Throttle* throttle = nullptr, IoBudget* budget = nullptr);
+
+  uint32_t bytes_per_record() const {
+    return record_size_;
+  }
+
+ private:
+  struct Extent {
+    uint64_t vcn;
+    uint64_t lcn;
+    uint64_t length;
+  };
+
+  static const size_t kChunkRecords = 1024;
+
+  bool ReadAt(uint64_t offset, void* buffer, size_t size);
+  bool ReadBootSector();
+  bool ReadMftExtents();
+  bool ReadMft(uint64_t offset, void* buffer, size_t size);
+  bool ReadRecord(uint64_t number, std::vector<uint8_t>* buffer);
+  bool ApplyFixup(uint8_t* record) const;
+  void ParseRecord(uint64_t number, uint8_t* record,
+                   std::vector<Record>* records) const;
+
+  static bool DecodeRuns(const uint8_t* runs, const uint8_t* end, uint64_t vcn,
+                         std::vector<Extent>* extents);
+
+#ifdef _WIN32
+  HANDLE handle_;
+#else
+  int handle_;
+#endif
+
+  uint32_t cluster_size_;
+  uint32_t record_size_;
+  uint64_t mft_offset_;
+  uint64_t mft_size_;
+  std::vector<Extent> extents_;
+  const NameMode names_;
+
+  MftReader(const MftReader&) = delete;
+  MftReader& operator=(const MftReader&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_MFT_READER_H_
@@ -0,0 +1,85 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/multi_scanner.h"
+
+#include <thread>
+
+#include "app/throttle.h"
+
+// Tells the listener of a MultiScanner which target a notification is for.
+class MultiScanner::Forwarder : public VolumeScanner::Listener {
+ public:
+  Forwarder(MultiScanner* owner, size_t index)
+      : owner_(owner), index_(index) {}
+
+  void OnScanProgress(VolumeScanner::Messages message,
+                      HRESULT result) override {
+    owner_->listener_->OnScanProgress(index_, message, result);
+  }
+
+ private:
+  MultiScanner* const owner_;
+  const size_t index_;
+
+  Forwarder(const Forwarder&) = delete;
+  Forwarder& operator=(const Forwarder&) = delete;
+};
+
+// The workers are shared by every scan, and so are left in the background
+// from the start if the scans are paced.
+MultiScanner::MultiScanner(size_t io_per_device, Throttle* throttle)
+    : io_per_device_(io_per_device),
+      throttle_(throttle),
+      listener_(nullptr),
+      scheduler_(std::thread::hardware_concurrency(),
+                 throttle != nullptr ? EnterBackgroundMode : nullptr) {}
+
+MultiScanner::~MultiScanner() {
+  Cancel();
+}
+
+void MultiScanner::SetTargets(const std::vector<std::wstring>& targets,
+                              const ScanOptions& options) {
+  scanners_.clear();
+  forwarders_.clear();
+  budgets_.clear();
+
+  size_t index = 0;
+  for (auto& target : targets) {
+    auto& budget = budgets_[GetDeviceKey(target)];
+    if (budget == nullptr)
+      budget = std::make_unique<IoBudget>(io_per_device_);
+
+    ScanResources resources;
+    resources.io_budget = budget.get();
+    resources.scheduler = &scheduler_;
+    resources.throttle = throttle_;
+
+    auto scanner = std::make_unique<VolumeScanner>();
+    scanner->SetTarget(target.c_str());
+    scanner->SetOptions(options);
+    scanner->SetResources(resources);
+    scanners_.push_back(std::move(scanner));
+    forwarders_.push_back(std::make_unique<Forwarder>(this, index++));
+  }
+}
+
+HRESULT MultiScanner::Scan(Listener* listener) {
+  listener_ = listener;
+
+  HRESULT result = S_OK;
+  for (size_t i = 0; i < scanners_.size(); ++i) {
+    result = scanners_[i]->Scan(forwarders_[i].get());
+    if (FAILED(result)) {
+      Cancel();
+      break;
+    }
+  }
+
+  return result;
+}
+
+void MultiScanner::Cancel() {
+  for (auto& scanner : scanners_)
+    scanner->Cancel();
+}
@@ -0,0 +1,73 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_MULTI_SCANNER_H_
+#define SCAN_VOLUME_APP_MULTI_SCANNER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/io_budget.h"
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+
+// Scans several targets at once, each with a VolumeScanner of its own.
+// Targets on the same physical device share an I/O budget, and every scan
+// shares one pool of workers for sorting and totaling, so that the whole
+// takes about as long as the slowest device.
+class MultiScanner {
+ public:
+  // Receives the progress of the scan of the target at |index| on its
+  // scanning thread.
+  class Listener {
+   public:
+    virtual void OnScanProgress(size_t index, VolumeScanner::Messages message,
+                                HRESULT result) = 0;
+
+   protected:
+    ~Listener() {}
+  };
+
+  // Allows |io_per_device| requests in flight on each physical device, and
+  // paces every scan with |throttle| together unless it is null.
+  MultiScanner(size_t io_per_device, Throttle* throttle);
+  ~MultiScanner();
+
+  // Replaces the targets, and drops the results of any earlier scans. Must
+  // not be called while scanning.
+  void SetTargets(const std::vector<std::wstring>& targets,
+                  const ScanOptions& options);
+
+  // Starts scanning every target, or cancels those already started if one
+  // fails to start. Must not be called until the listener was told that every
+  // scan started last time ended.
+  HRESULT Scan(Listener* listener);
+  void Cancel();
+
+  size_t target_count() const {
+    return scanners_.size();
+  }
+
+  VolumeScanner* scanner(size_t index) const {
+    return scanners_[index].get();
+  }
+
+ private:
+  class Forwarder;
+
+  const size_t io_per_device_;
+  Throttle* const throttle_;
+  Listener* listener_;
+  TaskScheduler scheduler_;
+  std::map<std::wstring, std::unique_ptr<IoBudget>> budgets_;
+  std::vector<std::unique_ptr<Forwarder>> forwarders_;
+
+  // Declared last, so that scans end before what they use goes away.
+  std::vector<std::unique_ptr<VolumeScanner>> scanners_;
+
+  MultiScanner(const MultiScanner&) = delete;
+  MultiScanner& operator=(const MultiScanner&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_MULTI_SCANNER_H_
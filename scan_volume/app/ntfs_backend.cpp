@@ -0,0 +1,857 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/ntfs_backend.h"
+
+#include <winioctl.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+
+#include "app/io_budget.h"
+#include "app/journal_replayer.h"
+#include "app/throttle.h"
+
+namespace {
+
+const DWORDLONG kRecordNumberMask = 0x0000FFFFFFFFFFFF;
+
+// Enumeration is split into ranges of no fewer MFT records than this.
+const DWORDLONG kMinRangeRecords = 64 * 1024;
+
+// Gets the size and allocated size of the file open as |handle| in a single
+// query.
+bool GetFileSizes(HANDLE handle, LARGE_INTEGER* size,
+                  LARGE_INTEGER* allocated) {
+  FILE_STANDARD_INFO info;
+  if (!GetFileInformationByHandleEx(handle, FileStandardInfo, &info,
+                                    sizeof(info)))
+    return false;
+
+  *size = info.EndOfFile;
+  *allocated = info.AllocationSize;
+  return true;
+}
+
+bool GetFileSize(const std::wstring& path, LARGE_INTEGER* size,
+                 LARGE_INTEGER* allocated) {
+  bool succeeded = false;
+
+  HANDLE handle = CreateFileW(
+      path.c_str(), FILE_READ_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
+      NULL);
+  if (handle != INVALID_HANDLE_VALUE) {
+    if (GetFileSizes(handle, size, allocated))
+      succeeded = true;
+
+    CloseHandle(handle);
+    handle = INVALID_HANDLE_VALUE;
+  }
+
+  if (!succeeded) {
+    WIN32_FIND_DATAW find_data;
+    handle = FindFirstFileW(path.c_str(), &find_data);
+    if (handle != INVALID_HANDLE_VALUE) {
+      size->LowPart = find_data.nFileSizeLow;
+      size->HighPart = find_data.nFileSizeHigh;
+      allocated->QuadPart = -1;
+      succeeded = true;
+
+      FindClose(handle);
+      handle = INVALID_HANDLE_VALUE;
+    }
+  }
+
+  return succeeded;
+}
+
+// Sets both sizes to -1 if the file can't be sized.
+void GetFileSizeById(HANDLE volume_hint, const FileId& id, LARGE_INTEGER* size,
+                     LARGE_INTEGER* allocated) {
+  size->QuadPart = allocated->QuadPart = -1;
+
+  HANDLE handle = OpenFileByFileId(volume_hint, id, FILE_READ_ATTRIBUTES);
+  if (handle == INVALID_HANDLE_VALUE)
+    return;
+
+  if (!GetFileSizes(handle, size, allocated))
+    size->QuadPart = allocated->QuadPart = -1;
+
+  CloseHandle(handle);
+  handle = INVALID_HANDLE_VALUE;
+}
+
+bool QueryJournal(HANDLE volume, USN_JOURNAL_DATA_V0* journal) {
+  DWORD bytes = 0;
+  return DeviceIoControl(volume, FSCTL_QUERY_USN_JOURNAL, nullptr, 0, journal,
+                         sizeof(*journal), &bytes, nullptr) != FALSE;
+}
+
+// Issues FSCTL_ENUM_USN_DATA on a thread of its own into two buffers in turn,
+// so that the next read is in flight while the last one is parsed. Reading
+// stops once it reaches MFT record number |last|. Each read takes a slot of
+// |io_budget|.
+class RecordStream {
+ public:
+  RecordStream(HANDLE volume, const MFT_ENUM_DATA_V1& query, DWORDLONG last,
+               IoBudget* io_budget, Throttle* throttle,
+               const std::atomic<bool>* cancel, ScanCounters* counters)
+      : volume_(volume),
+        query_(query),
+        last_(last),
+        io_budget_(io_budget),
+        throttle_(throttle),
+        cancel_(cancel),
+        counters_(counters),
+        current_(kNone),
+        stop_(false) {
+    for (auto& buffer : buffers_) {
+      buffer.data.resize(kBufferSize);
+      buffer.bytes = 0;
+      buffer.result = S_OK;
+      buffer.full = false;
+    }
+
+    try {
+      thread_ = std::thread(&RecordStream::ReadThread, this);
+    } catch (const std::system_error&) {
+      buffers_[0].result = E_FAIL;
+      buffers_[0].full = true;
+    }
+  }
+
+  ~RecordStream() {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stop_ = true;
+    }
+    changed_.notify_all();
+
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  // Hands back the records returned by the last call, and waits for those of
+  // the next read. Returns the error that ended the enumeration, such as
+  // ERROR_HANDLE_EOF, once there are no more.
+  HRESULT Next(const char** records, DWORD* size) {
+    std::unique_lock<std::mutex> lock(lock_);
+
+    auto next = 0;
+    if (current_ != kNone) {
+      buffers_[current_].full = false;
+      changed_.notify_all();
+      next = current_ ^ 1;
+    }
+
+    current_ = next;
+    auto& buffer = buffers_[current_];
+    changed_.wait(lock, [&buffer] { return buffer.full; });
+
+    if (FAILED(buffer.result))
+      return buffer.result;
+
+    *records = buffer.data.data() + sizeof(USN);
+    *size = buffer.bytes - sizeof(USN);
+
+    return S_OK;
+  }
+
+ private:
+  struct Buffer {
+    std::vector<char> data;
+    DWORD bytes;
+    HRESULT result;
+    bool full;
+  };
+
+  static const int kNone = -1;
+  static const DWORD kBufferSize = 256 * 1024;
+
+  void ReadThread() {
+    if (throttle_ != nullptr)
+      EnterBackgroundMode();
+
+    for (auto index = 0;; index ^= 1) {
+      auto& buffer = buffers_[index];
+
+      {
+        std::unique_lock<std::mutex> lock(lock_);
+        changed_.wait(lock, [this, &buffer] { return stop_ || !buffer.full; });
+        if (stop_)
+          break;
+      }
+
+      IoBudget::Slot slot(io_budget_);
+      HRESULT result = S_OK;
+      if (cancel_->load(std::memory_order_relaxed)) {
+        result = E_ABORT;
+      } else if ((query_.StartFileReferenceNumber & kRecordNumberMask) >=
+                 last_) {
+        result = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+      } else {
+        result = Read(&buffer);
+      }
+
+      {
+        std::lock_guard<std::mutex> guard(lock_);
+        buffer.result = result;
+        buffer.full = true;
+      }
+      changed_.notify_all();
+
+      if (FAILED(result))
+        break;
+    }
+  }
+
+  // Reads the next records into |buffer|, and moves on past them.
+  HRESULT Read(Buffer* buffer) {
+    Throttle::Operation operation(throttle_, cancel_);
+    if (!DeviceIoControl(volume_, FSCTL_ENUM_USN_DATA, &query_, sizeof(query_),
+                         buffer->data.data(), kBufferSize, &buffer->bytes,
+                         nullptr))
+      return HRESULT_FROM_WIN32(GetLastError());
+
+    if (buffer->bytes < sizeof(USN))
+      return E_FAIL;
+
+    operation.set_bytes(buffer->bytes);
+    query_.StartFileReferenceNumber =
+        *reinterpret_cast<DWORDLONG*>(buffer->data.data());
+    counters_->Add(ScanCounters::BytesRead, buffer->bytes);
+
+    return S_OK;
+  }
+
+  const HANDLE volume_;
+  MFT_ENUM_DATA_V1 query_;
+  const DWORDLONG last_;
+  IoBudget* const io_budget_;
+  Throttle* const throttle_;
+  const std::atomic<bool>* const cancel_;
+  ScanCounters* const counters_;
+
+  std::mutex lock_;
+  std::condition_variable changed_;
+  Buffer buffers_[2];
+  int current_;
+  bool stop_;
+  std::thread thread_;
+
+  RecordStream(const RecordStream&) = delete;
+  RecordStream& operator=(const RecordStream&) = delete;
+};
+
+}  // namespace
+
+HANDLE OpenFileByFileId(HANDLE hint, const FileId& id, DWORD access) {
+  FILE_ID_DESCRIPTOR descriptor{sizeof(descriptor)};
+  if (id.high() == 0) {
+    descriptor.Type = FileIdType;
+    descriptor.FileId.QuadPart = static_cast<LONGLONG>(id.low());
+  } else {
+    descriptor.Type = ExtendedFileIdType;
+    memcpy(descriptor.ExtendedFileId.Identifier, id.data(), id.size());
+  }
+
+  return OpenFileById(
+      hint, &descriptor, access,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS);
+}
+
+NtfsBackend::NtfsBackend(const std::wstring& target,
+                         const ScanOptions& options,
+                         const ScanResources& resources,
+                         const std::atomic<bool>* cancel,
+                         ScanCounters* counters)
+    : target_(target),
+      options_(options),
+      resources_(resources),
+      cancel_(cancel),
+      counters_(counters),
+      mft_result_(E_NOTIMPL),
+      metrics_() {}
+
+NtfsBackend::~NtfsBackend() {
+  if (mft_thread_.joinable())
+    mft_thread_.join();
+}
+
+HRESULT NtfsBackend::Enumerate() {
+  auto path = std::wstring(L"\\\\.\\").append(target_);
+  HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE)
+    return HRESULT_FROM_WIN32(GetLastError());
+
+  // Take the journal position first, so that changes made while enumerating
+  // are replayed by the next update.
+  USN_JOURNAL_DATA_V0 journal;
+  if (QueryJournal(handle, &journal)) {
+    cursor_.journal_id = journal.UsnJournalID;
+    cursor_.next_usn = journal.NextUsn;
+  }
+
+  DWORDLONG record_count = 0;
+  NTFS_VOLUME_DATA_BUFFER volume_data;
+  DWORD bytes = 0;
+  if (DeviceIoControl(handle, FSCTL_GET_NTFS_VOLUME_DATA, nullptr, 0,
+                      &volume_data, sizeof(volume_data), &bytes, nullptr)) {
+    record_count = volume_data.MftValidDataLength.QuadPart /
+                   volume_data.BytesPerFileRecordSegment;
+    counters_->SetRecordsExpected(record_count);
+  }
+
+  // Sizes come from the $MFT, which is read alongside the enumeration. Trees
+  // of directories only are sized from directory listings instead, so that
+  // neither the $MFT nor an index of every record has to be held.
+  if (!options_.directories_only)
+    tree_.Reserve(static_cast<size_t>(record_count));
+
+  if (tree_.record_count() > 0) {
+    try {
+      mft_thread_ = std::thread([this]() {
+        if (resources_.throttle != nullptr)
+          EnterBackgroundMode();
+
+        ReadMft();
+      });
+    } catch (const std::system_error&) {
+      // ReadSizes reads it after the enumeration instead.
+    }
+  }
+
+  // Split the MFT into ranges of record numbers, each enumerated and parsed
+  // on a thread of its own. Ranges are gathered in order as they complete.
+  CloseHandle(handle);
+  handle = INVALID_HANDLE_VALUE;
+
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+
+  DWORDLONG range_count =
+      std::min<DWORDLONG>(system_info.dwNumberOfProcessors,
+                          record_count / kMinRangeRecords);
+  if (resources_.throttle != nullptr && range_count > Throttle::kMaxThreads)
+    range_count = Throttle::kMaxThreads;
+  range_count = std::max<DWORDLONG>(range_count, 1);
+
+  std::vector<Range> ranges(static_cast<size_t>(range_count));
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    ranges[i].first = record_count * i / range_count;
+    ranges[i].last = record_count * (i + 1) / range_count;
+    ranges[i].result = S_OK;
+  }
+  ranges.back().last = MAXLONGLONG;
+
+  std::vector<std::thread> threads(ranges.size());
+  for (size_t i = 1; i < ranges.size(); ++i) {
+    try {
+      threads[i] = std::thread([this, &path, &ranges, i]() {
+        if (resources_.throttle != nullptr)
+          EnterBackgroundMode();
+
+        EnumerateRange(path, &ranges[i]);
+      });
+    } catch (const std::system_error&) {
+      break;
+    }
+  }
+
+  HRESULT error = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    auto& range = ranges[i];
+    if (threads[i].joinable())
+      threads[i].join();
+    else if (HRESULT_CODE(error) == ERROR_HANDLE_EOF)
+      EnumerateRange(path, &range);
+
+    if (HRESULT_CODE(error) == ERROR_HANDLE_EOF) {
+      error = range.result;
+      tree_.Append(&range.batch);
+    }
+
+    range.batch = TreeBuilder::Batch();
+  }
+
+  if (HRESULT_CODE(error) != ERROR_HANDLE_EOF)
+    return error;
+
+  return tree_.Finish(target_, resources_.scheduler) ? S_OK : S_FALSE;
+}
+
+void NtfsBackend::EnumerateRange(const std::wstring& path, Range* range) {
+  // Requests on a handle opened for synchronous I/O are serialized, so each
+  // range reads through a handle of its own.
+  HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    range->result = HRESULT_FROM_WIN32(GetLastError());
+    return;
+  }
+
+  if (resources_.throttle != nullptr)
+    LowerIoPriority(handle);
+
+  auto file_mode = options_.directories_only ? TreeBuilder::NoFiles
+                   : options_.keep_file_names ? TreeBuilder::NamedFiles
+                                              : TreeBuilder::NamelessFiles;
+
+  {
+    RecordStream stream(handle,
+                        MFT_ENUM_DATA_V1{range->first, 0, MAXLONGLONG, 2, 3},
+                        range->last, resources_.io_budget,
+                        resources_.throttle, cancel_, counters_);
+
+    for (;;) {
+      const char* cursor;
+      DWORD bytes;
+      range->result = stream.Next(&cursor, &bytes);
+      if (FAILED(range->result))
+        break;
+
+      auto parsed = range->batch.parsed;
+      auto files = range->batch.files;
+      range->result = TreeBuilder::Parse(cursor, bytes, range->first,
+                                         range->last, file_mode,
+                                         &range->batch);
+      counters_->Add(ScanCounters::RecordsParsed,
+                     range->batch.parsed - parsed);
+      counters_->Add(ScanCounters::FilesFound, range->batch.files - files);
+      if (FAILED(range->result))
+        break;
+    }
+  }
+
+  CloseHandle(handle);
+  handle = INVALID_HANDLE_VALUE;
+}
+
+HRESULT NtfsBackend::Size() {
+  HRESULT result = ReadSizes();
+  if (FAILED(result) && result != E_ABORT)
+    result = SizeFiles();
+
+  if (SUCCEEDED(result)) {
+    for (auto& root : tree_.roots())
+      AggregateSizes(root.get(), resources_.scheduler);
+  }
+
+  return result;
+}
+
+void NtfsBackend::GetRoots(std::vector<std::unique_ptr<FileEntry>>* roots) {
+  tree_.TakeRoots(roots);
+}
+
+void NtfsBackend::GetUsage(UsageHistogram* usage) {
+  *usage = std::move(usage_);
+  usage_.Clear();
+}
+
+bool NtfsBackend::GetCursor(JournalCursor* cursor) {
+  // The journal can't be replayed onto files that were never kept.
+  if (options_.directories_only)
+    return false;
+
+  *cursor = cursor_;
+  return cursor_.valid();
+}
+
+HRESULT NtfsBackend::Update(std::vector<std::unique_ptr<FileEntry>>* roots,
+                            JournalCursor* cursor) {
+  HANDLE hint = CreateFileW(
+      (target_ + L'\\').c_str(), FILE_READ_ATTRIBUTES,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  if (hint == INVALID_HANDLE_VALUE)
+    return HRESULT_FROM_WIN32(GetLastError());
+
+  auto path = std::wstring(L"\\\\.\\").append(target_);
+  HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+    auto error = GetLastError();
+    CloseHandle(hint);
+    return HRESULT_FROM_WIN32(error);
+  }
+
+  if (resources_.throttle != nullptr)
+    LowerIoPriority(handle);
+
+  HRESULT result = S_OK;
+  USN_JOURNAL_DATA_V0 journal{};
+  if (!QueryJournal(handle, &journal))
+    result = HRESULT_FROM_WIN32(GetLastError());
+  else if (journal.UsnJournalID != cursor->journal_id ||
+           cursor->next_usn < journal.LowestValidUsn)
+    result = HRESULT_FROM_WIN32(ERROR_JOURNAL_ENTRY_DELETED);
+
+  JournalReplayer replayer(*roots);
+  READ_USN_JOURNAL_DATA_V1 read_query{
+      cursor->next_usn, MAXDWORD, FALSE, 0, 0, journal.UsnJournalID, 2, 3};
+  auto next_usn = cursor->next_usn;
+  char buffer[kBufferSize];
+
+  // Replay up to where the journal ended when the update began.
+  while (SUCCEEDED(result) && next_usn < journal.NextUsn) {
+    if (canceled()) {
+      result = E_ABORT;
+      break;
+    }
+
+    read_query.StartUsn = next_usn;
+    DWORD bytes = 0;
+    BOOL succeeded;
+    {
+      IoBudget::Slot slot(resources_.io_budget);
+      Throttle::Operation operation(resources_.throttle, cancel_);
+      succeeded = DeviceIoControl(handle, FSCTL_READ_USN_JOURNAL, &read_query,
+                                  sizeof(read_query), buffer, kBufferSize,
+                                  &bytes, nullptr);
+      if (succeeded)
+        operation.set_bytes(bytes);
+    }
+    if (!succeeded) {
+      result = HRESULT_FROM_WIN32(GetLastError());
+      break;
+    }
+
+    if (bytes < sizeof(USN)) {
+      result = E_FAIL;
+      break;
+    }
+
+    next_usn = *reinterpret_cast<USN*>(buffer);
+    counters_->Add(ScanCounters::BytesRead, bytes);
+    result = replayer.Apply(buffer + sizeof(USN), bytes - sizeof(USN));
+    if (bytes == sizeof(USN))
+      break;
+  }
+
+  CloseHandle(handle);
+  handle = INVALID_HANDLE_VALUE;
+
+  if (SUCCEEDED(result)) {
+    replayer.Resize([this, hint](const FileEntry* entry, LARGE_INTEGER* size,
+                                 LARGE_INTEGER* allocated) {
+      if (canceled())
+        return;
+
+      IoBudget::Slot slot(resources_.io_budget);
+      Throttle::Operation operation(resources_.throttle, cancel_);
+      GetFileSizeById(hint, entry->id, size, allocated);
+      counters_->Add(size->QuadPart < 0 ? ScanCounters::SizeFailures
+                                        : ScanCounters::FilesSized,
+                     1);
+    });
+
+    if (canceled()) {
+      result = E_ABORT;
+    } else {
+      replayer.Reorder();
+      replayer.Commit();
+    }
+  }
+
+  CloseHandle(hint);
+  hint = INVALID_HANDLE_VALUE;
+
+  if (FAILED(result))
+    return result;
+
+  cursor->next_usn = next_usn;
+
+  return S_OK;
+}
+
+HRESULT NtfsBackend::ReadSizes() {
+  if (tree_.record_count() == 0)
+    return E_NOTIMPL;
+
+  if (mft_thread_.joinable())
+    mft_thread_.join();
+  else
+    ReadMft();
+
+  if (canceled())
+    return E_ABORT;
+
+  if (FAILED(mft_result_))
+    return mft_result_;
+
+  std::vector<MftReader::Record> records;
+  records.swap(mft_records_);
+
+  // Size the records in a slice per worker, each tallied on its own, and
+  // merge the tallies afterwards. The records carry the extensions of the
+  // files even if the tree keeps no names.
+  TaskGroup group(resources_.scheduler);
+  auto slices = group.concurrency();
+  auto slice_size = (records.size() + slices - 1) / slices;
+  std::vector<UsageHistogram> usage(slices);
+
+  for (size_t slice = 0; slice < slices; ++slice) {
+    group.Post([this, &records, &usage, slice, slice_size]() {
+      DWORDLONG sized = 0;
+      auto end = std::min(records.size(), (slice + 1) * slice_size);
+
+      for (auto i = slice * slice_size; i < end; ++i) {
+        auto& record = records[i];
+        if (!record.in_use || record.directory)
+          continue;
+
+        auto entry = tree_.Find(i);
+        if (entry == nullptr ||
+            (entry->attributes & FILE_ATTRIBUTE_DIRECTORY))
+          continue;
+
+        entry->size.QuadPart = static_cast<LONGLONG>(record.size);
+        entry->allocated.QuadPart =
+            static_cast<LONGLONG>(record.allocated_size);
+        usage[slice].Add(record.name, entry->attributes,
+                         entry->size.QuadPart, entry->allocated.QuadPart);
+        ++sized;
+      }
+
+      counters_->Add(ScanCounters::FilesSized, sized);
+    });
+  }
+
+  group.Wait();
+
+  for (auto& slice : usage)
+    usage_.Merge(slice);
+
+  return S_OK;
+}
+
+void NtfsBackend::ReadMft() {
+  // The tree is named from enumeration, so only extensions are read here.
+  MftReader reader(MftReader::Extensions);
+  auto path = std::wstring(L"\\\\.\\").append(target_);
+  if (reader.Open(path.c_str()) &&
+      reader.Read(&mft_records_, cancel_, resources_.throttle,
+                  resources_.io_budget))
+    mft_result_ = S_OK;
+  else
+    mft_result_ = canceled() ? E_ABORT : E_FAIL;
+}
+
+HRESULT NtfsBackend::SizeFiles() {
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+
+  // Files without names can only be opened by their IDs.
+  HANDLE hint = INVALID_HANDLE_VALUE;
+  if (!options_.keep_file_names)
+    hint = CreateFileW((target_ + L'\\').c_str(), FILE_READ_ATTRIBUTES,
+                       FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                       nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS,
+                       NULL);
+
+  // Waiting on the device rather than the CPU, more workers than processors
+  // keep it busy. Throttled scans don't try to.
+  size_t concurrency = system_info.dwNumberOfProcessors * 3 / 2;
+  if (resources_.throttle != nullptr && concurrency > Throttle::kMaxThreads)
+    concurrency = Throttle::kMaxThreads;
+
+  {
+    TaskScheduler scheduler(
+        concurrency,
+        resources_.throttle != nullptr ? EnterBackgroundMode : nullptr);
+    worker_usage_.resize(scheduler.concurrency());
+
+    for (auto& root : tree_.roots()) {
+      auto directory = root.get();
+      scheduler.Post([this, &scheduler, hint, directory]() {
+        SizeDirectory(&scheduler, hint, directory);
+      });
+    }
+
+    scheduler.Wait();
+    metrics_ = scheduler.GetMetrics();
+  }
+
+  for (auto& usage : worker_usage_)
+    usage_.Merge(usage);
+  worker_usage_.clear();
+
+  if (hint != INVALID_HANDLE_VALUE) {
+    CloseHandle(hint);
+    hint = INVALID_HANDLE_VALUE;
+  }
+
+  return canceled() ? E_ABORT : S_OK;
+}
+
+void NtfsBackend::SizeDirectory(TaskScheduler* scheduler, HANDLE hint,
+                                FileEntry* directory) {
+  if (canceled())
+    return;
+
+  std::vector<FileEntry*> files;
+  for (auto& child : directory->children) {
+    auto entry = child.get();
+    if (entry->attributes & FILE_ATTRIBUTE_DIRECTORY)
+      scheduler->Post([this, scheduler, hint, entry]() {
+        SizeDirectory(scheduler, hint, entry);
+      });
+    else
+      files.push_back(entry);
+  }
+
+  counters_->SetQueueDepth(scheduler->queued());
+
+  if (files.empty() && !options_.directories_only)
+    return;
+
+  std::vector<FileEntry*> tree_path;
+  for (auto cursor = directory; cursor != nullptr; cursor = cursor->parent)
+    tree_path.push_back(cursor);
+
+  std::wstring path(L"\\\\?");
+  path.reserve(MAX_PATH);
+  for (auto i = tree_path.rbegin(), end = tree_path.rend(); i != end; ++i) {
+    path.push_back(L'\\');
+    path.append((*i)->name);
+  }
+  path.push_back(L'\\');
+
+  BOOL wow64 = FALSE;
+  void* redirection = nullptr;
+  if (IsWow64Process(GetCurrentProcess(), &wow64) && wow64)
+    Wow64DisableWow64FsRedirection(&redirection);
+
+  // The listing and the files it leaves out take one slot.
+  IoBudget::Slot slot(resources_.io_budget);
+  auto& usage = worker_usage_[scheduler->worker_index()];
+
+  // Size every file from a single listing of the directory, which reports
+  // the ID, size and allocated size of each, and open only those the listing
+  // doesn't report.
+  std::sort(files.begin(), files.end(),
+            [](const FileEntry* a, const FileEntry* b) {
+              return a->id < b->id;
+            });
+  std::vector<bool> resolved(files.size());
+
+  DWORDLONG listed = 0;
+  HANDLE listing;
+  {
+    Throttle::Operation operation(resources_.throttle, cancel_);
+    listing = CreateFileW(
+        path.c_str(), FILE_LIST_DIRECTORY,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+  }
+  if (listing != INVALID_HANDLE_VALUE) {
+    if (resources_.throttle != nullptr)
+      LowerIoPriority(listing);
+
+    std::vector<char> buffer(kBufferSize);
+
+    while (!canceled() && ReadListing(listing, &buffer)) {
+      for (DWORD offset = 0, next = 1; next != 0; offset += next) {
+        auto info =
+            reinterpret_cast<const FILE_ID_EXTD_DIR_INFO*>(&buffer[offset]);
+        next = info->NextEntryOffset;
+        if (info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+          continue;
+
+        FileId id(info->FileId);
+        auto name_length = info->FileNameLength / sizeof(info->FileName[0]);
+
+        // Fold the file into the totals of the directory. The listing doesn't
+        // tell files with several links apart, so every file is remembered.
+        if (options_.directories_only) {
+          if (!options_.dedupe_hard_links || listed_.Insert(id)) {
+            directory->size.QuadPart += info->EndOfFile.QuadPart;
+            directory->allocated.QuadPart += info->AllocationSize.QuadPart;
+            usage.Add(info->FileName, name_length, info->FileAttributes,
+                      info->EndOfFile.QuadPart,
+                      info->AllocationSize.QuadPart);
+          }
+          ++listed;
+          continue;
+        }
+
+        auto match = std::lower_bound(files.begin(), files.end(), id,
+                                      [](const FileEntry* a, const FileId& b) {
+                                        return a->id < b;
+                                      });
+        if (match == files.end() || !((*match)->id == id))
+          continue;
+
+        (*match)->size = info->EndOfFile;
+        (*match)->allocated = info->AllocationSize;
+        resolved[match - files.begin()] = true;
+        usage.Add(info->FileName, name_length, (*match)->attributes,
+                  info->EndOfFile.QuadPart, info->AllocationSize.QuadPart);
+      }
+    }
+
+    CloseHandle(listing);
+    listing = INVALID_HANDLE_VALUE;
+  }
+
+  DWORDLONG failures = 0;
+  auto prefix = path.size();
+  for (size_t i = 0; i < files.size() && !canceled(); ++i) {
+    if (resolved[i])
+      continue;
+
+    Throttle::Operation operation(resources_.throttle, cancel_);
+    if (files[i]->name.empty()) {
+      GetFileSizeById(hint, files[i]->id, &files[i]->size,
+                      &files[i]->allocated);
+      if (files[i]->size.QuadPart < 0)
+        ++failures;
+    } else {
+      path.resize(prefix);
+      path.append(files[i]->name);
+      if (!GetFileSize(path, &files[i]->size, &files[i]->allocated)) {
+        files[i]->size.QuadPart = files[i]->allocated.QuadPart = -1;
+        ++failures;
+      }
+    }
+
+    usage.Add(files[i]->name, files[i]->attributes,
+              files[i]->size.QuadPart, files[i]->allocated.QuadPart);
+  }
+
+  counters_->Add(ScanCounters::FilesSized,
+                 listed + files.size() - failures);
+  counters_->Add(ScanCounters::SizeFailures, failures);
+
+  if (wow64)
+    Wow64RevertWow64FsRedirection(&redirection);
+}
+
+// Reads the next entries of the directory open as |listing| into |buffer|,
+// and charges the bytes they take up.
+bool NtfsBackend::ReadListing(HANDLE listing, std::vector<char>* buffer) {
+  Throttle::Operation operation(resources_.throttle, cancel_);
+  if (!GetFileInformationByHandleEx(listing, FileIdExtdDirectoryInfo,
+                                    buffer->data(), kBufferSize))
+    return false;
+
+  DWORD offset = 0;
+  auto info = reinterpret_cast<const FILE_ID_EXTD_DIR_INFO*>(buffer->data());
+  while (info->NextEntryOffset != 0) {
+    offset += info->NextEntryOffset;
+    info = reinterpret_cast<const FILE_ID_EXTD_DIR_INFO*>(&(*buffer)[offset]);
+  }
+
+  operation.set_bytes(offset + FIELD_OFFSET(FILE_ID_EXTD_DIR_INFO, FileName) +
+                      info->FileNameLength);
+  return true;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_NTFS_BACKEND_H_
+#define SCAN_VOLUME_APP_NTFS_BACKEND_H_
+
+#include <windows.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "app/file_id_set.h"
+#include "app/mft_reader.h"
+#include "app/scan_backend.h"
+#include "app/task_scheduler.h"
+#include "app/tree_builder.h"
+#include "app/usage_histogram.h"
+
+// Opens the file identified by |id| on the volume |hint| is a handle on, or
+// returns INVALID_HANDLE_VALUE.
+HANDLE OpenFileByFileId(HANDLE hint, const FileId& id, DWORD access);
+
+// Enumerates a local volume through its USN journal and sizes files from the
+// $MFT, or from a listing of each directory when the volume can't be read raw.
+// The enumeration is split into ranges of MFT records read and parsed in
+// parallel, and reading the $MFT overlaps it.
+class NtfsBackend : public ScanBackend {
+ public:
+  NtfsBackend(const std::wstring& target, const ScanOptions& options,
+              const ScanResources& resources, const std::atomic<bool>* cancel,
+              ScanCounters* counters);
+  ~NtfsBackend();
+
+  HRESULT Enumerate() override;
+  HRESULT Size() override;
+  void GetRoots(std::vector<std::unique_ptr<FileEntry>>* roots) override;
+  void GetUsage(UsageHistogram* usage) override;
+  bool GetCursor(JournalCursor* cursor) override;
+  HRESULT Update(std::vector<std::unique_ptr<FileEntry>>* roots,
+                 JournalCursor* cursor) override;
+
+  // Returns the scheduler metrics of the last per-file sizing pass.
+  const TaskScheduler::Metrics& metrics() const {
+    return metrics_;
+  }
+
+ private:
+  // A range of MFT record numbers, and what enumerating it produced.
+  struct Range {
+    DWORDLONG first;
+    DWORDLONG last;
+    TreeBuilder::Batch batch;
+    HRESULT result;
+  };
+
+  static const size_t kBufferSize = 64 * 1024;
+
+  bool canceled() const {
+    return cancel_->load(std::memory_order_relaxed);
+  }
+
+  void EnumerateRange(const std::wstring& path, Range* range);
+
+  HRESULT ReadSizes();
+  void ReadMft();
+  HRESULT SizeFiles();
+  void SizeDirectory(TaskScheduler* scheduler, HANDLE hint,
+                     FileEntry* directory);
+  bool ReadListing(HANDLE listing, std::vector<char>* buffer);
+
+  const std::wstring target_;
+  const ScanOptions options_;
+  const ScanResources resources_;
+  const std::atomic<bool>* const cancel_;
+  ScanCounters* const counters_;
+
+  TreeBuilder tree_;
+  JournalCursor cursor_;
+
+  // The $MFT is read on |mft_thread_| while Enumerate runs.
+  std::thread mft_thread_;
+  std::vector<MftReader::Record> mft_records_;
+  HRESULT mft_result_;
+
+  // The files folded into directories so far, when hard links are deduped.
+  FileIdSet listed_;
+
+  // The tallies of the files sized, and those of each worker sizing them
+  // from directory listings until they are merged.
+  UsageHistogram usage_;
+  std::vector<UsageHistogram> worker_usage_;
+
+  TaskScheduler::Metrics metrics_;
+
+  NtfsBackend(const NtfsBackend&) = delete;
+  NtfsBackend& operator=(const NtfsBackend&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_NTFS_BACKEND_H_
@@ -0,0 +1,70 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_PORT_H_
+#define SCAN_VOLUME_APP_PORT_H_
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else  // _WIN32
+
+#include <cerrno>
+#include <cstdint>
+
+// The subset of Win32 types and constants the scanner core relies on, so that
+// it can be built against POSIX backends.
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int64_t LONGLONG;
+typedef uint64_t DWORDLONG;
+typedef int32_t HRESULT;
+
+typedef union _LARGE_INTEGER {
+  struct {
+    DWORD LowPart;
+    LONG HighPart;
+  };
+  LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _FILE_ID_128 {
+  BYTE Identifier[16];
+} FILE_ID_128;
+
+#define MAXDWORD 0xFFFFFFFF
+#define MAXLONGLONG 0x7FFFFFFFFFFFFFFFLL
+
+#define FILE_ATTRIBUTE_READONLY 0x00000001
+#define FILE_ATTRIBUTE_HIDDEN 0x00000002
+#define FILE_ATTRIBUTE_SYSTEM 0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE 0x00000020
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define FILE_ATTRIBUTE_SPARSE_FILE 0x00000200
+#define FILE_ATTRIBUTE_REPARSE_POINT 0x00000400
+#define FILE_ATTRIBUTE_COMPRESSED 0x00000800
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001)
+#define E_ABORT ((HRESULT)0x80004004)
+#define E_FAIL ((HRESULT)0x80004005)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000E)
+#define E_INVALIDARG ((HRESULT)0x80070057)
+
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+// errno values are wrapped with FACILITY_ITF, as Win32 error codes are
+// wrapped with FACILITY_WIN32.
+#define HRESULT_FROM_ERRNO(e) \
+  ((e) <= 0 ? (HRESULT)(e)    \
+            : (HRESULT)(((e)&0x0000FFFF) | (4 << 16) | 0x80000000))
+
+#endif  // _WIN32
+
+#endif  // SCAN_VOLUME_APP_PORT_H_
@@ -0,0 +1,384 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/posix_backend.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#include "app/io_budget.h"
+#include "app/throttle.h"
+#include "app/utf16.h"
+
+namespace {
+
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;  // NOLINT(runtime/int)
+  unsigned char d_type;
+  char d_name[];
+};
+
+const unsigned int kStatxMask =
+    STATX_TYPE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS;
+
+// The unit of stx_blocks, whatever the block size of the file system.
+const LONGLONG kBlockSize = 512;
+const int kStatxFlags =
+    AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC;
+
+}  // namespace
+
+PosixBackend::PosixBackend(const std::wstring& target,
+                           const ScanOptions& options,
+                           const ScanResources& resources,
+                           const std::atomic<bool>* cancel,
+                           ScanCounters* counters)
+    : target_(target),
+      options_(options),
+      resources_(resources),
+      cancel_(cancel),
+      counters_(counters),
+      device_(0),
+      max_queued_(0),
+      busy_(0) {}
+
+PosixBackend::~PosixBackend() {
+  for (auto& task : queue_)
+    close(task.fd);
+}
+
+HRESULT PosixBackend::Enumerate() {
+  auto path = EncodeUtf8(target_);
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1)
+    return HRESULT_FROM_ERRNO(errno);
+
+  struct statx stat;
+  if (statx(fd, "", AT_EMPTY_PATH | kStatxFlags, kStatxMask, &stat) != 0) {
+    auto error = errno;
+    close(fd);
+    return HRESULT_FROM_ERRNO(error);
+  }
+
+  device_ = makedev(stat.stx_dev_major, stat.stx_dev_minor);
+
+  // The inodes in use bound the entries to expect, where the file system
+  // keeps count of them.
+  struct statvfs file_system;
+  if (fstatvfs(fd, &file_system) == 0 &&
+      file_system.f_files > file_system.f_ffree)
+    counters_->SetRecordsExpected(file_system.f_files - file_system.f_ffree);
+
+  root_ = std::make_unique<FileEntry>();
+  root_->id = static_cast<DWORDLONG>(stat.stx_ino);
+  root_->attributes = FILE_ATTRIBUTE_DIRECTORY;
+  root_->name = target_;
+
+  size_t concurrency = std::max(1u, std::thread::hardware_concurrency());
+  if (resources_.throttle != nullptr && concurrency > Throttle::kMaxThreads)
+    concurrency = Throttle::kMaxThreads;
+  max_queued_ = concurrency * 2;
+  queue_.push_back(Task{root_.get(), fd});
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < concurrency; ++i) {
+    try {
+      threads.push_back(std::thread(&PosixBackend::WorkerThread, this));
+    } catch (const std::system_error&) {
+      break;
+    }
+  }
+
+  WorkerThread();
+
+  for (auto& thread : threads)
+    thread.join();
+
+  return canceled() ? E_ABORT : S_OK;
+}
+
+HRESULT PosixBackend::Size() {
+  if (canceled())
+    return E_ABORT;
+
+  AggregateSizes(root_.get(), resources_.scheduler);
+
+  return S_OK;
+}
+
+void PosixBackend::GetRoots(std::vector<std::unique_ptr<FileEntry>>* roots) {
+  roots->clear();
+  if (root_ != nullptr)
+    roots->push_back(std::move(root_));
+}
+
+void PosixBackend::GetUsage(UsageHistogram* usage) {
+  *usage = std::move(usage_);
+  usage_.Clear();
+}
+
+bool PosixBackend::GetCursor(JournalCursor* /*cursor*/) {
+  return false;
+}
+
+HRESULT PosixBackend::Update(
+    std::vector<std::unique_ptr<FileEntry>>* /*roots*/,
+    JournalCursor* /*cursor*/) {
+  return E_NOTIMPL;
+}
+
+void PosixBackend::WorkerThread() {
+  Worker worker;
+  std::unique_lock<std::mutex> lock(queue_lock_);
+
+  for (;;) {
+    queue_available_.wait(lock,
+                          [this] { return !queue_.empty() || busy_ == 0; });
+    if (queue_.empty())
+      break;
+
+    auto task = queue_.back();
+    queue_.pop_back();
+    counters_->SetQueueDepth(queue_.size());
+    ++busy_;
+
+    lock.unlock();
+    Traverse(task.entry, task.fd, &worker);
+    lock.lock();
+
+    if (--busy_ == 0 && queue_.empty())
+      queue_available_.notify_all();
+  }
+
+  usage_.Merge(worker.usage);
+}
+
+// Walks depth first from |directory| on the calling thread, handing
+// subdirectories to other workers while the queue has room. Takes ownership
+// of |fd|.
+void PosixBackend::Traverse(FileEntry* directory, int fd, Worker* worker) {
+  std::vector<Level> levels;
+  levels.push_back(Level{directory, fd, 0, {}, 0});
+  List(directory, fd, worker, &levels.back().subdirectories);
+
+  // The levels from here down are open.
+  size_t first_open = 0;
+
+  while (!levels.empty()) {
+    auto& level = levels.back();
+
+    if (level.next == level.subdirectories.size() || canceled()) {
+      if (first_open > 0 && first_open == levels.size() - 1) {
+        auto& parent = levels[--first_open];
+        if (!canceled())
+          parent.fd = Reopen(level.fd, parent);
+      }
+
+      if (level.fd != -1)
+        close(level.fd);
+      levels.pop_back();
+      continue;
+    }
+
+    auto subdirectory = level.subdirectories[level.next].first;
+    auto& name = level.subdirectories[level.next].second;
+    ++level.next;
+
+    // Whatever can't be opened is left out of the totals, but counted.
+    int child = -1;
+    if (level.fd != -1) {
+      Throttle::Operation operation(resources_.throttle, cancel_);
+      child = openat(level.fd, name.c_str(),
+                     O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (child == -1) {
+      Unreadable(subdirectory);
+      continue;
+    }
+
+    if (Offer(subdirectory, child))
+      continue;
+
+    levels.push_back(Level{subdirectory, child, 0, {}, 0});
+    if (levels.size() - first_open > kMaxOpenLevels) {
+      auto& shallowest = levels[first_open++];
+      struct stat stat;
+      if (fstat(shallowest.fd, &stat) == 0)
+        shallowest.inode = stat.st_ino;
+      close(shallowest.fd);
+      shallowest.fd = -1;
+    }
+
+    List(subdirectory, child, worker, &levels.back().subdirectories);
+  }
+}
+
+// Adds the entries of |directory|, open as |fd|, and collects the
+// subdirectories on the same file system into |subdirectories|.
+void PosixBackend::List(FileEntry* directory, int fd, Worker* worker,
+                        Subdirectories* subdirectories) {
+  auto buffer = &worker->buffer;
+
+  while (!canceled()) {
+    // A listing and the lookups of the names in it take one slot.
+    IoBudget::Slot slot(resources_.io_budget);
+
+    long length;  // NOLINT(runtime/int)
+    {
+      Throttle::Operation operation(resources_.throttle, cancel_);
+      length = syscall(SYS_getdents64, fd, buffer->data(), buffer->size());
+      if (length > 0)
+        operation.set_bytes(static_cast<DWORDLONG>(length));
+    }
+    if (length < 0) {
+      Unreadable(directory);
+      break;
+    }
+    if (length == 0)
+      break;
+    DWORDLONG parsed = 0, files = 0, sized = 0, failures = 0;
+
+    for (long offset = 0; offset < length;) {  // NOLINT(runtime/int)
+      auto dirent = reinterpret_cast<linux_dirent64*>(&(*buffer)[offset]);
+      offset += dirent->d_reclen;
+
+      auto name = dirent->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+
+      ++parsed;
+
+      DWORD attributes;
+      LONGLONG size = 0, allocated = 0;
+      bool descend = false;
+
+      struct statx stat;
+      int status;
+      {
+        Throttle::Operation operation(resources_.throttle, cancel_);
+        status = statx(fd, name, kStatxFlags, kStatxMask, &stat);
+      }
+
+      if (status != 0) {
+        attributes = dirent->d_type == DT_DIR ? FILE_ATTRIBUTE_DIRECTORY
+                                              : FILE_ATTRIBUTE_NORMAL;
+        size = allocated = -1;
+        ++failures;
+      } else if (S_ISDIR(stat.stx_mode)) {
+        attributes = FILE_ATTRIBUTE_DIRECTORY;
+        descend = makedev(stat.stx_dev_major, stat.stx_dev_minor) == device_;
+      } else {
+        attributes = S_ISLNK(stat.stx_mode) ? FILE_ATTRIBUTE_REPARSE_POINT
+                                            : FILE_ATTRIBUTE_NORMAL;
+        size = static_cast<LONGLONG>(stat.stx_size);
+        allocated = stat.stx_mask & STATX_BLOCKS
+                        ? static_cast<LONGLONG>(stat.stx_blocks) * kBlockSize
+                        : -1;
+        ++sized;
+
+        // Count the data of each file once, under the first of its links.
+        if (options_.dedupe_hard_links && stat.stx_nlink > 1 &&
+            !linked_.Insert(FileId(static_cast<DWORDLONG>(stat.stx_ino))))
+          size = allocated = 0;
+
+        // Only the extension is decoded when names aren't kept.
+        auto extension = strrchr(name, '.');
+        if (extension != nullptr)
+          DecodeUtf8(extension, &worker->extension);
+        else
+          worker->extension.clear();
+
+        worker->usage.Add(worker->extension, attributes, size, allocated);
+      }
+
+      bool is_directory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+      if (!is_directory)
+        ++files;
+
+      // Fold files into the total of their directory and drop them.
+      if (options_.directories_only && !is_directory) {
+        if (size > 0)
+          directory->size.QuadPart += size;
+        if (allocated > 0)
+          directory->allocated.QuadPart += allocated;
+        continue;
+      }
+
+      auto entry = std::make_unique<FileEntry>();
+      entry->parent = directory;
+      entry->id = static_cast<DWORDLONG>(dirent->d_ino);
+      entry->attributes = attributes;
+      entry->size.QuadPart = size;
+      entry->allocated.QuadPart = allocated;
+
+      if (options_.keep_file_names || is_directory)
+        DecodeUtf8(name, &entry->name);
+
+      if (descend)
+        subdirectories->push_back(std::make_pair(entry.get(), name));
+
+      directory->children.push_back(std::move(entry));
+    }
+
+    counters_->Add(ScanCounters::BytesRead, static_cast<DWORDLONG>(length));
+    counters_->Add(ScanCounters::RecordsParsed, parsed);
+    counters_->Add(ScanCounters::FilesFound, files);
+    counters_->Add(ScanCounters::FilesSized, sized);
+    counters_->Add(ScanCounters::SizeFailures, failures);
+  }
+}
+
+// Hands |directory|, open as |fd|, to the next idle worker if the queue has
+// room. Takes ownership of |fd| if so.
+bool PosixBackend::Offer(FileEntry* directory, int fd) {
+  std::lock_guard<std::mutex> guard(queue_lock_);
+  if (queue_.size() >= max_queued_)
+    return false;
+
+  queue_.push_back(Task{directory, fd});
+  counters_->SetQueueDepth(queue_.size());
+  queue_available_.notify_one();
+  return true;
+}
+
+// Opens the parent of the directory open as |fd| through "..", and checks
+// that it is still |parent|, which may have been moved or replaced since it
+// was closed. Returns -1 if not.
+int PosixBackend::Reopen(int fd, const Level& parent) {
+  if (fd == -1)
+    return -1;
+
+  int result;
+  {
+    Throttle::Operation operation(resources_.throttle, cancel_);
+    result = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  }
+  if (result == -1)
+    return -1;
+
+  struct stat stat;
+  if (fstat(result, &stat) != 0 || stat.st_dev != device_ ||
+      stat.st_ino != parent.inode) {
+    close(result);
+    return -1;
+  }
+
+  return result;
+}
+
+void PosixBackend::Unreadable(FileEntry* directory) {
+  directory->size.QuadPart = -1;
+  directory->allocated.QuadPart = -1;
+  counters_->Add(ScanCounters::SizeFailures, 1);
+}
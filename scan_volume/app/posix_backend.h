@@ -0,0 +1,109 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_POSIX_BACKEND_H_
+#define SCAN_VOLUME_APP_POSIX_BACKEND_H_
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "app/file_id_set.h"
+#include "app/scan_backend.h"
+#include "app/usage_histogram.h"
+
+// Walks a directory tree on Linux with getdents64 and statx, in parallel.
+// Every lookup is relative to an open directory descriptor, and the walk
+// stays on the file system of the target like `du -x`.
+class PosixBackend : public ScanBackend {
+ public:
+  PosixBackend(const std::wstring& target, const ScanOptions& options,
+               const ScanResources& resources, const std::atomic<bool>* cancel,
+               ScanCounters* counters);
+  ~PosixBackend();
+
+  HRESULT Enumerate() override;
+  HRESULT Size() override;
+  void GetRoots(std::vector<std::unique_ptr<FileEntry>>* roots) override;
+  void GetUsage(UsageHistogram* usage) override;
+  bool GetCursor(JournalCursor* cursor) override;
+  HRESULT Update(std::vector<std::unique_ptr<FileEntry>>* roots,
+                 JournalCursor* cursor) override;
+
+ private:
+  struct Task {
+    FileEntry* entry;
+    int fd;
+  };
+
+  static const size_t kBufferSize = 64 * 1024;
+
+  // Walking down a deep tree keeps no more directories than this open at a
+  // time on each thread. The others are opened again on the way back up.
+  static const size_t kMaxOpenLevels = 16;
+
+  typedef std::vector<std::pair<FileEntry*, std::string>> Subdirectories;
+
+  // A directory on the path a worker is walking down, and those of its
+  // subdirectories left to walk. |fd| is -1 once closed, and |inode| is kept
+  // from then on to tell whether it is the same directory when opened again.
+  struct Level {
+    FileEntry* directory;
+    int fd;
+    ino_t inode;
+    Subdirectories subdirectories;
+    size_t next;
+  };
+
+  // What each worker thread keeps to itself while walking.
+  struct Worker {
+    Worker() : buffer(kBufferSize) {}
+
+    std::vector<char> buffer;
+    std::wstring extension;
+    UsageHistogram usage;
+  };
+
+  bool canceled() const {
+    return cancel_->load(std::memory_order_relaxed);
+  }
+
+  void WorkerThread();
+  void Traverse(FileEntry* directory, int fd, Worker* worker);
+  void List(FileEntry* directory, int fd, Worker* worker,
+            Subdirectories* subdirectories);
+  bool Offer(FileEntry* directory, int fd);
+  int Reopen(int fd, const Level& parent);
+  void Unreadable(FileEntry* directory);
+
+  const std::wstring target_;
+  const ScanOptions options_;
+  const ScanResources resources_;
+  const std::atomic<bool>* const cancel_;
+  ScanCounters* const counters_;
+
+  std::unique_ptr<FileEntry> root_;
+  dev_t device_;
+
+  // The files with several links counted so far.
+  FileIdSet linked_;
+
+  // The tallies of the workers that have finished.
+  UsageHistogram usage_;
+
+  std::mutex queue_lock_;
+  std::condition_variable queue_available_;
+  std::vector<Task> queue_;
+  size_t max_queued_;
+  size_t busy_;
+
+  PosixBackend(const PosixBackend&) = delete;
+  PosixBackend& operator=(const PosixBackend&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_POSIX_BACKEND_H_
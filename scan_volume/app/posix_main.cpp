@@ -0,0 +1,21 @@
+// Copyright (c) 2016 dacci.org
+
+#include <string>
+#include <vector>
+
+#include "app/console_scan.h"
+#include "app/utf16.h"
+
+// There is no window on Linux, so the headless scan is the whole program.
+// Arguments are taken to be UTF-8, as file names are.
+int main(int argc, char** argv) {
+  std::vector<std::wstring> arguments(argc);
+  std::vector<wchar_t*> pointers;
+  for (int i = 0; i < argc; ++i) {
+    DecodeUtf8(argv[i], &arguments[i]);
+    pointers.push_back(&arguments[i][0]);
+  }
+  pointers.push_back(nullptr);
+
+  return RunConsoleScan(argc, pointers.data());
+}
@@ -0,0 +1,313 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/query_engine.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || \
+    defined(__SSE2__)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
+#include <mutex>
+
+#include "app/utf16.h"
+
+namespace {
+
+// The number of entries indexed and searched per task.
+const size_t kChunkEntries = 64 * 1024;
+
+std::string Fold(const std::wstring& text) {
+  std::wstring folded(text);
+  for (auto& c : folded)
+    c = static_cast<wchar_t>(std::towlower(c));
+
+  return EncodeUtf8(folded);
+}
+
+// Appends |text| folded to |output|, without converting names of ASCII alone
+// twice.
+void AppendFolded(const std::wstring& text, std::string* output) {
+  auto offset = output->size();
+
+  for (auto c : text) {
+    if (c >= 0x80) {
+      output->resize(offset);
+      output->append(Fold(text));
+      return;
+    }
+
+    output->push_back(static_cast<char>(L'A' <= c && c <= L'Z' ? c + 0x20
+                                                                : c));
+  }
+}
+
+// Returns the offset of the character after the one at |offset|.
+size_t NextCharacter(const char* text, size_t length, size_t offset) {
+  ++offset;
+  while (offset < length && (text[offset] & 0xC0) == 0x80)
+    ++offset;
+
+  return offset;
+}
+
+bool MatchGlob(const char* name, size_t length, const std::string& glob) {
+  size_t n = 0, g = 0;
+  size_t star = std::string::npos, resume = 0;
+
+  while (n < length) {
+    if (g < glob.size() && glob[g] == '*') {
+      star = ++g;
+      resume = n;
+    } else if (g < glob.size() && glob[g] == '?') {
+      n = NextCharacter(name, length, n);
+      ++g;
+    } else if (g < glob.size() && glob[g] == name[n]) {
+      ++n;
+      ++g;
+    } else if (star != std::string::npos) {
+      // Let the last star take one more character, and try again after it.
+      resume = NextCharacter(name, length, resume);
+      n = resume;
+      g = star;
+    } else {
+      return false;
+    }
+  }
+
+  while (g < glob.size() && glob[g] == '*')
+    ++g;
+
+  return g == glob.size();
+}
+
+#ifdef USE_SSE2
+
+int LowestBit(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+#endif  // USE_SSE2
+
+// Returns the offset of the first |needle| in |text| at or after |offset|, or
+// |length| if there is none. 16 candidates are filtered at once by comparing
+// both their first and last bytes, and only those left are compared whole.
+size_t Find(const char* text, size_t length, size_t offset,
+            const std::string& needle) {
+  auto size = needle.size();
+  if (size == 0 || size > length)
+    return length;
+
+  auto end = length - size + 1;
+
+#ifdef USE_SSE2
+  const auto first = _mm_set1_epi8(needle.front());
+  const auto last = _mm_set1_epi8(needle.back());
+
+  for (; offset + 16 <= end; offset += 16) {
+    auto heads = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(text + offset));
+    auto tails = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(text + offset + size - 1));
+    auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(heads, first), _mm_cmpeq_epi8(tails, last))));
+
+    while (mask != 0) {
+      auto candidate = offset + LowestBit(mask);
+      if (memcmp(text + candidate + 1, needle.data() + 1, size - 1) == 0)
+        return candidate;
+
+      mask &= mask - 1;
+    }
+  }
+#endif  // USE_SSE2
+
+  while (offset < end) {
+    auto found = static_cast<const char*>(
+        memchr(text + offset, needle.front(), end - offset));
+    if (found == nullptr)
+      break;
+
+    offset = found - text;
+    if (memcmp(found + 1, needle.data() + 1, size - 1) == 0)
+      return offset;
+
+    ++offset;
+  }
+
+  return length;
+}
+
+}  // namespace
+
+// A query with its names folded and encoded the way the index is.
+struct QueryEngine::Pattern {
+  explicit Pattern(const Query& query)
+      : query(query),
+        glob(Fold(query.glob)),
+        substring(Fold(query.substring)) {
+    if (!query.extension.empty())
+      suffix = '.' + Fold(query.extension);
+
+    // Every match contains each of these, so the longest is searched for.
+    needle = substring;
+    if (suffix.size() > needle.size())
+      needle = suffix;
+
+    for (size_t begin = 0, end; begin < glob.size(); begin = end + 1) {
+      end = std::min(glob.find_first_of("*?", begin), glob.size());
+      if (end - begin > needle.size())
+        needle = glob.substr(begin, end - begin);
+    }
+  }
+
+  bool Match(LONGLONG size, DWORD attributes, const char* name,
+             size_t length) const {
+    if (size < query.min_size || size > query.max_size ||
+        (attributes & query.attributes_set) != query.attributes_set ||
+        (attributes & query.attributes_clear) != 0)
+      return false;
+
+    if (!substring.empty() && Find(name, length, 0, substring) == length)
+      return false;
+
+    if (!suffix.empty() &&
+        (length < suffix.size() ||
+         memcmp(name + length - suffix.size(), suffix.data(),
+                suffix.size()) != 0))
+      return false;
+
+    return glob.empty() || MatchGlob(name, length, glob);
+  }
+
+  const Query& query;
+  std::string glob;
+  std::string substring;
+  std::string suffix;
+  std::string needle;
+};
+
+QueryEngine::QueryEngine(const FileEntry* root, TaskScheduler* scheduler)
+    : scheduler_(scheduler) {
+  if (root == nullptr)
+    return;
+
+  std::vector<const FileEntry*> stack(1, root);
+  while (!stack.empty()) {
+    auto directory = stack.back();
+    stack.pop_back();
+
+    for (auto& child : directory->children) {
+      entries_.push_back(child.get());
+      if (!child->children.empty())
+        stack.push_back(child.get());
+    }
+  }
+
+  chunks_.resize((entries_.size() + kChunkEntries - 1) / kChunkEntries);
+
+  TaskGroup group(scheduler_);
+  for (size_t i = 0; i < chunks_.size(); ++i) {
+    group.Post([this, i]() {
+      auto& chunk = chunks_[i];
+      chunk.first = i * kChunkEntries;
+
+      auto end = std::min(entries_.size(), chunk.first + kChunkEntries);
+      chunk.offsets.reserve(end - chunk.first + 1);
+      chunk.sizes.reserve(end - chunk.first);
+      chunk.attributes.reserve(end - chunk.first);
+
+      for (auto j = chunk.first; j < end; ++j) {
+        auto entry = entries_[j];
+        chunk.offsets.push_back(static_cast<uint32_t>(chunk.names.size()));
+        AppendFolded(entry->name, &chunk.names);
+        chunk.names.push_back('\0');
+        chunk.sizes.push_back(entry->size.QuadPart);
+        chunk.attributes.push_back(entry->attributes);
+      }
+
+      chunk.offsets.push_back(static_cast<uint32_t>(chunk.names.size()));
+      chunk.names.shrink_to_fit();
+    });
+  }
+}
+
+HRESULT QueryEngine::Run(const Query& query, Listener* listener,
+                         const std::atomic<bool>* cancel) const {
+  Pattern pattern(query);
+
+  std::mutex lock;
+  std::atomic<bool> stopped(false);
+
+  {
+    TaskGroup group(scheduler_);
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+      group.Post([&, this, i]() {
+        if (stopped || (cancel != nullptr && *cancel))
+          return;
+
+        std::vector<const FileEntry*> matches;
+        Search(chunks_[i], pattern, &matches);
+        if (matches.empty())
+          return;
+
+        std::lock_guard<std::mutex> guard(lock);
+        if (!stopped && !listener->OnMatches(matches))
+          stopped = true;
+      });
+    }
+  }
+
+  if (stopped || (cancel != nullptr && *cancel))
+    return E_ABORT;
+
+  return S_OK;
+}
+
+void QueryEngine::Search(const Chunk& chunk, const Pattern& pattern,
+                         std::vector<const FileEntry*>* matches) const {
+  auto names = chunk.names.data();
+  auto& offsets = chunk.offsets;
+  auto count = offsets.size() - 1;
+
+  auto check = [&](size_t index) {
+    auto begin = offsets[index];
+    if (pattern.Match(chunk.sizes[index], chunk.attributes[index],
+                      names + begin, offsets[index + 1] - begin - 1))
+      matches->push_back(entries_[chunk.first + index]);
+  };
+
+  if (pattern.needle.empty()) {
+    for (size_t i = 0; i < count; ++i)
+      check(i);
+    return;
+  }
+
+  // The needle holds no null characters, so it can't span two names.
+  size_t index = 0;
+  for (size_t offset = 0;;) {
+    offset = Find(names, chunk.names.size(), offset, pattern.needle);
+    if (offset == chunk.names.size())
+      break;
+
+    index = std::upper_bound(offsets.begin() + index, offsets.end(),
+                             offset) -
+            offsets.begin() - 1;
+    check(index);
+
+    offset = offsets[++index];
+  }
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_QUERY_ENGINE_H_
+#define SCAN_VOLUME_APP_QUERY_ENGINE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+
+// What the entries found by a QueryEngine must satisfy. Names are compared
+// without regard to case, and empty conditions are left out.
+struct Query {
+  Query()
+      : min_size(0),
+        max_size(MAXLONGLONG),
+        attributes_set(0),
+        attributes_clear(0) {}
+
+  // Matched against whole names, where * stands for any run of characters
+  // and ? for any one.
+  std::wstring glob;
+
+  // Found anywhere in names.
+  std::wstring substring;
+
+  // Ends names after a period, such as "bak".
+  std::wstring extension;
+
+  // The range sizes fall in, both ends included. The sizes of directories
+  // are the totals of their contents.
+  LONGLONG min_size;
+  LONGLONG max_size;
+
+  // Attributes all of which must be set, and those none of which may be.
+  DWORD attributes_set;
+  DWORD attributes_clear;
+};
+
+// Answers queries over a scanned tree, from an index that lays the names,
+// sizes and attributes of every entry out contiguously in chunks. Each query
+// scans the chunks in parallel for the longest literal its matches must
+// contain, with SIMD where available, and checks the rest only for the
+// entries it turns up.
+class QueryEngine {
+ public:
+  // Receives the matches of a query one batch at a time, on a worker.
+  class Listener {
+   public:
+    // Returns false to stop the query.
+    virtual bool OnMatches(const std::vector<const FileEntry*>& matches) = 0;
+
+   protected:
+    ~Listener() {}
+  };
+
+  // Indexes every entry under |root| on |scheduler|. The tree must not
+  // change while the engine is in use.
+  QueryEngine(const FileEntry* root, TaskScheduler* scheduler);
+
+  // Finds the entries matching |query|, and passes them to |listener| as each
+  // chunk is searched, in no particular order. Returns E_ABORT if |listener|
+  // or |cancel| stopped it first. Must not be called from a worker.
+  HRESULT Run(const Query& query, Listener* listener,
+              const std::atomic<bool>* cancel) const;
+
+  size_t entry_count() const {
+    return entries_.size();
+  }
+
+ private:
+  // A run of entries, with what queries look at laid out contiguously so
+  // that only the entries that match are visited.
+  struct Chunk {
+    size_t first;
+
+    // The name of each entry folded to lower case, encoded in UTF-8 and
+    // followed by a null character.
+    std::string names;
+
+    // Where the name of each entry starts, and where the names end.
+    std::vector<uint32_t> offsets;
+
+    std::vector<LONGLONG> sizes;
+    std::vector<DWORD> attributes;
+  };
+
+  struct Pattern;
+
+  void Search(const Chunk& chunk, const Pattern& pattern,
+              std::vector<const FileEntry*>* matches) const;
+
+  TaskScheduler* const scheduler_;
+  std::vector<const FileEntry*> entries_;
+  std::vector<Chunk> chunks_;
+
+  QueryEngine(const QueryEngine&) = delete;
+  QueryEngine& operator=(const QueryEngine&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_QUERY_ENGINE_H_
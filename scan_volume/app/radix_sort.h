@@ -0,0 +1,94 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_RADIX_SORT_H_
+#define SCAN_VOLUME_APP_RADIX_SORT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "app/task_scheduler.h"
+
+// Sorts |items| stably by the unsigned key |key| returns for each, least
+// significant byte first. Only the bytes that differ between keys are sorted
+// on, which leaves out the zeroed ones in the middle of NTFS file reference
+// numbers. Each pass counts and scatters a slice of the items per task posted
+// to |group|.
+template <typename T, typename Key>
+void RadixSort(std::vector<T>* items, Key key, TaskGroup* group) {
+  const int kDigitBits = 8;
+  const size_t kBuckets = 1 << kDigitBits;
+  const size_t kMinSliceItems = 64 * 1024;
+
+  auto count = items->size();
+  if (count < 2)
+    return;
+
+  uint64_t any_bits = 0, all_bits = ~uint64_t();
+  for (auto& item : *items) {
+    uint64_t value = key(item);
+    any_bits |= value;
+    all_bits &= value;
+  }
+
+  auto varying = any_bits ^ all_bits;
+  if (varying == 0)
+    return;
+
+  auto slices = std::max<size_t>(
+      1, std::min(group->concurrency(), count / kMinSliceItems));
+  auto slice_size = (count + slices - 1) / slices;
+
+  std::vector<T> buffer(count);
+  std::vector<size_t> offsets(slices * kBuckets);
+  auto source = items->data();
+  auto target = buffer.data();
+
+  for (int shift = 0; shift < 64 && (varying >> shift) != 0;
+       shift += kDigitBits) {
+    if (((varying >> shift) & (kBuckets - 1)) == 0)
+      continue;
+
+    std::fill(offsets.begin(), offsets.end(), 0);
+
+    for (size_t slice = 0; slice < slices; ++slice) {
+      group->Post([&, slice, shift]() {
+        auto histogram = &offsets[slice * kBuckets];
+        auto end = std::min(count, (slice + 1) * slice_size);
+        for (auto i = slice * slice_size; i < end; ++i)
+          ++histogram[(key(source[i]) >> shift) & (kBuckets - 1)];
+      });
+    }
+    group->Wait();
+
+    // Each slice scatters into its own run of each bucket, after those of
+    // the slices before it.
+    size_t position = 0;
+    for (size_t digit = 0; digit < kBuckets; ++digit) {
+      for (size_t slice = 0; slice < slices; ++slice) {
+        auto& offset = offsets[slice * kBuckets + digit];
+        auto size = offset;
+        offset = position;
+        position += size;
+      }
+    }
+
+    for (size_t slice = 0; slice < slices; ++slice) {
+      group->Post([&, slice, shift]() {
+        auto positions = &offsets[slice * kBuckets];
+        auto end = std::min(count, (slice + 1) * slice_size);
+        for (auto i = slice * slice_size; i < end; ++i)
+          target[positions[(key(source[i]) >> shift) & (kBuckets - 1)]++] =
+              source[i];
+      });
+    }
+    group->Wait();
+
+    std::swap(source, target);
+  }
+
+  if (source != items->data())
+    items->swap(buffer);
+}
+
+#endif  // SCAN_VOLUME_APP_RADIX_SORT_H_
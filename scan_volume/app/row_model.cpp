@@ -0,0 +1,115 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/row_model.h"
+
+void RowModel::Node::Add(size_t index, ptrdiff_t delta) {
+  for (auto i = index + 1; i <= extra.size(); i += i & (0 - i))
+    extra[i - 1] += delta;
+}
+
+// Each child takes up one row of its own, so the rows of the first n children
+// are n plus the sum of their extra rows.
+size_t RowModel::Node::Find(size_t* row) const {
+  size_t step = 1;
+  while (step <= extra.size() / 2)
+    step *= 2;
+
+  size_t index = 0;
+  for (; step > 0; step /= 2) {
+    auto next = index + step;
+    if (next <= extra.size() && extra[next - 1] + step <= *row) {
+      *row -= extra[next - 1] + step;
+      index = next;
+    }
+  }
+
+  return index;
+}
+
+const RowModel::Item RowModel::kNoItem;
+
+RowModel::RowModel(const RowTree* tree) : tree_(tree), row_count_(1) {}
+
+RowModel::Item RowModel::GetRow(size_t row, size_t* depth) const {
+  return Locate(row, nullptr, depth);
+}
+
+bool RowModel::IsExpanded(size_t row) const {
+  auto item = Locate(row, nullptr, nullptr);
+  if (item == kNoItem)
+    return false;
+
+  auto found = nodes_.find(item);
+  return found != nodes_.end() && found->second.expanded;
+}
+
+bool RowModel::Expand(size_t row) {
+  std::vector<Step> path;
+  auto item = Locate(row, &path, nullptr);
+  if (item == kNoItem)
+    return false;
+
+  auto children = tree_->child_count(item);
+  if (children == 0)
+    return false;
+
+  auto& node = nodes_.emplace(item, Node(children)).first->second;
+  if (node.expanded)
+    return false;
+
+  node.expanded = true;
+  Propagate(path, node.rows);
+
+  return true;
+}
+
+bool RowModel::Collapse(size_t row) {
+  std::vector<Step> path;
+  auto item = Locate(row, &path, nullptr);
+  if (item == kNoItem)
+    return false;
+
+  auto found = nodes_.find(item);
+  if (found == nodes_.end() || !found->second.expanded)
+    return false;
+
+  found->second.expanded = false;
+  Propagate(path, -static_cast<ptrdiff_t>(found->second.rows));
+
+  return true;
+}
+
+RowModel::Item RowModel::Locate(size_t row, std::vector<Step>* path,
+                                size_t* depth) const {
+  if (row >= row_count_)
+    return kNoItem;
+
+  auto item = tree_->root();
+  size_t level = 0;
+  for (; row > 0; ++level) {
+    --row;
+
+    // Only expanded directories have rows below them.
+    auto& node = nodes_.find(item)->second;
+    auto index = node.Find(&row);
+    if (path != nullptr)
+      path->push_back(Step{item, index});
+    item = tree_->child(item, index);
+  }
+
+  if (depth != nullptr)
+    *depth = level;
+
+  return item;
+}
+
+// Every directory on |path| is expanded, so the change shows in each.
+void RowModel::Propagate(const std::vector<Step>& path, ptrdiff_t delta) {
+  for (auto& step : path) {
+    auto& node = nodes_.find(step.directory)->second;
+    node.Add(step.index, delta);
+    node.rows += delta;
+  }
+
+  row_count_ += delta;
+}
@@ -0,0 +1,201 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_ROW_MODEL_H_
+#define SCAN_VOLUME_APP_ROW_MODEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/volume_scanner.h"
+
+// The tree a RowModel lays out, and what the view shows of each entry, read
+// through items that stand for the entries. Lets a scan be shown as its
+// FileEntry tree and a snapshot as the FileTree it is mapped in, without
+// copying either.
+class RowTree {
+ public:
+  typedef uintptr_t Item;
+
+  virtual ~RowTree() {}
+
+  virtual Item root() const = 0;
+  virtual size_t child_count(Item item) const = 0;
+  virtual Item child(Item item, size_t index) const = 0;
+
+  virtual void AppendName(Item item, std::wstring* text) const = 0;
+  virtual LONGLONG size(Item item) const = 0;
+  virtual DWORD attributes(Item item) const = 0;
+};
+
+// Shows a FileEntry tree, each entry being the item of its own address.
+class EntryRowTree : public RowTree {
+ public:
+  explicit EntryRowTree(const FileEntry* root) : root_(root) {}
+
+  static Item item(const FileEntry* entry) {
+    return reinterpret_cast<Item>(entry);
+  }
+
+  static const FileEntry* entry(Item item) {
+    return reinterpret_cast<const FileEntry*>(item);
+  }
+
+  Item root() const override {
+    return item(root_);
+  }
+
+  size_t child_count(Item item) const override {
+    return entry(item)->children.size();
+  }
+
+  Item child(Item item, size_t index) const override {
+    return EntryRowTree::item(entry(item)->children[index].get());
+  }
+
+  void AppendName(Item item, std::wstring* text) const override {
+    text->append(entry(item)->name);
+  }
+
+  LONGLONG size(Item item) const override {
+    return entry(item)->size.QuadPart;
+  }
+
+  DWORD attributes(Item item) const override {
+    return entry(item)->attributes;
+  }
+
+ private:
+  const FileEntry* const root_;
+
+  EntryRowTree(const EntryRowTree&) = delete;
+  EntryRowTree& operator=(const EntryRowTree&) = delete;
+};
+
+// Shows a FileTree where it lies, such as in a mapped snapshot, each node
+// being the item of its index. A child that doesn't name its parent back
+// shows as FileTree::kNone, a blank row of its own, so that a damaged
+// snapshot can't show a node under two parents or in a loop.
+class SnapshotRowTree : public RowTree {
+ public:
+  explicit SnapshotRowTree(const FileTree* tree) : tree_(tree) {}
+
+  Item root() const override {
+    return 0;
+  }
+
+  size_t child_count(Item item) const override {
+    return node(item).child_count;
+  }
+
+  Item child(Item item, size_t index) const override {
+    auto child = node(item).first_child + static_cast<DWORD>(index);
+    return tree_->node(child).parent == item ? child : FileTree::kNone;
+  }
+
+  void AppendName(Item item, std::wstring* text) const override {
+    auto& node = this->node(item);
+    AppendUtf16(tree_->name_data(node), node.name_length, text);
+  }
+
+  LONGLONG size(Item item) const override {
+    return node(item).size;
+  }
+
+  DWORD attributes(Item item) const override {
+    return node(item).attributes;
+  }
+
+ private:
+  const FileTree::Node& node(Item item) const {
+    return tree_->node(static_cast<DWORD>(item));
+  }
+
+  const FileTree* const tree_;
+
+  SnapshotRowTree(const SnapshotRowTree&) = delete;
+  SnapshotRowTree& operator=(const SnapshotRowTree&) = delete;
+};
+
+// Lays a tree out as the rows of an outline, where the children of each
+// expanded directory follow it in the order they are stored in.
+//
+// Each directory ever expanded keeps a Fenwick tree over the rows its
+// children take up, so a row is found in O(log n) per level and expanding or
+// collapsing one updates O(log n) per level above it. Nothing is kept for the
+// rest of the tree. The tree must not change while the model is in use.
+class RowModel {
+ public:
+  typedef RowTree::Item Item;
+
+  // Returned for rows beyond the last.
+  static const Item kNoItem = UINTPTR_MAX;
+
+  // The root is the only row until it is expanded. |tree| must outlive the
+  // model.
+  explicit RowModel(const RowTree* tree);
+
+  const RowTree& tree() const {
+    return *tree_;
+  }
+
+  // Returns the item shown at |row|, and how many levels below the root it
+  // is in |depth| unless null.
+  Item GetRow(size_t row, size_t* depth) const;
+
+  bool IsExpanded(size_t row) const;
+
+  // Shows or hides the children of the item at |row|. Returns false if
+  // nothing changed.
+  bool Expand(size_t row);
+  bool Collapse(size_t row);
+
+  size_t row_count() const {
+    return row_count_;
+  }
+
+ private:
+  struct Node {
+    explicit Node(size_t children)
+        : expanded(false), rows(children), extra(children) {}
+
+    // Adds |delta| to the rows taken up by the child at |index|.
+    void Add(size_t index, ptrdiff_t delta);
+
+    // Returns the index of the child whose rows include |*row|, and leaves
+    // |*row| relative to the first of them.
+    size_t Find(size_t* row) const;
+
+    bool expanded;
+
+    // The rows below the directory while it is expanded, which are kept
+    // while it is collapsed.
+    size_t rows;
+
+    // A Fenwick tree over the rows below each child, beyond the child itself.
+    std::vector<size_t> extra;
+  };
+
+  // The directory a row descends through, and the index of the child it
+  // descends into.
+  struct Step {
+    Item directory;
+    size_t index;
+  };
+
+  // Returns the item at |row|, and fills in |path| and |depth| unless null.
+  Item Locate(size_t row, std::vector<Step>* path, size_t* depth) const;
+  void Propagate(const std::vector<Step>& path, ptrdiff_t delta);
+
+  const RowTree* const tree_;
+  size_t row_count_;
+  std::unordered_map<Item, Node> nodes_;
+
+  RowModel(const RowModel&) = delete;
+  RowModel& operator=(const RowModel&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_ROW_MODEL_H_
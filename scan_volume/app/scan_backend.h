@@ -0,0 +1,46 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_SCAN_BACKEND_H_
+#define SCAN_VOLUME_APP_SCAN_BACKEND_H_
+
+#include <memory>
+#include <vector>
+
+#include "app/port.h"
+#include "app/scan_counters.h"
+#include "app/usage_histogram.h"
+#include "app/volume_scanner.h"
+
+// Builds the FileEntry tree of a scan target on behalf of VolumeScanner. Each
+// platform provides its own implementation, and reports its progress through
+// the ScanCounters it is given.
+class ScanBackend {
+ public:
+  virtual ~ScanBackend() {}
+
+  // Builds the tree of the target. Sizes may be left unset.
+  virtual HRESULT Enumerate() = 0;
+
+  // Fills in the sizes of the tree built by Enumerate, including the totals
+  // of directories, and leaves the children of each directory sorted. Tallies
+  // the files it sizes as it goes.
+  virtual HRESULT Size() = 0;
+
+  // Moves the roots of the finished tree to |roots|.
+  virtual void GetRoots(std::vector<std::unique_ptr<FileEntry>>* roots) = 0;
+
+  // Moves the tallies of the files sized by Size to |usage|.
+  virtual void GetUsage(UsageHistogram* usage) = 0;
+
+  // Returns the position in the change journal of the target that the tree
+  // built by Enumerate is current as of, or false if there is no journal.
+  virtual bool GetCursor(JournalCursor* cursor) = 0;
+
+  // Brings |roots|, the result of an earlier scan, up to date with the
+  // changes recorded since |cursor| and advances |cursor| past them. The
+  // children of the directories changed are sorted again.
+  virtual HRESULT Update(std::vector<std::unique_ptr<FileEntry>>* roots,
+                         JournalCursor* cursor) = 0;
+};
+
+#endif  // SCAN_VOLUME_APP_SCAN_BACKEND_H_
@@ -0,0 +1,61 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/scan_counters.h"
+
+namespace {
+
+std::atomic<DWORDLONG> last_generation(0);
+
+struct SlotCache {
+  DWORDLONG generation;
+  void* slot;
+};
+
+thread_local SlotCache slot_cache = {0, nullptr};
+
+}  // namespace
+
+ScanCounters::ScanCounters() {
+  Reset();
+}
+
+void ScanCounters::Reset() {
+  for (auto& slot : slots_) {
+    for (auto& value : slot.values)
+      value.store(0, std::memory_order_relaxed);
+  }
+
+  next_slot_.store(0, std::memory_order_relaxed);
+  queue_depth_.store(0, std::memory_order_relaxed);
+  records_expected_.store(0, std::memory_order_relaxed);
+  generation_ = ++last_generation;
+}
+
+void ScanCounters::Read(ScanProgress* progress) const {
+  DWORDLONG totals[CounterCount] = {};
+  for (auto& slot : slots_) {
+    for (int i = 0; i < CounterCount; ++i)
+      totals[i] += slot.values[i].load(std::memory_order_relaxed);
+  }
+
+  progress->records_parsed = totals[RecordsParsed];
+  progress->files_found = totals[FilesFound];
+  progress->bytes_read = totals[BytesRead];
+  progress->files_sized = totals[FilesSized];
+  progress->size_failures = totals[SizeFailures];
+  progress->queue_depth = queue_depth_.load(std::memory_order_relaxed);
+  progress->records_expected =
+      records_expected_.load(std::memory_order_relaxed);
+}
+
+ScanCounters::Slot* ScanCounters::GetSlot() {
+  if (slot_cache.generation != generation_) {
+    // Threads beyond the number of slots share them, which costs contention
+    // but not correctness.
+    auto index = next_slot_.fetch_add(1, std::memory_order_relaxed);
+    slot_cache.generation = generation_;
+    slot_cache.slot = &slots_[index % kSlotCount];
+  }
+
+  return static_cast<Slot*>(slot_cache.slot);
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_SCAN_COUNTERS_H_
+#define SCAN_VOLUME_APP_SCAN_COUNTERS_H_
+
+#include <atomic>
+#include <cstddef>
+
+#include "app/port.h"
+
+// A snapshot of the counters of a scan.
+struct ScanProgress {
+  DWORDLONG records_parsed;
+  DWORDLONG files_found;
+  DWORDLONG bytes_read;
+  DWORDLONG files_sized;
+  DWORDLONG size_failures;
+  DWORDLONG queue_depth;
+
+  // The number of records the target is expected to hold, or zero if it
+  // isn't known.
+  DWORDLONG records_expected;
+};
+
+// Counters that any number of scanning threads update without locking. Each
+// thread adds to a cache line of its own, and readers sum them up, so that
+// counting stays cheap on hot paths.
+class ScanCounters {
+ public:
+  enum Counter {
+    RecordsParsed,
+    FilesFound,
+    BytesRead,
+    FilesSized,
+    SizeFailures,
+    CounterCount,
+  };
+
+  ScanCounters();
+
+  // Zeroes every counter. Must not race with updates.
+  void Reset();
+
+  void Add(Counter counter, DWORDLONG value) {
+    GetSlot()->values[counter].fetch_add(value, std::memory_order_relaxed);
+  }
+
+  void SetQueueDepth(DWORDLONG depth) {
+    queue_depth_.store(depth, std::memory_order_relaxed);
+  }
+
+  void SetRecordsExpected(DWORDLONG count) {
+    records_expected_.store(count, std::memory_order_relaxed);
+  }
+
+  void Read(ScanProgress* progress) const;
+
+ private:
+  static const size_t kCacheLineSize = 64;
+  static const size_t kSlotCount = 64;
+
+  struct alignas(kCacheLineSize) Slot {
+    std::atomic<DWORDLONG> values[CounterCount];
+  };
+
+  Slot* GetSlot();
+
+  Slot slots_[kSlotCount];
+  std::atomic<size_t> next_slot_;
+  std::atomic<DWORDLONG> queue_depth_;
+  std::atomic<DWORDLONG> records_expected_;
+
+  // Distinguishes this set of counters, and each reset of it, in the slot
+  // cache of each thread.
+  DWORDLONG generation_;
+
+  ScanCounters(const ScanCounters&) = delete;
+  ScanCounters& operator=(const ScanCounters&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_SCAN_COUNTERS_H_
@@ -0,0 +1,204 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/scan_diff.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "app/radix_sort.h"
+
+namespace {
+
+// Carries what is compared along with each ID, so that the join reads the
+// keys alone, in order.
+struct Key {
+  FileId id;
+  LONGLONG size;
+  LONGLONG allocated;
+  DWORD node;
+  bool directory;
+};
+
+bool IsDirectory(const FileTree::Node& node) {
+  return (node.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+// Lists the nodes of |tree| by their IDs. Sorting on the low half and then,
+// stably, on the high half orders them the way FileId::operator< does.
+void SortById(const FileTree& tree, std::vector<Key>* keys, TaskGroup* group) {
+  keys->resize(tree.size());
+  for (size_t i = 0; i < keys->size(); ++i) {
+    auto index = static_cast<DWORD>(i);
+    auto& node = tree.node(index);
+    (*keys)[i] =
+        Key{node.id, node.size, node.allocated, index, IsDirectory(node)};
+  }
+
+  RadixSort(keys, [](const Key& key) { return key.id.low(); }, group);
+  RadixSort(keys, [](const Key& key) { return key.id.high(); }, group);
+}
+
+// Compares the IDs as two 64-bit halves rather than byte by byte.
+bool Less(const FileId& a, const FileId& b) {
+  auto a_high = a.high(), b_high = b.high();
+  return a_high != b_high ? a_high < b_high : a.low() < b.low();
+}
+
+// Unknown sizes are negative, and count as nothing.
+LONGLONG SizeOf(LONGLONG size) {
+  return std::max<LONGLONG>(size, 0);
+}
+
+// Returns the change from |before| to |after|, or zero if either is unknown.
+LONGLONG Growth(LONGLONG before, LONGLONG after) {
+  return before >= 0 && after >= 0 ? after - before : 0;
+}
+
+LONGLONG Magnitude(const ScanDiff::Change& change) {
+  return std::max(std::abs(change.growth), std::abs(change.allocated_growth));
+}
+
+// Tells whether node |a| of |a_tree| and node |b| of |b_tree| are linked under
+// the same name in the same directory.
+bool SameLink(const FileTree& a_tree, DWORD a, const FileTree& b_tree,
+              DWORD b) {
+  auto& a_node = a_tree.node(a);
+  auto& b_node = b_tree.node(b);
+  return a_tree.node(a_node.parent).id == b_tree.node(b_node.parent).id &&
+         a_node.name_length == b_node.name_length &&
+         memcmp(a_tree.name_data(a_node), b_tree.name_data(b_node),
+                a_node.name_length * sizeof(char16_t)) == 0;
+}
+
+}  // namespace
+
+ScanDiff::ScanDiff() : growth_(0), allocated_growth_(0) {}
+
+void ScanDiff::Compare(const FileTree& before, const FileTree& after,
+                       TaskScheduler* scheduler) {
+  Clear();
+
+  if (!after.empty()) {
+    growth_ += SizeOf(after.root()->size);
+    allocated_growth_ += SizeOf(after.root()->allocated);
+  }
+  if (!before.empty()) {
+    growth_ -= SizeOf(before.root()->size);
+    allocated_growth_ -= SizeOf(before.root()->allocated);
+  }
+
+  std::vector<Key> before_keys, after_keys;
+  {
+    TaskGroup group(scheduler);
+    SortById(before, &before_keys, &group);
+    SortById(after, &after_keys, &group);
+  }
+
+  auto add = [this](Kind kind, bool directory, DWORD before, DWORD after,
+                    LONGLONG growth, LONGLONG allocated_growth) {
+    auto& changes = directory ? directories_ : files_;
+    changes.push_back(Change{kind, before, after, growth, allocated_growth});
+  };
+
+  auto added = [&](const Key& key) {
+    add(Added, key.directory, FileTree::kNone, key.node, SizeOf(key.size),
+        SizeOf(key.allocated));
+  };
+
+  auto removed = [&](const Key& key) {
+    add(Removed, key.directory, key.node, FileTree::kNone, -SizeOf(key.size),
+        -SizeOf(key.allocated));
+  };
+
+  auto matched = [&](const Key& old_key, const Key& new_key) {
+    // An ID given to a file of another kind was reused.
+    if (old_key.directory != new_key.directory) {
+      removed(old_key);
+      added(new_key);
+      return;
+    }
+
+    auto growth = Growth(old_key.size, new_key.size);
+    auto allocated_growth = Growth(old_key.allocated, new_key.allocated);
+    if (growth != 0 || allocated_growth != 0) {
+      add(Resized, new_key.directory, old_key.node, new_key.node, growth,
+          allocated_growth);
+    }
+  };
+
+  // Walk both lists in step: an ID found in one alone was added or removed.
+  size_t i = 0, j = 0;
+  std::vector<bool> linked;
+  while (i < before_keys.size() || j < after_keys.size()) {
+    if (j == after_keys.size() ||
+        (i < before_keys.size() && Less(before_keys[i].id, after_keys[j].id))) {
+      removed(before_keys[i++]);
+      continue;
+    }
+
+    if (i == before_keys.size() || Less(after_keys[j].id, before_keys[i].id)) {
+      added(after_keys[j++]);
+      continue;
+    }
+
+    auto before_end = i + 1, after_end = j + 1;
+    while (before_end < before_keys.size() &&
+           before_keys[before_end].id == before_keys[i].id)
+      ++before_end;
+    while (after_end < after_keys.size() &&
+           after_keys[after_end].id == after_keys[j].id)
+      ++after_end;
+
+    if (before_end - i == 1 && after_end - j == 1) {
+      matched(before_keys[i], after_keys[j]);
+      i = before_end;
+      j = after_end;
+      continue;
+    }
+
+    // Links of the same file are paired by where they are and what they are
+    // called, since the order they were found in may differ between scans.
+    linked.assign(after_end - j, false);
+    for (; i < before_end; ++i) {
+      auto k = j;
+      while (k < after_end &&
+             (linked[k - j] || !SameLink(before, before_keys[i].node, after,
+                                         after_keys[k].node)))
+        ++k;
+
+      if (k == after_end) {
+        removed(before_keys[i]);
+      } else {
+        linked[k - j] = true;
+        matched(before_keys[i], after_keys[k]);
+      }
+    }
+
+    for (auto k = j; k < after_end; ++k) {
+      if (!linked[k - j])
+        added(after_keys[k]);
+    }
+
+    j = after_end;
+  }
+
+  auto larger = [](const Change& a, const Change& b) {
+    auto a_growth = Magnitude(a), b_growth = Magnitude(b);
+    if (a_growth != b_growth)
+      return a_growth > b_growth;
+    if (a.after != b.after)
+      return a.after < b.after;
+    return a.before < b.before;
+  };
+
+  std::sort(files_.begin(), files_.end(), larger);
+  std::sort(directories_.begin(), directories_.end(), larger);
+}
+
+void ScanDiff::Clear() {
+  std::vector<Change>().swap(files_);
+  std::vector<Change>().swap(directories_);
+  growth_ = 0;
+  allocated_growth_ = 0;
+}
@@ -0,0 +1,77 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_SCAN_DIFF_H_
+#define SCAN_VOLUME_APP_SCAN_DIFF_H_
+
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/task_scheduler.h"
+
+// Compares two scans of the same volume and tells what was added, removed or
+// resized in between, ranked by how much each grew or shrank. Entries are
+// matched by their IDs rather than their paths, so those renamed or moved
+// aren't taken for new ones: the IDs of both scans are sorted in parallel,
+// and merge-joined in a single pass. Sizes and allocated sizes are compared
+// alike.
+class ScanDiff {
+ public:
+  enum Kind {
+    Added,
+    Removed,
+    Resized,
+  };
+
+  struct Change {
+    Kind kind;
+
+    // The node in each scan, or FileTree::kNone in the one lacking it.
+    DWORD before;
+    DWORD after;
+
+    // Negative for entries that shrank or were removed.
+    LONGLONG growth;
+    LONGLONG allocated_growth;
+  };
+
+  ScanDiff();
+
+  // Replaces the contents with the changes from |before| to |after|, working
+  // on |scheduler|. Entries sharing an ID, such as hard links, are paired up
+  // by their parents and names, and those left over taken as added or
+  // removed. Must not be called from a worker.
+  void Compare(const FileTree& before, const FileTree& after,
+               TaskScheduler* scheduler);
+  void Clear();
+
+  // The files that changed, largest change first.
+  const std::vector<Change>& files() const {
+    return files_;
+  }
+
+  // The directories added, removed or whose totals changed, largest change
+  // first.
+  const std::vector<Change>& directories() const {
+    return directories_;
+  }
+
+  // The change in the total size of the volume.
+  LONGLONG growth() const {
+    return growth_;
+  }
+
+  LONGLONG allocated_growth() const {
+    return allocated_growth_;
+  }
+
+ private:
+  std::vector<Change> files_;
+  std::vector<Change> directories_;
+  LONGLONG growth_;
+  LONGLONG allocated_growth_;
+
+  ScanDiff(const ScanDiff&) = delete;
+  ScanDiff& operator=(const ScanDiff&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_SCAN_DIFF_H_
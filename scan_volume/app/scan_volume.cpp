@@ -4,6 +4,7 @@
 
 #include <crtdbg.h>
 
+#include "app/console_scan.h"
 #include "ui/main_frame.h"
 
 CAppModule _Module;
@@ -53,7 +54,11 @@ int __stdcall wWinMain(HINSTANCE hInstance, HINSTANCE /*hPrevInstance*/,
 }
 
 #ifdef _CONSOLE
-int wmain(int /*argc*/, wchar_t** /*argv*/) {
+int wmain(int argc, wchar_t** argv) {
+  // A target on the command line selects the headless scan.
+  if (argc > 1)
+    return RunConsoleScan(argc, argv);
+
   auto command_line = GetCommandLineW();
 
   if (command_line[0] == L'"')
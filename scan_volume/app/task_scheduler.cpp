@@ -0,0 +1,196 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/task_scheduler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+#include <utility>
+
+namespace {
+
+thread_local const TaskScheduler* current_scheduler = nullptr;
+thread_local size_t current_worker = 0;
+
+}  // namespace
+
+TaskScheduler::TaskScheduler(size_t concurrency, Task on_start)
+    : on_start_(std::move(on_start)),
+      pending_(0),
+      queued_(0),
+      sleeping_(0),
+      next_(0),
+      stopping_(false) {
+  concurrency = std::max<size_t>(1, concurrency);
+
+  for (size_t i = 0; i < concurrency; ++i)
+    workers_.push_back(std::make_unique<Worker>());
+
+  for (size_t i = 0; i < concurrency; ++i) {
+    try {
+      threads_.push_back(std::thread(&TaskScheduler::WorkerThread, this, i));
+    } catch (const std::system_error&) {
+      if (threads_.empty())
+        throw;
+
+      break;
+    }
+  }
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stopping_ = true;
+  }
+  available_.notify_all();
+
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+void TaskScheduler::Post(Task task) {
+  size_t index;
+  if (current_scheduler == this)
+    index = current_worker;
+  else
+    index = next_.fetch_add(1, std::memory_order_relaxed) % threads_.size();
+
+  pending_.fetch_add(1);
+  queued_.fetch_add(1);
+
+  {
+    auto& worker = *workers_[index];
+    std::lock_guard<std::mutex> guard(worker.lock);
+    worker.tasks.push_back(std::move(task));
+  }
+
+  if (sleeping_.load() > 0) {
+    { std::lock_guard<std::mutex> guard(lock_); }
+    available_.notify_one();
+  }
+}
+
+void TaskScheduler::Wait() {
+  std::unique_lock<std::mutex> lock(lock_);
+  done_.wait(lock, [this] { return pending_.load() == 0; });
+}
+
+TaskScheduler::Metrics TaskScheduler::GetMetrics() const {
+  Metrics metrics{};
+
+  for (auto& worker : workers_) {
+    metrics.executed += worker->executed.load(std::memory_order_relaxed);
+    metrics.steals += worker->steals.load(std::memory_order_relaxed);
+    metrics.idle_microseconds +=
+        worker->idle_microseconds.load(std::memory_order_relaxed);
+  }
+
+  return metrics;
+}
+
+size_t TaskScheduler::worker_index() const {
+  return current_scheduler == this ? current_worker : workers_.size();
+}
+
+void TaskScheduler::WorkerThread(size_t index) {
+  current_scheduler = this;
+  current_worker = index;
+
+  if (on_start_)
+    on_start_();
+
+  auto& worker = *workers_[index];
+
+  for (;;) {
+    Task task;
+    if (TryPop(index, &task) || TrySteal(index, &task)) {
+      queued_.fetch_sub(1);
+
+      task();
+      worker.executed.fetch_add(1, std::memory_order_relaxed);
+
+      if (pending_.fetch_sub(1) == 1) {
+        { std::lock_guard<std::mutex> guard(lock_); }
+        done_.notify_all();
+      }
+
+      continue;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      sleeping_.fetch_add(1);
+      available_.wait(lock,
+                      [this] { return stopping_ || queued_.load() > 0; });
+      sleeping_.fetch_sub(1);
+
+      if (stopping_ && queued_.load() == 0)
+        break;
+    }
+
+    auto idle = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    worker.idle_microseconds.fetch_add(idle.count(),
+                                       std::memory_order_relaxed);
+  }
+
+  current_scheduler = nullptr;
+}
+
+bool TaskScheduler::TryPop(size_t index, Task* task) {
+  auto& worker = *workers_[index];
+  std::lock_guard<std::mutex> guard(worker.lock);
+
+  if (worker.tasks.empty())
+    return false;
+
+  *task = std::move(worker.tasks.back());
+  worker.tasks.pop_back();
+
+  return true;
+}
+
+bool TaskScheduler::TrySteal(size_t index, Task* task) {
+  for (size_t i = 1; i < workers_.size(); ++i) {
+    auto& victim = *workers_[(index + i) % workers_.size()];
+
+    std::unique_lock<std::mutex> lock(victim.lock, std::try_to_lock);
+    if (!lock.owns_lock() || victim.tasks.empty())
+      continue;
+
+    *task = std::move(victim.tasks.front());
+    victim.tasks.pop_front();
+    workers_[index]->steals.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+  }
+
+  return false;
+}
+
+TaskGroup::~TaskGroup() {
+  Wait();
+}
+
+void TaskGroup::Post(TaskScheduler::Task task) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    ++pending_;
+  }
+
+  scheduler_->Post([this, task = std::move(task)]() {
+    task();
+
+    std::lock_guard<std::mutex> guard(lock_);
+    if (--pending_ == 0)
+      done_.notify_all();
+  });
+}
+
+void TaskGroup::Wait() {
+  std::unique_lock<std::mutex> lock(lock_);
+  done_.wait(lock, [this] { return pending_ == 0; });
+}
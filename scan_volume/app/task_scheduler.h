@@ -0,0 +1,122 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_TASK_SCHEDULER_H_
+#define SCAN_VOLUME_APP_TASK_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs tasks on a fixed set of worker threads. Each worker owns a deque: it
+// pushes and pops its own tasks at the back, and idle workers steal from the
+// front of the others. Workers only touch the shared lock to go to sleep or
+// to wake a sleeper.
+class TaskScheduler {
+ public:
+  typedef std::function<void()> Task;
+
+  struct Metrics {
+    uint64_t executed;
+    uint64_t steals;
+    uint64_t idle_microseconds;
+  };
+
+  // Runs |on_start|, if given, on each worker before it takes any task, such
+  // as to set the priorities of its thread.
+  explicit TaskScheduler(size_t concurrency, Task on_start = nullptr);
+  ~TaskScheduler();
+
+  // Queues |task|. Tasks posted from a worker go to that worker's own deque;
+  // others are spread across the workers.
+  void Post(Task task);
+
+  // Blocks until every posted task, including those posted by tasks, has
+  // finished. Must not be called from a worker.
+  void Wait();
+
+  // Returns the totals over all workers so far.
+  Metrics GetMetrics() const;
+
+  size_t concurrency() const {
+    return workers_.size();
+  }
+
+  // Returns the number of tasks waiting to run.
+  size_t queued() const {
+    return queued_.load(std::memory_order_relaxed);
+  }
+
+  // Returns the index of the worker running the caller, or concurrency() if
+  // the caller isn't a worker of this scheduler. Lets tasks fill tables of
+  // their worker's own without locking.
+  size_t worker_index() const;
+
+ private:
+  struct Worker {
+    Worker() : executed(0), steals(0), idle_microseconds(0) {}
+
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> steals;
+    std::atomic<uint64_t> idle_microseconds;
+  };
+
+  void WorkerThread(size_t index);
+  bool TryPop(size_t index, Task* task);
+  bool TrySteal(size_t index, Task* task);
+
+  const Task on_start_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<size_t> pending_;
+  std::atomic<size_t> queued_;
+  std::atomic<size_t> sleeping_;
+  std::atomic<size_t> next_;
+
+  std::mutex lock_;
+  std::condition_variable available_;
+  std::condition_variable done_;
+  bool stopping_;
+
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+};
+
+// Tracks the tasks one caller posts to a scheduler that others share, so that
+// it can wait for its own alone. Waits before it goes away.
+class TaskGroup {
+ public:
+  explicit TaskGroup(TaskScheduler* scheduler)
+      : scheduler_(scheduler), pending_(0) {}
+  ~TaskGroup();
+
+  void Post(TaskScheduler::Task task);
+
+  // Blocks until every task posted through the group has finished. Must not
+  // be called from a worker.
+  void Wait();
+
+  size_t concurrency() const {
+    return scheduler_->concurrency();
+  }
+
+ private:
+  TaskScheduler* const scheduler_;
+
+  std::mutex lock_;
+  std::condition_variable done_;
+  size_t pending_;
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_TASK_SCHEDULER_H_
@@ -0,0 +1,202 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/throttle.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+namespace {
+
+// The buckets hold no more than this many seconds of their rates, so that
+// an idle spell doesn't turn into a burst.
+const double kBurstSeconds = 0.1;
+
+// Waits are cut into naps no longer than this, to notice cancellation.
+const auto kMaxNap = std::chrono::milliseconds(50);
+
+// The rates are adjusted once per window.
+const auto kWindow = std::chrono::milliseconds(250);
+
+// Latency is taken to have risen once its average over a window is more than
+// this many times the lowest, plus a slack in seconds. Within a millisecond of
+// the lowest is noise rather than queuing, which tells apart cached operations
+// from others.
+const double kCongestionFactor = 2.0;
+const double kCongestionSlack = 0.001;
+
+const double kBaselineDrift = 1.0 / 64;
+
+const double kMinScale = 1.0 / 64;
+const double kScaleStep = 1.0 / 16;
+
+const double kNoLatency = std::numeric_limits<double>::infinity();
+
+#if !defined(_WIN32) && defined(SYS_ioprio_set)
+const int kIoprioWhoProcess = 1;
+const int kIoprioClassBestEffort = 2;
+const int kIoprioClassShift = 13;
+const int kIoprioLowestLevel = 7;
+#endif
+
+double Seconds(Throttle::Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+}  // namespace
+
+Throttle::Throttle(double ops_per_second, double bytes_per_second)
+    : ops_per_second_(std::max(ops_per_second, 0.0)),
+      bytes_per_second_(std::max(bytes_per_second, 0.0)),
+      refilled_(Clock::now()),
+      ops_tokens_(0.0),
+      byte_tokens_(0.0),
+      ceiling_(0.0),
+      scale_(1.0),
+      baseline_(kNoLatency),
+      window_start_(refilled_),
+      window_ops_(0),
+      window_latency_(0.0) {}
+
+Throttle::Clock::time_point Throttle::Acquire(
+    const std::atomic<bool>* cancel) {
+  auto now = Clock::now();
+  double wait = 0.0;
+
+  // Tokens are taken up front and may go into debt, so that threads
+  // arriving together wait in turn rather than all at once.
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    Refill(now);
+
+    auto ops = ops_rate();
+    if (ops > 0.0) {
+      ops_tokens_ -= 1.0;
+      if (ops_tokens_ < 0.0)
+        wait = -ops_tokens_ / ops;
+    }
+
+    auto bytes = byte_rate();
+    if (bytes > 0.0 && byte_tokens_ < 0.0)
+      wait = std::max(wait, -byte_tokens_ / bytes);
+  }
+
+  auto deadline = now + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>(wait));
+  while (cancel == nullptr || !cancel->load(std::memory_order_relaxed)) {
+    now = Clock::now();
+    if (now >= deadline)
+      break;
+
+    std::this_thread::sleep_for(std::min<Clock::duration>(deadline - now,
+                                                          kMaxNap));
+  }
+
+  return Clock::now();
+}
+
+void Throttle::Complete(Clock::time_point start, DWORDLONG bytes) {
+  auto now = Clock::now();
+  auto latency = Seconds(now - start);
+
+  std::lock_guard<std::mutex> guard(lock_);
+  Refill(now);
+
+  if (byte_rate() > 0.0)
+    byte_tokens_ -= static_cast<double>(bytes);
+
+  baseline_ = std::min(baseline_, latency);
+  ++window_ops_;
+  window_latency_ += latency;
+  if (now - window_start_ >= kWindow)
+    Adjust(now);
+}
+
+double Throttle::scale() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return scale_;
+}
+
+double Throttle::ops_rate() const {
+  return (ops_per_second_ > 0.0 ? ops_per_second_ : ceiling_) * scale_;
+}
+
+double Throttle::byte_rate() const {
+  return bytes_per_second_ * scale_;
+}
+
+void Throttle::Refill(Clock::time_point now) {
+  auto elapsed = Seconds(now - refilled_);
+  refilled_ = now;
+
+  auto ops = ops_rate();
+  if (ops > 0.0)
+    ops_tokens_ = std::min(ops_tokens_ + elapsed * ops,
+                           std::max(ops * kBurstSeconds, 1.0));
+  else
+    ops_tokens_ = 0.0;
+
+  auto bytes = byte_rate();
+  if (bytes > 0.0)
+    byte_tokens_ = std::min(byte_tokens_ + elapsed * bytes,
+                            std::max(bytes * kBurstSeconds, 1.0));
+  else
+    byte_tokens_ = 0.0;
+}
+
+// Halves the rates once latency rises, and raises them by a step otherwise,
+// as congestion control does with its window.
+void Throttle::Adjust(Clock::time_point now) {
+  auto average = window_latency_ / window_ops_;
+  if (average > baseline_ * kCongestionFactor + kCongestionSlack) {
+    if (ops_per_second_ == 0.0 && ceiling_ == 0.0)
+      ceiling_ = window_ops_ / Seconds(now - window_start_);
+
+    scale_ = std::max(scale_ / 2.0, kMinScale);
+  } else if (scale_ < 1.0) {
+    scale_ = std::min(scale_ + kScaleStep, 1.0);
+    if (scale_ == 1.0 && ops_per_second_ == 0.0)
+      ceiling_ = 0.0;
+  }
+
+  baseline_ += baseline_ * kBaselineDrift;
+  window_start_ = now;
+  window_ops_ = 0;
+  window_latency_ = 0.0;
+}
+
+#ifdef _WIN32
+
+// Only a hint, which not every file system honors, so failing is harmless.
+void LowerIoPriority(HANDLE handle) {
+  FILE_IO_PRIORITY_HINT_INFO info{IoPriorityHintVeryLow};
+  SetFileInformationByHandle(handle, FileIoPriorityHintInfo, &info,
+                             sizeof(info));
+}
+
+// Background mode lowers the I/O and memory priorities of the thread along
+// with its CPU priority.
+void EnterBackgroundMode() {
+  SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+}
+
+#else  // _WIN32
+
+// Linux sets both priorities per thread when given a thread ID of zero. The
+// lowest level of the best-effort class is used rather than the idle class,
+// which a busy server could starve the scan in.
+void EnterBackgroundMode() {
+#ifdef SYS_ioprio_set
+  syscall(SYS_ioprio_set, kIoprioWhoProcess, 0,
+          kIoprioClassBestEffort << kIoprioClassShift | kIoprioLowestLevel);
+#endif
+  setpriority(PRIO_PROCESS, 0, 19);
+}
+
+#endif  // _WIN32
@@ -0,0 +1,118 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_THROTTLE_H_
+#define SCAN_VOLUME_APP_THROTTLE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+#include "app/port.h"
+
+// Paces the I/O of scans running on a live file server, so that they take
+// no more than a share of what the device can do. Every scanning thread draws
+// from two token buckets, one of operations and one of bytes, each refilled
+// at its rate. On top of that, the time each operation takes is watched: once
+// it rises well above the lowest seen, the device is taken to be busy with
+// others and the rates are halved, then raised again a little at a time as
+// it recovers.
+class Throttle {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Throttled scans issue I/O from no more threads than this, since more
+  // would only queue up on the device.
+  static const size_t kMaxThreads = 2;
+
+  // Waits for the turn of one operation of |throttle| and times it for its
+  // lifetime. A null throttle doesn't wait.
+  class Operation {
+   public:
+    Operation(Throttle* throttle, const std::atomic<bool>* cancel)
+        : throttle_(throttle), bytes_(0) {
+      if (throttle_ != nullptr)
+        start_ = throttle_->Acquire(cancel);
+    }
+
+    ~Operation() {
+      if (throttle_ != nullptr)
+        throttle_->Complete(start_, bytes_);
+    }
+
+    // The bytes the operation transferred, charged once it completes.
+    void set_bytes(DWORDLONG bytes) {
+      bytes_ = bytes;
+    }
+
+   private:
+    Throttle* const throttle_;
+    Clock::time_point start_;
+    DWORDLONG bytes_;
+
+    Operation(const Operation&) = delete;
+    Operation& operator=(const Operation&) = delete;
+  };
+
+  // Allows |ops_per_second| operations and |bytes_per_second| bytes a second
+  // at most, where zero means no limit. Without a limit on operations, one is
+  // set from the rate measured when latency first rises.
+  Throttle(double ops_per_second, double bytes_per_second);
+
+  // Takes the tokens of one operation, and waits until the buckets are no
+  // longer in debt, or |cancel|, if given, is set. Returns when it was done.
+  Clock::time_point Acquire(const std::atomic<bool>* cancel);
+
+  // Charges |bytes| to the operation that began at |start|, and adjusts the
+  // rates by how long it took.
+  void Complete(Clock::time_point start, DWORDLONG bytes);
+
+  // The fraction of the rates currently allowed, from 1 down to 1/64.
+  double scale() const;
+
+ private:
+  // The rates currently allowed, where zero means no limit.
+  double ops_rate() const;
+  double byte_rate() const;
+
+  void Refill(Clock::time_point now);
+  void Adjust(Clock::time_point now);
+
+  const double ops_per_second_;
+  const double bytes_per_second_;
+
+  mutable std::mutex lock_;
+  Clock::time_point refilled_;
+  double ops_tokens_;
+  double byte_tokens_;
+
+  // The operation rate measured when backing off without a limit of its own,
+  // or zero while there is none.
+  double ceiling_;
+  double scale_;
+
+  // The lowest latency seen in seconds, which slowly drifts up so that it
+  // follows the device.
+  double baseline_;
+
+  // The operations completed in the current window, and the sum of their
+  // latencies.
+  Clock::time_point window_start_;
+  DWORDLONG window_ops_;
+  double window_latency_;
+
+  Throttle(const Throttle&) = delete;
+  Throttle& operator=(const Throttle&) = delete;
+};
+
+#ifdef _WIN32
+// Asks the I/O manager to serve the requests on |handle| after those of
+// everyone else.
+void LowerIoPriority(HANDLE handle);
+#endif
+
+// Lowers the CPU and I/O priorities of the calling thread for good. On Linux,
+// threads it starts afterwards inherit them.
+void EnterBackgroundMode();
+
+#endif  // SCAN_VOLUME_APP_THROTTLE_H_
@@ -0,0 +1,49 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_TOP_ENTRIES_H_
+#define SCAN_VOLUME_APP_TOP_ENTRIES_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "app/volume_scanner.h"
+
+// Keeps the largest of the entries offered to it, up to |capacity| of them,
+// in a min-heap. Ranking n entries takes O(n log capacity) and never sorts
+// more than the entries kept. The heap grows with the entries offered rather
+// than the capacity asked for, which may be far more than there are.
+class TopEntries {
+ public:
+  explicit TopEntries(size_t capacity) : capacity_(capacity) {}
+
+  void Offer(const FileEntry* entry) {
+    if (heap_.size() < capacity_) {
+      heap_.push_back(entry);
+      std::push_heap(heap_.begin(), heap_.end(), Larger);
+    } else if (capacity_ > 0 && Larger(entry, heap_.front())) {
+      std::pop_heap(heap_.begin(), heap_.end(), Larger);
+      heap_.back() = entry;
+      std::push_heap(heap_.begin(), heap_.end(), Larger);
+    }
+  }
+
+  // Moves the entries kept to |entries|, largest first.
+  void Take(std::vector<const FileEntry*>* entries) {
+    std::sort_heap(heap_.begin(), heap_.end(), Larger);
+    entries->swap(heap_);
+    heap_.clear();
+  }
+
+ private:
+  static bool Larger(const FileEntry* a, const FileEntry* b) {
+    return a->size.QuadPart > b->size.QuadPart;
+  }
+
+  const size_t capacity_;
+  std::vector<const FileEntry*> heap_;
+
+  TopEntries(const TopEntries&) = delete;
+  TopEntries& operator=(const TopEntries&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_TOP_ENTRIES_H_
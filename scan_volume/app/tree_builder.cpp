@@ -0,0 +1,174 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/tree_builder.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "app/radix_sort.h"
+#include "app/usn_record.h"
+#include "app/utf16.h"
+
+namespace {
+
+const DWORDLONG kRecordNumberMask = 0x0000FFFFFFFFFFFF;
+const DWORDLONG kKeyMultiplier = 0x9E3779B97F4A7C15;
+
+}  // namespace
+
+TreeBuilder::TreeBuilder() : roots_taken_(false) {}
+
+TreeBuilder::~TreeBuilder() {
+  if (roots_taken_)
+    return;
+
+  // Free the entries one by one rather than through their owners, which
+  // don't include the roots until Finish and would recurse as deep as the
+  // tree otherwise.
+  for (auto& root : roots_)
+    root.release();
+
+  entries_.ForEach([](FileEntry* entry) {
+    for (auto& child : entry->children)
+      child.release();
+
+    delete entry;
+    return true;
+  });
+}
+
+HRESULT TreeBuilder::Parse(const void* data, size_t size, DWORDLONG first,
+                           DWORDLONG last, FileMode files, Batch* batch) {
+  std::vector<UsnRecord> decoded;
+  HRESULT result = ReadUsnRecords(data, size, &decoded);
+  if (FAILED(result))
+    return result;
+
+  for (auto& record : decoded) {
+    auto number = record.id.low() & kRecordNumberMask;
+    if (record.id.high() == 0 && (number < first || number >= last))
+      continue;
+
+    ++batch->parsed;
+
+    bool directory = (record.attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    if (!directory)
+      ++batch->files;
+    if (files == NoFiles && !directory)
+      continue;
+
+    auto offset = batch->names.size();
+    if (files == NamedFiles || directory)
+      AppendUtf16(record.name, record.name_length, &batch->names);
+
+    batch->records.push_back(
+        Record{record.id, record.parent, record.attributes,
+               static_cast<DWORD>(batch->names.size() - offset), offset});
+  }
+
+  return S_OK;
+}
+
+void TreeBuilder::Append(Batch* batch) {
+  if (gathered_.records.empty()) {
+    std::swap(gathered_, *batch);
+  } else {
+    auto offset = gathered_.names.size();
+    for (auto& record : batch->records) {
+      record.name_offset += offset;
+      gathered_.records.push_back(record);
+    }
+
+    gathered_.names.insert(gathered_.names.end(), batch->names.begin(),
+                           batch->names.end());
+  }
+
+  batch->records.clear();
+  batch->names.clear();
+  batch->parsed = 0;
+  batch->files = 0;
+}
+
+HRESULT TreeBuilder::Add(const void* data, size_t size, size_t* count) {
+  Batch batch;
+  HRESULT result = Parse(data, size, 0, MAXLONGLONG, NamedFiles, &batch);
+  *count = batch.records.size();
+  Append(&batch);
+
+  return result;
+}
+
+bool TreeBuilder::Finish(const std::wstring& name,
+                         TaskScheduler* scheduler) {
+  Link(scheduler);
+
+  if (entries_.empty())
+    return false;
+
+  entries_.ForEach([this, &name](FileEntry* entry) {
+    if (entry->parent != nullptr)
+      return true;
+
+    std::unique_ptr<FileEntry> root(entry);
+    root->attributes = FILE_ATTRIBUTE_DIRECTORY;
+    root->name = name;
+    roots_.push_back(std::move(root));
+    return true;
+  });
+
+  return true;
+}
+
+void TreeBuilder::TakeRoots(std::vector<std::unique_ptr<FileEntry>>* roots) {
+  *roots = std::move(roots_);
+  roots_taken_ = true;
+}
+
+void TreeBuilder::Link(TaskScheduler* scheduler) {
+  auto& records = gathered_.records;
+  if (records.empty())
+    return;
+
+  // Sort the records by a key that's the same for the same parent: its MFT
+  // record number where it has one, or a mix of its halves otherwise.
+  std::vector<std::pair<DWORDLONG, size_t>> order(records.size());
+  for (size_t i = 0; i < records.size(); ++i) {
+    auto& parent = records[i].parent;
+    order[i].first = parent.high() == 0
+                         ? parent.low() & kRecordNumberMask
+                         : parent.low() ^ (parent.high() * kKeyMultiplier);
+    order[i].second = i;
+  }
+
+  TaskGroup group(scheduler);
+  RadixSort(&order,
+            [](const std::pair<DWORDLONG, size_t>& item) {
+              return item.first;
+            },
+            &group);
+
+  for (size_t begin = 0, end; begin < order.size(); begin = end) {
+    auto& parent_id = records[order[begin].second].parent;
+    for (end = begin + 1; end < order.size(); ++end) {
+      if (!(records[order[end].second].parent == parent_id))
+        break;
+    }
+
+    auto parent = entries_.Acquire(parent_id);
+    parent->children.reserve(parent->children.size() + (end - begin));
+
+    for (auto i = begin; i < end; ++i) {
+      auto& record = records[order[i].second];
+      auto entry = entries_.Acquire(record.id);
+
+      entry->parent = parent;
+      entry->attributes = record.attributes;
+      entry->name.assign(gathered_.names.data() + record.name_offset,
+                         record.name_length);
+
+      parent->children.push_back(std::unique_ptr<FileEntry>(entry));
+    }
+  }
+
+  gathered_ = Batch();
+}
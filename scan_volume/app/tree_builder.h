@@ -0,0 +1,115 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_TREE_BUILDER_H_
+#define SCAN_VOLUME_APP_TREE_BUILDER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/file_index.h"
+#include "app/port.h"
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+
+// Builds a FileEntry tree from the records returned by FSCTL_ENUM_USN_DATA.
+// Records are gathered flat as they are parsed, then sorted by parent and
+// linked a parent at a time, so each parent's children are allocated once.
+// Records are decoded with ReadUsnRecords, so the builder runs on any platform
+// against real or synthetic enumeration buffers.
+class TreeBuilder {
+ public:
+  // A record parsed ahead of linking. Its name is the |name_length| characters
+  // at |name_offset| in the name pool of its batch.
+  struct Record {
+    FileId id;
+    FileId parent;
+    DWORD attributes;
+    DWORD name_length;
+    size_t name_offset;
+  };
+
+  // The records parsed from a run of enumeration buffers. |parsed| counts
+  // those left out too, and |files| the files among them.
+  struct Batch {
+    Batch() : parsed(0), files(0) {}
+
+    std::vector<Record> records;
+    std::vector<wchar_t> names;
+    size_t parsed;
+    size_t files;
+  };
+
+  // What Parse keeps of the records of files, as opposed to directories.
+  enum FileMode {
+    NamedFiles,
+    NamelessFiles,
+    NoFiles,
+  };
+
+  TreeBuilder();
+  ~TreeBuilder();
+
+  // Enables direct addressing of MFT record numbers below |record_count|. Must
+  // be called before Finish.
+  void Reserve(size_t record_count) {
+    entries_.Reserve(record_count);
+  }
+
+  // Parses the records packed back to back in |data|, as returned by
+  // FSCTL_ENUM_USN_DATA after its leading file reference number, and appends
+  // those whose MFT record numbers are at least |first| and below |last| to
+  // |batch|. IDs wider than 64 bits are always kept. |files| selects what is
+  // kept of files. Doesn't touch any builder, so several ranges can be parsed
+  // at once. Returns E_INVALIDARG at the first malformed record.
+  static HRESULT Parse(const void* data, size_t size, DWORDLONG first,
+                       DWORDLONG last, FileMode files, Batch* batch);
+
+  // Gathers the records of |batch| for Finish to link, and empties it.
+  void Append(Batch* batch);
+
+  // Parses and gathers the records in |data| in one go, and sets |count| to
+  // the number gathered.
+  HRESULT Add(const void* data, size_t size, size_t* count);
+
+  // Links the gathered records into a tree, and makes each entry whose parent
+  // never appeared a directory named |name|, and a root of the tree. Sorting
+  // runs on |scheduler|. Returns false if nothing was gathered.
+  bool Finish(const std::wstring& name, TaskScheduler* scheduler);
+
+  // Moves the roots of the finished tree to |roots|.
+  void TakeRoots(std::vector<std::unique_ptr<FileEntry>>* roots);
+
+  // Returns the entry addressed directly by MFT record number |record|, or
+  // nullptr if there is none.
+  FileEntry* Find(size_t record) const {
+    return entries_.Find(record);
+  }
+
+  const std::vector<std::unique_ptr<FileEntry>>& roots() const {
+    return roots_;
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  size_t record_count() const {
+    return entries_.record_count();
+  }
+
+ private:
+  // Creates the entries of the gathered records and links them to their
+  // parents, in an order that groups them by parent.
+  void Link(TaskScheduler* scheduler);
+
+  Batch gathered_;
+  FileIndex entries_;
+  std::vector<std::unique_ptr<FileEntry>> roots_;
+  bool roots_taken_;
+
+  TreeBuilder(const TreeBuilder&) = delete;
+  TreeBuilder& operator=(const TreeBuilder&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_TREE_BUILDER_H_
@@ -0,0 +1,264 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/treemap_layout.h"
+
+#include <algorithm>
+
+namespace {
+
+typedef std::vector<std::unique_ptr<FileEntry>>::const_iterator Iterator;
+
+bool IsDirectory(const FileEntry* entry) {
+  return (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
+
+// Takes the children of a directory largest first, by merging the runs of
+// directories and of files SortChildren leaves them in, so that nothing has to
+// be sorted. Those without a positive size are skipped.
+class LargestFirst {
+ public:
+  explicit LargestFirst(const FileEntry* directory)
+      : directories_(directory->children.begin()),
+        files_(std::partition_point(
+            directory->children.begin(), directory->children.end(),
+            [](const std::unique_ptr<FileEntry>& child) {
+              return IsDirectory(child.get());
+            })),
+        directories_end_(files_),
+        files_end_(directory->children.end()) {}
+
+  // Returns null once none is left.
+  const FileEntry* Next() {
+    auto directory = Front(directories_, directories_end_);
+    auto file = Front(files_, files_end_);
+
+    if (directory != nullptr &&
+        (file == nullptr || directory->size.QuadPart >= file->size.QuadPart)) {
+      ++directories_;
+      return directory;
+    }
+
+    if (file != nullptr)
+      ++files_;
+
+    return file;
+  }
+
+ private:
+  static const FileEntry* Front(Iterator begin, Iterator end) {
+    if (begin == end || (*begin)->size.QuadPart <= 0)
+      return nullptr;
+
+    return begin->get();
+  }
+
+  Iterator directories_;
+  Iterator files_;
+  const Iterator directories_end_;
+  const Iterator files_end_;
+
+  LargestFirst(const LargestFirst&) = delete;
+  LargestFirst& operator=(const LargestFirst&) = delete;
+};
+
+// Returns the worst aspect ratio of a row of cells along a side of |length|,
+// given the total, the largest and the smallest of their areas.
+double Worst(double length, double total, double largest, double smallest) {
+  auto square = length * length;
+  return std::max(square * largest / (total * total),
+                  total * total / (square * smallest));
+}
+
+}  // namespace
+
+TreemapLayout::TreemapLayout(const FileEntry* root)
+    : min_size_(1), max_depth_(0) {
+  if (root == nullptr)
+    return;
+
+  entries_.push_back(root);
+  nodes_.push_back(Node{root->size.QuadPart, 0, 0});
+
+  // Put the children of each node in the order layouts visit them.
+  std::vector<size_t> stack(1, 0);
+  while (!stack.empty()) {
+    auto node = stack.back();
+    stack.pop_back();
+
+    auto first = entries_.size();
+    LargestFirst children(entries_[node]);
+    for (auto child = children.Next(); child != nullptr;
+         child = children.Next()) {
+      entries_.push_back(child);
+      nodes_.push_back(Node{child->size.QuadPart, 0, 0});
+    }
+
+    nodes_[node].first = static_cast<uint32_t>(first);
+    nodes_[node].count = static_cast<uint32_t>(entries_.size() - first);
+
+    for (auto i = entries_.size(); i-- > first;) {
+      if (!entries_[i]->children.empty())
+        stack.push_back(i);
+    }
+  }
+}
+
+void TreemapLayout::Layout(const FileEntry* root, float width, float height,
+                           float min_size, unsigned max_depth) {
+  cells_.clear();
+  min_size_ = std::max(min_size, 1.0f);
+  max_depth_ = max_depth;
+
+  auto node = FindNode(root);
+  if (node == nodes_.size() || width <= 0 || height <= 0)
+    return;
+
+  AddCell(root, false, 0, 0, 0, width, height);
+  if (nodes_[node].count > 0 && max_depth_ > 0 && width >= min_size_ &&
+      height >= min_size_) {
+    LayoutChildren(0, node);
+    cells_[0].next = cells_.size();
+  }
+}
+
+size_t TreemapLayout::HitTest(float x, float y) const {
+  auto found = cells_.size();
+
+  // Step into the cells that contain the point, and over those that don't.
+  for (size_t i = 0, end = cells_.size(); i < end;) {
+    auto& cell = cells_[i];
+    if (cell.left <= x && x < cell.right && cell.top <= y && y < cell.bottom) {
+      found = i;
+      end = cell.next;
+      ++i;
+    } else {
+      i = cell.next;
+    }
+  }
+
+  return found;
+}
+
+size_t TreemapLayout::FindNode(const FileEntry* entry) const {
+  if (entries_.empty())
+    return 0;
+
+  std::vector<const FileEntry*> path;
+  for (; entry != entries_[0]; entry = entry->parent) {
+    if (entry == nullptr)
+      return nodes_.size();
+
+    path.push_back(entry);
+  }
+
+  // Walk down from the root, looking for each entry among its siblings.
+  size_t node = 0;
+  for (auto i = path.rbegin(); i != path.rend(); ++i) {
+    auto begin = entries_.begin() + nodes_[node].first;
+    auto found = std::find(begin, begin + nodes_[node].count, *i);
+    if (found == begin + nodes_[node].count)
+      return nodes_.size();
+
+    node = found - entries_.begin();
+  }
+
+  return node;
+}
+
+void TreemapLayout::LayoutChildren(size_t parent, size_t node) {
+  auto& directory = nodes_[node];
+  auto depth = cells_[parent].depth + 1;
+  auto left = cells_[parent].left;
+  auto top = cells_[parent].top;
+  auto right = cells_[parent].right;
+  auto bottom = cells_[parent].bottom;
+
+  if (directory.size <= 0)
+    return;
+
+  // The area of a pixel per byte. What the directory holds beyond its
+  // children is left over at the end.
+  auto scale = static_cast<double>(right - left) * (bottom - top) /
+               static_cast<double>(directory.size);
+  auto min_area = static_cast<double>(min_size_) * min_size_;
+
+  auto child = directory.first;
+  auto children_end = directory.first + directory.count;
+
+  // The rows of the directories being laid out are stacked in |row_|.
+  auto row = row_.size();
+
+  while (child < children_end && nodes_[child].size * scale >= min_area) {
+    auto width = static_cast<double>(right - left);
+    auto height = static_cast<double>(bottom - top);
+    auto length = std::min(width, height);
+    if (length <= 0)
+      break;
+
+    // Fill a row along the shorter side for as long as that makes its cells
+    // squarer. Each child is smaller than those before it.
+    row_.resize(row);
+    double total = 0, largest = 0, worst = 0;
+    for (; child < children_end; ++child) {
+      auto area = nodes_[child].size * scale;
+      if (area < min_area)
+        break;
+
+      auto ratio = Worst(length, total + area, std::max(largest, area), area);
+      if (row_.size() > row && ratio > worst)
+        break;
+
+      row_.push_back(std::make_pair(child, area));
+      total += area;
+      largest = std::max(largest, area);
+      worst = ratio;
+    }
+
+    // Lay the row out along the left side if the rectangle is wide, or along
+    // the top otherwise, and leave the rest of the rectangle to the others.
+    auto thickness = static_cast<float>(total / length);
+    auto vertical = width >= height;
+    auto offset = vertical ? top : left;
+
+    for (auto i = row, count = row_.size(); i < count; ++i) {
+      auto item = row_[i];
+      auto extent = static_cast<float>(item.second / total * length);
+      auto end = i + 1 < count ? offset + extent : (vertical ? bottom : right);
+
+      auto index = cells_.size();
+      auto entry = entries_[item.first];
+      if (vertical)
+        AddCell(entry, false, depth, left, offset, left + thickness, end);
+      else
+        AddCell(entry, false, depth, offset, top, end, top + thickness);
+
+      auto& cell = cells_[index];
+      if (nodes_[item.first].count > 0 && depth < max_depth_ &&
+          cell.right - cell.left >= min_size_ &&
+          cell.bottom - cell.top >= min_size_) {
+        LayoutChildren(index, item.first);
+        cells_[index].next = cells_.size();
+      }
+
+      offset = end;
+    }
+
+    if (vertical)
+      left = std::min(left + thickness, right);
+    else
+      top = std::min(top + thickness, bottom);
+  }
+
+  row_.resize(row);
+
+  // Leave out slivers made of rounding errors alone.
+  if ((right - left) * (bottom - top) >= 1)
+    AddCell(entries_[node], true, depth, left, top, right, bottom);
+}
+
+void TreemapLayout::AddCell(const FileEntry* entry, bool rest, unsigned depth,
+                            float left, float top, float right,
+                            float bottom) {
+  cells_.push_back(
+      Cell{entry, rest, depth, left, top, right, bottom, cells_.size() + 1});
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_TREEMAP_LAYOUT_H_
+#define SCAN_VOLUME_APP_TREEMAP_LAYOUT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "app/volume_scanner.h"
+
+// Lays a scanned tree out as a squarified treemap, where each entry takes up
+// an area in proportion to its size in cells close to square.
+//
+// Only what can be seen is laid out: the children of a directory are taken
+// largest first, and once the next is below the size of a cell worth showing,
+// it and all those after it are left as one cell. Directories too small or
+// too deep aren't subdivided at all. The cost of a layout is bound by the
+// cells it makes rather than the entries in the tree, and it reads only an
+// index of sizes kept apart from the tree, so zooming into a directory or
+// resizing is just another layout.
+class TreemapLayout {
+ public:
+  struct Cell {
+    const FileEntry* entry;
+
+    // Set if the cell stands for the children of |entry| too small to be
+    // shown, together with what |entry| holds beyond its children.
+    bool rest;
+
+    // The levels below the root of the layout.
+    unsigned depth;
+
+    float left;
+    float top;
+    float right;
+    float bottom;
+
+    // The index of the first cell after those inside this one.
+    size_t next;
+  };
+
+  // Indexes the entries under |root| with a positive size. The children of
+  // each directory must be in the order SortChildren leaves them, and the
+  // tree must not change while the layout is in use.
+  explicit TreemapLayout(const FileEntry* root);
+
+  // Lays |root|, the root indexed or an entry under it, out in a rectangle of
+  // |width| by |height| pixels. Directories are subdivided while they are at
+  // least |min_size| pixels both wide and high and less than |max_depth|
+  // levels below |root|, and entries smaller than |min_size| squared are left
+  // out.
+  void Layout(const FileEntry* root, float width, float height,
+              float min_size, unsigned max_depth);
+
+  // Returns the index of the innermost cell containing the point, or the
+  // number of cells if none does.
+  size_t HitTest(float x, float y) const;
+
+  // In pre-order: each cell is followed by the cells inside it.
+  const std::vector<Cell>& cells() const {
+    return cells_;
+  }
+
+ private:
+  // An entry in the index, whose children are the |count| nodes from |first|,
+  // largest first.
+  struct Node {
+    LONGLONG size;
+    uint32_t first;
+    uint32_t count;
+  };
+
+  // Returns the number of nodes if |entry| isn't indexed.
+  size_t FindNode(const FileEntry* entry) const;
+
+  void LayoutChildren(size_t parent, size_t node);
+  void AddCell(const FileEntry* entry, bool rest, unsigned depth, float left,
+               float top, float right, float bottom);
+
+  // The children of each node are contiguous, and follow those of its parent
+  // in the order layouts visit them.
+  std::vector<const FileEntry*> entries_;
+  std::vector<Node> nodes_;
+
+  std::vector<Cell> cells_;
+  std::vector<std::pair<size_t, double>> row_;
+  float min_size_;
+  unsigned max_depth_;
+
+  TreemapLayout(const TreemapLayout&) = delete;
+  TreemapLayout& operator=(const TreemapLayout&) = delete;
+};
+
+#endif  // SCAN_VOLUME_APP_TREEMAP_LAYOUT_H_
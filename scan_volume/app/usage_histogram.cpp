@@ -0,0 +1,62 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/usage_histogram.h"
+
+#include <cwctype>
+
+namespace {
+
+const DWORD kClassAttributes[] = {
+    FILE_ATTRIBUTE_COMPRESSED, FILE_ATTRIBUTE_SPARSE_FILE,
+    FILE_ATTRIBUTE_REPARSE_POINT, FILE_ATTRIBUTE_HIDDEN,
+};
+
+static_assert(sizeof(kClassAttributes) / sizeof(kClassAttributes[0]) ==
+                  UsageHistogram::kAttributeClasses,
+              "Every attribute class must have an attribute");
+
+}  // namespace
+
+void UsageHistogram::Add(const wchar_t* name, size_t length, DWORD attributes,
+                         LONGLONG size, LONGLONG allocated) {
+  total_.Add(size, allocated);
+
+  for (int i = 0; i < kAttributeClasses; ++i) {
+    if (attributes & kClassAttributes[i])
+      classes_[i].Add(size, allocated);
+  }
+
+  auto extension = length;
+  while (extension > 0 && name[extension - 1] != L'.')
+    --extension;
+
+  key_.clear();
+  if (extension > 0) {
+    for (auto i = extension; i < length; ++i) {
+      auto c = name[i];
+      if (c < 0x80)
+        key_.push_back(L'A' <= c && c <= L'Z' ? c + 0x20 : c);
+      else
+        key_.push_back(static_cast<wchar_t>(std::towlower(c)));
+    }
+  }
+
+  extensions_[key_].Add(size, allocated);
+}
+
+void UsageHistogram::Merge(const UsageHistogram& other) {
+  total_.Add(other.total_);
+
+  for (int i = 0; i < kAttributeClasses; ++i)
+    classes_[i].Add(other.classes_[i]);
+
+  for (auto& extension : other.extensions_)
+    extensions_[extension.first].Add(extension.second);
+}
+
+void UsageHistogram::Clear() {
+  total_ = Bucket();
+  for (auto& bucket : classes_)
+    bucket = Bucket();
+  extensions_.clear();
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_USAGE_HISTOGRAM_H_
+#define SCAN_VOLUME_APP_USAGE_HISTOGRAM_H_
+
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+
+#include "app/port.h"
+
+// Tallies files by extension and by attribute class. Each thread sizing files
+// fills a histogram of its own, and those are merged once sizing ends.
+class UsageHistogram {
+ public:
+  struct Bucket {
+    Bucket() : files(0), size(0), allocated(0) {}
+
+    // Counts a file. Negative sizes are unknown, and left out of the totals.
+    void Add(LONGLONG file_size, LONGLONG file_allocated) {
+      ++files;
+      if (file_size > 0)
+        size += file_size;
+      if (file_allocated > 0)
+        allocated += file_allocated;
+    }
+
+    void Add(const Bucket& other) {
+      files += other.files;
+      size += other.size;
+      allocated += other.allocated;
+    }
+
+    DWORDLONG files;
+    LONGLONG size;
+    LONGLONG allocated;
+  };
+
+  enum AttributeClass {
+    Compressed,
+    Sparse,
+    ReparsePoint,
+    Hidden,
+    kAttributeClasses,
+  };
+
+  // Counts a file named |name| of |length| characters. Only what follows the
+  // last period of the name is looked at, so that alone may be passed.
+  void Add(const wchar_t* name, size_t length, DWORD attributes,
+           LONGLONG size, LONGLONG allocated);
+
+  void Add(const std::wstring& name, DWORD attributes, LONGLONG size,
+           LONGLONG allocated) {
+    Add(name.data(), name.size(), attributes, size, allocated);
+  }
+
+  void Merge(const UsageHistogram& other);
+  void Clear();
+
+  // Keyed by extensions folded to lower case. Files without one are counted
+  // under the empty string.
+  const std::unordered_map<std::wstring, Bucket>& extensions() const {
+    return extensions_;
+  }
+
+  const Bucket& attribute_class(AttributeClass attribute_class) const {
+    return classes_[attribute_class];
+  }
+
+  const Bucket& total() const {
+    return total_;
+  }
+
+ private:
+  Bucket total_;
+  Bucket classes_[kAttributeClasses];
+  std::unordered_map<std::wstring, Bucket> extensions_;
+
+  // Reused to look extensions up without allocating.
+  std::wstring key_;
+};
+
+#endif  // SCAN_VOLUME_APP_USAGE_HISTOGRAM_H_
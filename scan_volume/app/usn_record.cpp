@@ -0,0 +1,160 @@
+// Copyright (c) 2016 dacci.org
+
+#include "app/usn_record.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+const size_t kHeaderSize = 0x08;
+
+// The offsets of the fields up to FileName in each version of USN_RECORD.
+template <WORD Version>
+struct Layout;
+
+template <>
+struct Layout<2> {
+  typedef DWORDLONG Id;
+  static const size_t kId = 0x08;
+  static const size_t kParent = 0x10;
+  static const size_t kReason = 0x28;
+  static const size_t kAttributes = 0x34;
+  static const size_t kNameFields = 0x38;
+  static const size_t kFileName = 0x3C;
+};
+
+template <>
+struct Layout<3> {
+  typedef FILE_ID_128 Id;
+  static const size_t kId = 0x08;
+  static const size_t kParent = 0x18;
+  static const size_t kReason = 0x38;
+  static const size_t kAttributes = 0x44;
+  static const size_t kNameFields = 0x48;
+  static const size_t kFileName = 0x4C;
+};
+
+template <typename T>
+T Get(const uint8_t* pointer) {
+  T value;
+  memcpy(&value, pointer, sizeof(value));
+  return value;
+}
+
+// Checks the length of the record at the head of the |size| bytes at
+// |pointer|, and sets |length| to it.
+HRESULT ReadLength(const uint8_t* pointer, size_t size, size_t* length) {
+  if (size < kHeaderSize)
+    return E_INVALIDARG;
+
+  *length = Get<DWORD>(pointer);
+  if (*length < kHeaderSize || *length > size)
+    return E_INVALIDARG;
+
+  return S_OK;
+}
+
+// Decodes the record of |length| bytes at |pointer|, known to be of
+// |Version|.
+template <WORD Version>
+HRESULT Decode(const uint8_t* pointer, size_t length, UsnRecord* record) {
+  typedef Layout<Version> Fields;
+  if (length < Fields::kFileName)
+    return E_INVALIDARG;
+
+  record->id = Get<typename Fields::Id>(pointer + Fields::kId);
+  record->parent = Get<typename Fields::Id>(pointer + Fields::kParent);
+  record->reason = Get<DWORD>(pointer + Fields::kReason);
+  record->attributes = Get<DWORD>(pointer + Fields::kAttributes);
+
+  size_t name_length = Get<WORD>(pointer + Fields::kNameFields);
+  size_t name_offset = Get<WORD>(pointer + Fields::kNameFields + 2);
+  if (name_length % 2 != 0 || name_offset + name_length > length)
+    return E_INVALIDARG;
+
+  record->name = pointer + name_offset;
+  record->name_length = name_length / 2;
+
+  return S_OK;
+}
+
+// Decodes records from |cursor| onwards for as long as they are of |Version|,
+// advancing |cursor| and |size| past them.
+template <WORD Version>
+HRESULT DecodeRun(const uint8_t** cursor, size_t* size,
+                  std::vector<UsnRecord>* records) {
+  UsnRecord record;
+
+  for (size_t length; *size > 0; *cursor += length, *size -= length) {
+    HRESULT result = ReadLength(*cursor, *size, &length);
+    if (FAILED(result))
+      return result;
+
+    if (Get<WORD>(*cursor + 4) != Version)
+      break;
+
+    result = Decode<Version>(*cursor, length, &record);
+    if (FAILED(result))
+      return result;
+
+    records->push_back(record);
+  }
+
+  return S_OK;
+}
+
+}  // namespace
+
+HRESULT ReadUsnRecord(const void* data, size_t size, UsnRecord* record,
+                      size_t* length) {
+  auto pointer = static_cast<const uint8_t*>(data);
+  HRESULT result = ReadLength(pointer, size, length);
+  if (FAILED(result))
+    return result;
+
+  switch (Get<WORD>(pointer + 4)) {
+    case 2:
+      return Decode<2>(pointer, *length, record);
+
+    case 3:
+      return Decode<3>(pointer, *length, record);
+
+    default:
+      return S_FALSE;
+  }
+}
+
+HRESULT ReadUsnRecords(const void* data, size_t size,
+                       std::vector<UsnRecord>* records) {
+  auto cursor = static_cast<const uint8_t*>(data);
+
+  // A buffer holds records of one version in practice, so dispatch once per
+  // run rather than once per record.
+  while (size > 0) {
+    size_t length;
+    HRESULT result = ReadLength(cursor, size, &length);
+    if (FAILED(result))
+      return result;
+
+    switch (Get<WORD>(cursor + 4)) {
+      case 2:
+        result = DecodeRun<2>(&cursor, &size, records);
+        break;
+
+      case 3:
+        result = DecodeRun<3>(&cursor, &size, records);
+        break;
+
+      default:
+        cursor += length;
+        size -= length;
+        break;
+    }
+
+    if (FAILED(result))
+      return result;
+  }
+
+  return S_OK;
+}
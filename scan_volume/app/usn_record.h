@@ -0,0 +1,36 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_USN_RECORD_H_
+#define SCAN_VOLUME_APP_USN_RECORD_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "app/file_id.h"
+#include "app/port.h"
+
+// The fields of a USN_RECORD_V2 or V3 that the scanner uses. The name points
+// into the record it was read from and isn't terminated.
+struct UsnRecord {
+  FileId id;
+  FileId parent;
+  DWORD reason;
+  DWORD attributes;
+  const void* name;
+  size_t name_length;
+};
+
+// Decodes the record at the head of the |size| bytes at |data| from its
+// documented layout, and sets |length| to the bytes it takes up. Returns
+// S_FALSE for records of other versions, which carry no names, and
+// E_INVALIDARG if the record is malformed.
+HRESULT ReadUsnRecord(const void* data, size_t size, UsnRecord* record,
+                      size_t* length);
+
+// Decodes the records packed back to back in the |size| bytes at |data| and
+// appends them to |records|, skipping those of other versions. Returns
+// E_INVALIDARG at the first malformed record.
+HRESULT ReadUsnRecords(const void* data, size_t size,
+                       std::vector<UsnRecord>* records);
+
+#endif  // SCAN_VOLUME_APP_USN_RECORD_H_
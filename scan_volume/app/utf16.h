@@ -0,0 +1,141 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_APP_UTF16_H_
+#define SCAN_VOLUME_APP_UTF16_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Appends the |length| little-endian UTF-16 code units at |data| to |text|,
+// a std::wstring or std::vector<wchar_t>. Surrogate pairs are combined where
+// wchar_t is wider than 16 bits. |data| need not be aligned.
+template <typename Text>
+void AppendUtf16(const void* data, size_t length, Text* text) {
+  auto offset = text->size();
+
+  if (sizeof(wchar_t) == 2) {
+    text->resize(offset + length);
+    if (length > 0)
+      memcpy(&(*text)[offset], data, length * 2);
+    return;
+  }
+
+  // Not reserved up front, which would defeat the geometric growth of
+  // |text| when appending many short names to it.
+  auto pointer = static_cast<const uint8_t*>(data);
+
+  for (size_t i = 0; i < length; ++i) {
+    uint16_t unit16;
+    memcpy(&unit16, pointer + i * 2, sizeof(unit16));
+    uint32_t unit = unit16;
+
+    if (sizeof(wchar_t) > 2 && 0xD800 <= unit && unit < 0xDC00 &&
+        i + 1 < length) {
+      uint16_t low;
+      memcpy(&low, pointer + (i + 1) * 2, sizeof(low));
+      if (0xDC00 <= low && low < 0xE000) {
+        unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+        ++i;
+      }
+    }
+
+    text->push_back(static_cast<wchar_t>(unit));
+  }
+}
+
+// Assigns the |length| little-endian UTF-16 code units at |data| to |text|.
+inline void AssignUtf16(const void* data, size_t length, std::wstring* text) {
+  text->clear();
+  AppendUtf16(data, length, text);
+}
+
+// Appends |text| to |output| as UTF-16 code units. Characters beyond the BMP
+// are split into surrogate pairs where wchar_t is wider than 16 bits.
+inline void AppendUtf16Units(const std::wstring& text,
+                             std::vector<char16_t>* output) {
+  for (auto character : text) {
+    auto code = static_cast<uint32_t>(character);
+    if (sizeof(wchar_t) > 2 && code >= 0x10000) {
+      code -= 0x10000;
+      output->push_back(static_cast<char16_t>(0xD800 + (code >> 10)));
+      code = 0xDC00 + (code & 0x3FF);
+    }
+
+    output->push_back(static_cast<char16_t>(code));
+  }
+}
+
+// Returns |text| encoded in UTF-8. Surrogate pairs are combined where wchar_t
+// is 16 bits wide.
+inline std::string EncodeUtf8(const std::wstring& text) {
+  std::string output;
+  output.reserve(text.size());
+
+  for (size_t i = 0; i < text.size(); ++i) {
+    auto code = static_cast<uint32_t>(text[i]);
+    if (sizeof(wchar_t) == 2 && 0xD800 <= code && code < 0xDC00 &&
+        i + 1 < text.size()) {
+      auto low = static_cast<uint32_t>(text[i + 1]);
+      if (0xDC00 <= low && low < 0xE000) {
+        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        ++i;
+      }
+    }
+
+    if (code < 0x80) {
+      output.push_back(static_cast<char>(code));
+    } else if (code < 0x800) {
+      output.push_back(static_cast<char>(0xC0 | (code >> 6)));
+      output.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else if (code < 0x10000) {
+      output.push_back(static_cast<char>(0xE0 | (code >> 12)));
+      output.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    } else {
+      output.push_back(static_cast<char>(0xF0 | (code >> 18)));
+      output.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+    }
+  }
+
+  return output;
+}
+
+// Assigns |text|, NUL-terminated UTF-8, to |output|. Malformed sequences
+// become U+FFFD, and surrogate pairs are made where wchar_t is 16 bits wide.
+inline void DecodeUtf8(const char* text, std::wstring* output) {
+  output->clear();
+
+  for (auto cursor = reinterpret_cast<const unsigned char*>(text); *cursor;) {
+    uint32_t code = *cursor++;
+    int trailing = code >= 0xF0 ? 3 : code >= 0xE0 ? 2 : code >= 0xC0 ? 1 : 0;
+
+    if (code >= 0x80 && trailing == 0) {
+      code = 0xFFFD;
+    } else if (trailing > 0) {
+      code &= 0x3F >> trailing;
+      for (; trailing > 0; --trailing) {
+        if ((*cursor & 0xC0) != 0x80)
+          break;
+
+        code = (code << 6) | (*cursor++ & 0x3F);
+      }
+
+      if (trailing > 0)
+        code = 0xFFFD;
+    }
+
+    if (sizeof(wchar_t) == 2 && code >= 0x10000) {
+      code -= 0x10000;
+      output->push_back(static_cast<wchar_t>(0xD800 + (code >> 10)));
+      code = 0xDC00 + (code & 0x3FF);
+    }
+
+    output->push_back(static_cast<wchar_t>(code));
+  }
+}
+
+#endif  // SCAN_VOLUME_APP_UTF16_H_
@@ -2,399 +2,288 @@
 
 #include "app/volume_scanner.h"
 
-#include <winioctl.h>
-
 #include <algorithm>
-#include <array>
-#include <list>
-#include <map>
-#include <vector>
-
-namespace {
-
-class FileId : public std::array<BYTE, 16> {
- public:
-  FileId() {
-    fill(static_cast<value_type>(-1));
-  }
-
-  explicit FileId(const FILE_ID_128& id) {
-    operator=(id);
-  }
-
-  explicit FileId(const DWORDLONG& id) {
-    operator=(id);
-  }
-
-  FileId& operator=(const FILE_ID_128& id) {
-    memcpy(data(), id.Identifier, size());
-    return *this;
-  }
+#include <system_error>
 
-  FileId& operator=(const DWORDLONG& id) {
-    fill(0);
-    memcpy(data(), &id, sizeof(id));
-    return *this;
-  }
+#include "app/task_scheduler.h"
+#include "app/throttle.h"
 
-  bool operator==(const FileId& other) const {
-    return memcmp(data(), other.data(), size()) == 0;
-  }
+#ifdef _WIN32
+#include "app/ntfs_backend.h"
+#else
+#include "app/posix_backend.h"
+#endif
 
-  bool operator<(const FileId& other) const {
-    auto a = rbegin(), b = other.rbegin();
+namespace {
 
-    for (size_t i = 0; i < size(); ++i) {
-      if (*a != *b)
-        return *a < *b;
+// The number of subtrees to split aggregation into for each worker.
+const size_t kSubtreesPerWorker = 8;
 
-      ++a;
-      ++b;
-    }
+bool IsDirectory(const FileEntry* entry) {
+  return (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+}
 
-    return false;
+void SumChildren(FileEntry* directory) {
+  LONGLONG total = std::max<LONGLONG>(directory->size.QuadPart, 0);
+  LONGLONG allocated = std::max<LONGLONG>(directory->allocated.QuadPart, 0);
+  for (auto& child : directory->children) {
+    if (child->size.QuadPart > 0)
+      total += child->size.QuadPart;
+    if (child->allocated.QuadPart > 0)
+      allocated += child->allocated.QuadPart;
   }
-};
 
-bool GetFileSize(const std::wstring& path, LARGE_INTEGER* size) {
-  bool succeeded = false;
+  directory->size.QuadPart = total;
+  directory->allocated.QuadPart = allocated;
 
-  HANDLE handle = CreateFileW(
-      path.c_str(), FILE_READ_ATTRIBUTES,
-      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
-      OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
-      NULL);
-  if (handle != INVALID_HANDLE_VALUE) {
-    if (GetFileSizeEx(handle, size))
-      succeeded = true;
+  SortChildren(directory);
+}
 
-    CloseHandle(handle);
-    handle = INVALID_HANDLE_VALUE;
-  }
+void SumSubtree(FileEntry* root) {
+  std::vector<std::pair<FileEntry*, size_t>> stack;
+  stack.push_back(std::make_pair(root, 0));
 
-  if (!succeeded) {
-    WIN32_FIND_DATAW find_data;
-    handle = FindFirstFileW(path.c_str(), &find_data);
-    if (handle != INVALID_HANDLE_VALUE) {
-      size->LowPart = find_data.nFileSizeLow;
-      size->HighPart = find_data.nFileSizeHigh;
-      succeeded = true;
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    auto directory = top.first;
 
-      FindClose(handle);
-      handle = INVALID_HANDLE_VALUE;
+    if (top.second < directory->children.size()) {
+      auto child = directory->children[top.second++].get();
+      if (IsDirectory(child))
+        stack.push_back(std::make_pair(child, 0));
+      continue;
     }
-  }
 
-  return succeeded;
+    SumChildren(directory);
+    stack.pop_back();
+  }
 }
 
-template <typename Record>
-void ProcessRecord(const Record& record,
-                   std::map<FileId, FileEntry*>* entries) {
-  FileId id(record.FileReferenceNumber);
-  FileId parent_id(record.ParentFileReferenceNumber);
+}  // namespace
 
-  auto pointer = reinterpret_cast<const wchar_t*>(
-      reinterpret_cast<const char*>(&record) + record.FileNameOffset);
-  auto length = record.FileNameLength / sizeof(wchar_t);
+void AggregateSizes(FileEntry* root, TaskScheduler* scheduler) {
+  if (root == nullptr)
+    return;
 
-  auto& parent = (*entries)[parent_id];
-  if (parent == nullptr)
-    parent = new FileEntry();
+  TaskGroup group(scheduler);
 
-  auto& entry = (*entries)[id];
-  if (entry == nullptr)
-    entry = new FileEntry();
+  // Split the tree breadth-first until there are enough disjoint subtrees to
+  // keep every worker busy. Directories above that frontier are summed last.
+  std::vector<FileEntry*> upper;
+  std::vector<FileEntry*> frontier(1, root);
 
-  entry->parent = parent;
-  entry->attributes = record.FileAttributes;
-  entry->name.assign(pointer, length);
+  while (frontier.size() < group.concurrency() * kSubtreesPerWorker) {
+    std::vector<FileEntry*> next;
+    auto expanded = upper.size();
 
-  parent->children.push_back(std::unique_ptr<FileEntry>(entry));
-}
+    for (auto directory : frontier) {
+      auto begin = next.size();
+      for (auto& child : directory->children) {
+        if (IsDirectory(child.get()))
+          next.push_back(child.get());
+      }
 
-}  // namespace
+      if (next.size() == begin) {
+        next.push_back(directory);
+      } else {
+        upper.push_back(directory);
+      }
+    }
 
-struct VolumeScanner::Context {
-  Context(VolumeScanner* instance, HWND hWnd) : instance(instance), hWnd(hWnd) {
-    InitializeSRWLock(&queue_lock);
-    InitializeConditionVariable(&queue_available);
+    frontier.swap(next);
+    if (upper.size() == expanded)
+      break;
   }
 
-  VolumeScanner* const instance;
-  const HWND hWnd;
-  std::map<FileId, FileEntry*> entries;
-  std::vector<std::unique_ptr<FileEntry>> roots;
-  std::list<FileEntry*> queue;
-  SRWLOCK queue_lock;
-  CONDITION_VARIABLE queue_available;
-};
+  for (auto subtree : frontier)
+    group.Post([subtree]() { SumSubtree(subtree); });
 
-VolumeScanner::VolumeScanner() : cancel_(false), thread_(NULL) {
-  InitializeSRWLock(&lock_);
-  InitializeConditionVariable(&done_);
-}
+  group.Wait();
 
-HRESULT VolumeScanner::Scan(HWND hWnd) {
-  HRESULT result = E_FAIL;
-
-  AcquireSRWLockExclusive(&lock_);
-
-  if (thread_ == NULL) {
-    auto context = std::make_unique<Context>(this, hWnd);
-    if (context != nullptr) {
-      cancel_ = false;
+  for (auto i = upper.rbegin(), end = upper.rend(); i != end; ++i)
+    SumChildren(*i);
+}
 
-      thread_ = CreateThread(nullptr, 0, Run, context.get(), 0, nullptr);
-      if (thread_ != NULL) {
-        context.release();
-        result = S_OK;
-      } else {
-        result = HRESULT_FROM_WIN32(GetLastError());
-      }
-    } else {
-      result = E_OUTOFMEMORY;
+void CountUsage(const FileEntry* directory, UsageHistogram* usage) {
+  std::vector<const FileEntry*> stack(1, directory);
+  while (!stack.empty()) {
+    auto top = stack.back();
+    stack.pop_back();
+
+    for (auto& child : top->children) {
+      if (IsDirectory(child.get()))
+        stack.push_back(child.get());
+      else
+        usage->Add(child->name, child->attributes, child->size.QuadPart,
+                   child->allocated.QuadPart);
     }
   }
-
-  ReleaseSRWLockExclusive(&lock_);
-
-  return result;
 }
 
-void VolumeScanner::Cancel() {
-  AcquireSRWLockExclusive(&lock_);
+void SortChildren(FileEntry* directory) {
+  std::sort(directory->children.begin(), directory->children.end(),
+            [](const std::unique_ptr<FileEntry>& a,
+               const std::unique_ptr<FileEntry>& b) {
+              auto a_directory = IsDirectory(a.get());
+              if (a_directory != IsDirectory(b.get()))
+                return a_directory;
 
-  cancel_ = true;
+              if (a->size.QuadPart != b->size.QuadPart)
+                return a->size.QuadPart > b->size.QuadPart;
 
-  while (thread_ != NULL) {
-    if (!SleepConditionVariableSRW(&done_, &lock_, INFINITE, 0))
-      break;
-  }
-
-  ReleaseSRWLockExclusive(&lock_);
+              return a->name < b->name;
+            });
 }
 
-DWORD CALLBACK VolumeScanner::Run(void* param) {
-  auto context = static_cast<Context*>(param);
-  HRESULT result;
+#ifdef _WIN32
 
-  PostMessage(context->hWnd, WM_USER, EnumBegin, 0);
-  result = context->instance->Enumerate(context);
-  PostMessage(context->hWnd, WM_USER, EnumEnd, result);
+class VolumeScanner::WindowListener : public VolumeScanner::Listener {
+ public:
+  explicit WindowListener(HWND hWnd) : hWnd_(hWnd) {}
 
-  if (SUCCEEDED(result) && result != S_FALSE) {
-    for (auto& pair : context->entries) {
-      if (pair.second->parent != nullptr)
-        continue;
+  void OnScanProgress(Messages message, HRESULT result) override {
+    PostMessage(hWnd_, WM_USER, message, result);
+  }
 
-      std::unique_ptr<FileEntry> root(pair.second);
-      root->attributes = FILE_ATTRIBUTE_DIRECTORY;
-      root->name = context->instance->target_.c_str();
-      context->roots.push_back(std::move(root));
-    }
+ private:
+  const HWND hWnd_;
+};
 
-    PostMessage(context->hWnd, WM_USER, SizeBegin, 0);
+#endif  // _WIN32
 
-    SYSTEM_INFO system_info;
-    GetSystemInfo(&system_info);
+VolumeScanner::VolumeScanner() : cancel_(false), running_(false) {}
 
-    DWORD concurrency =
-        std::min<DWORD>(MAXIMUM_WAIT_OBJECTS, system_info.dwNumberOfProcessors);
-    concurrency = concurrency * 3 / 2;
+VolumeScanner::~VolumeScanner() {
+  Cancel();
 
-    std::vector<HANDLE> threads;
-    for (DWORD i = 0; i < concurrency; ++i) {
-      HANDLE thread = CreateThread(nullptr, 0, SizeThread, context, 0, nullptr);
-      if (thread == NULL)
-        break;
+  if (thread_.joinable())
+    thread_.join();
+}
 
-      threads.push_back(thread);
-    }
+HRESULT VolumeScanner::Scan(Listener* listener) {
+  std::lock_guard<std::mutex> guard(lock_);
 
-    if (threads.empty()) {
-      result = HRESULT_FROM_WIN32(GetLastError());
-    } else {
-      for (auto& pair : context->entries) {
-        AcquireSRWLockShared(&context->instance->lock_);
-        bool cancel = context->instance->cancel_;
-        ReleaseSRWLockShared(&context->instance->lock_);
-        if (cancel) {
-          result = E_ABORT;
-          break;
-        }
-
-        AcquireSRWLockExclusive(&context->queue_lock);
-
-        if (!(pair.second->attributes & FILE_ATTRIBUTE_DIRECTORY)) {
-          context->queue.push_front(pair.second);
-          WakeAllConditionVariable(&context->queue_available);
-        }
-
-        ReleaseSRWLockExclusive(&context->queue_lock);
-      }
+  if (running_)
+    return E_FAIL;
 
-      AcquireSRWLockExclusive(&context->queue_lock);
-      context->queue.push_front(nullptr);
-      WakeAllConditionVariable(&context->queue_available);
-      ReleaseSRWLockExclusive(&context->queue_lock);
+  if (thread_.joinable())
+    thread_.join();
 
-      WaitForMultipleObjects(static_cast<DWORD>(threads.size()), &threads[0],
-                             TRUE, INFINITE);
-      std::for_each(threads.begin(), threads.end(), CloseHandle);
-      threads.clear();
-    }
+  cancel_ = false;
+  counters_.Reset();
+  running_ = true;
 
-    PostMessage(context->hWnd, WM_USER, SizeEnd, result);
+  try {
+    thread_ = std::thread(&VolumeScanner::Run, this, listener);
+  } catch (const std::system_error&) {
+    running_ = false;
+    return E_FAIL;
   }
 
-  if (SUCCEEDED(result)) {
-    AcquireSRWLockExclusive(&context->instance->lock_);
-    context->instance->roots_.clear();
-    context->instance->roots_ = std::move(context->roots);
-    ReleaseSRWLockExclusive(&context->instance->lock_);
-  } else {
-    for (auto& pair : context->entries) {
-      for (auto& child : pair.second->children)
-        child.release();
-
-      delete pair.second;
-    }
-  }
-
-  PostMessage(context->hWnd, WM_USER, ScanEnd, result);
-
-  AcquireSRWLockExclusive(&context->instance->lock_);
+  return S_OK;
+}
 
-  CloseHandle(context->instance->thread_);
-  context->instance->thread_ = NULL;
-  WakeAllConditionVariable(&context->instance->done_);
+#ifdef _WIN32
 
-  ReleaseSRWLockExclusive(&context->instance->lock_);
+HRESULT VolumeScanner::Scan(HWND hWnd) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (running_)
+      return E_FAIL;
+  }
 
-  delete context;
+  window_listener_ = std::make_unique<WindowListener>(hWnd);
 
-  return 0;
+  return Scan(window_listener_.get());
 }
 
-HRESULT VolumeScanner::Enumerate(Context* context) {
-  auto path = std::wstring(L"\\\\.\\").append(target_);
-  HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ,
-                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
-                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-  if (handle == INVALID_HANDLE_VALUE)
-    return HRESULT_FROM_WIN32(GetLastError());
-
-  auto& entries = context->entries;
-
-  MFT_ENUM_DATA_V1 enum_query{0, 0, MAXLONGLONG, 2, 3};
-  char buffer[kBufferSize];
-  DWORD bytes = 0;
-  HRESULT error = S_OK;
-
-  for (;;) {
-    AcquireSRWLockShared(&lock_);
-    if (cancel_)
-      error = E_ABORT;
-    ReleaseSRWLockShared(&lock_);
-    if (FAILED(error))
-      break;
+#endif  // _WIN32
 
-    BOOL succeeded = DeviceIoControl(handle, FSCTL_ENUM_USN_DATA, &enum_query,
-                                     sizeof(enum_query), buffer, kBufferSize,
-                                     &bytes, nullptr);
-    if (!succeeded) {
-      error = HRESULT_FROM_WIN32(GetLastError());
-      break;
-    }
+void VolumeScanner::Cancel() {
+  std::unique_lock<std::mutex> guard(lock_);
 
-    for (auto cursor = buffer + 8; bytes > 8 && !cancel_;) {
-      AcquireSRWLockShared(&lock_);
-      if (cancel_)
-        error = E_ABORT;
-      ReleaseSRWLockShared(&lock_);
-      if (FAILED(error))
-        break;
+  cancel_ = true;
+  done_.wait(guard, [this] { return !running_; });
+}
 
-      auto record = reinterpret_cast<USN_RECORD_UNION*>(cursor);
+void VolumeScanner::Run(Listener* listener) {
+  // The thread is the scan's own, so it is left in the background, as are
+  // the workers of the pool made for the scan.
+  TaskScheduler::Task on_start;
+  if (resources_.throttle != nullptr) {
+    EnterBackgroundMode();
+    on_start = EnterBackgroundMode;
+  }
 
-      switch (record->Header.MajorVersion) {
-        case 2:
-          ProcessRecord(record->V2, &entries);
-          break;
+  auto resources = resources_;
+  std::unique_ptr<TaskScheduler> scheduler;
+  if (resources.scheduler == nullptr) {
+    scheduler = std::make_unique<TaskScheduler>(
+        std::thread::hardware_concurrency(), on_start);
+    resources.scheduler = scheduler.get();
+  }
 
-        case 3:
-          ProcessRecord(record->V3, &entries);
-          break;
+#ifdef _WIN32
+  NtfsBackend backend(target_, options_, resources, &cancel_, &counters_);
+#else
+  PosixBackend backend(target_, options_, resources, &cancel_, &counters_);
+#endif
+  HRESULT result = E_NOTIMPL;
+
+  // Replay the changes since the last scan of the same target if possible,
+  // and fall back to a full scan otherwise.
+  if (cursor_.valid() && !roots_.empty()) {
+    listener->OnScanProgress(EnumBegin, S_OK);
+    result = backend.Update(&roots_, &cursor_);
+    listener->OnScanProgress(EnumEnd, result);
+
+    if (FAILED(result)) {
+      cursor_ = JournalCursor();
+    } else {
+      // Count again from the tree, which only has names to go by if they
+      // were kept.
+      UsageHistogram usage;
+      if (options_.keep_file_names) {
+        for (auto& root : roots_)
+          CountUsage(root.get(), &usage);
       }
 
-      cursor += record->Header.RecordLength;
-      bytes -= record->Header.RecordLength;
+      std::lock_guard<std::mutex> guard(lock_);
+      usage_ = std::move(usage);
     }
-
-    enum_query.StartFileReferenceNumber = *reinterpret_cast<DWORDLONG*>(buffer);
   }
 
-  CloseHandle(handle);
-  handle = INVALID_HANDLE_VALUE;
-
-  if (HRESULT_CODE(error) != ERROR_HANDLE_EOF)
-    return error;
-
-  return entries.empty() ? S_FALSE : S_OK;
-}
+  if (FAILED(result) && result != E_ABORT) {
+    listener->OnScanProgress(EnumBegin, S_OK);
+    result = backend.Enumerate();
+    listener->OnScanProgress(EnumEnd, result);
 
-DWORD CALLBACK VolumeScanner::SizeThread(void* param) {
-  auto context = static_cast<Context*>(param);
-
-  BOOL wow64 = FALSE;
-  void* redirection = nullptr;
-  if (IsWow64Process(GetCurrentProcess(), &wow64) && wow64)
-    Wow64DisableWow64FsRedirection(&redirection);
-
-  for (bool cancel = false; !cancel;) {
-    AcquireSRWLockShared(&context->instance->lock_);
-    cancel = context->instance->cancel_;
-    ReleaseSRWLockShared(&context->instance->lock_);
-    if (cancel)
-      break;
-
-    AcquireSRWLockExclusive(&context->queue_lock);
-
-    while (context->queue.empty())
-      SleepConditionVariableSRW(&context->queue_available, &context->queue_lock,
-                                INFINITE, 0);
+    if (SUCCEEDED(result) && result != S_FALSE) {
+      listener->OnScanProgress(SizeBegin, S_OK);
+      result = backend.Size();
+      listener->OnScanProgress(SizeEnd, result);
+    }
 
-    auto entry = context->queue.back();
-    if (entry != nullptr)
-      context->queue.pop_back();
-    ReleaseSRWLockExclusive(&context->queue_lock);
-    if (entry == nullptr)
-      break;
+    if (SUCCEEDED(result)) {
+      std::vector<std::unique_ptr<FileEntry>> roots;
+      backend.GetRoots(&roots);
 
-    std::list<FileEntry*> tree_path;
-    for (auto cursor = entry; cursor != nullptr; cursor = cursor->parent)
-      tree_path.push_front(cursor);
+      UsageHistogram usage;
+      backend.GetUsage(&usage);
 
-    std::wstring path(L"\\\\?");
-    path.reserve(MAX_PATH);
-    for (auto cursor : tree_path) {
-      path.push_back(L'\\');
-      path.append(cursor->name);
-    }
+      JournalCursor cursor;
+      backend.GetCursor(&cursor);
 
-    if (GetFileSize(path, &entry->size)) {
-      for (auto cursor : tree_path) {
-        if (cursor != entry)
-          InterlockedAdd64(&cursor->size.QuadPart, entry->size.QuadPart);
-      }
-    } else {
-      entry->size.QuadPart = -1;
+      std::lock_guard<std::mutex> guard(lock_);
+      roots_ = std::move(roots);
+      usage_ = std::move(usage);
+      cursor_ = cursor;
     }
   }
 
-  if (wow64)
-    Wow64RevertWow64FsRedirection(&redirection);
+  listener->OnScanProgress(ScanEnd, result);
 
-  return 0;
+  std::lock_guard<std::mutex> guard(lock_);
+  running_ = false;
+  done_.notify_all();
 }
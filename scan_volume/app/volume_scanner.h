@@ -3,28 +3,114 @@
 #ifndef SCAN_VOLUME_APP_VOLUME_SCANNER_H_
 #define SCAN_VOLUME_APP_VOLUME_SCANNER_H_
 
-#include <windows.h>
-
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include <pshpack8.h>  // NOLINT(build/include_order)
+#include "app/file_id.h"
+#include "app/port.h"
+#include "app/scan_counters.h"
+#include "app/usage_histogram.h"
+
+class IoBudget;
+class TaskScheduler;
+class Throttle;
+
+#pragma pack(push, 8)
 
 struct FileEntry {
-  FileEntry() : parent(nullptr), attributes(), size() {}
+  FileEntry() : parent(nullptr), attributes(), size(), allocated() {}
 
   FileEntry* parent;
+  FileId id;
   DWORD attributes;
   std::wstring name;
   LARGE_INTEGER size;
+
+  // The space taken up on disk, which is less than |size| for compressed and
+  // sparse files. Negative if unknown.
+  LARGE_INTEGER allocated;
   std::vector<std::unique_ptr<FileEntry>> children;
 
   FileEntry(const FileEntry&) = delete;
   FileEntry& operator=(const FileEntry&) = delete;
 };
 
-#include <poppack.h>  // NOLINT(build/include_order)
+#pragma pack(pop)
+
+// A position in the change journal of a volume. A scan result carries the
+// position it is current as of so that it can be brought up to date later.
+struct JournalCursor {
+  JournalCursor() : journal_id(), next_usn() {}
+
+  bool valid() const {
+    return journal_id != 0;
+  }
+
+  DWORDLONG journal_id;
+  LONGLONG next_usn;
+};
+
+// How a scan builds its tree.
+struct ScanOptions {
+  ScanOptions()
+      : keep_file_names(true),
+        directories_only(false),
+        dedupe_hard_links(false) {}
+
+  // Whether files, as opposed to directories, keep their names. Scans whose
+  // results never show file names can leave them out to save memory.
+  bool keep_file_names;
+
+  // Whether to keep directories only. Files are added to the totals of their
+  // directories and dropped, so memory scales with the number of directories
+  // rather than files. Such trees can't be updated from the change journal.
+  bool directories_only;
+
+  // Whether a file with several hard links is counted under one of them only,
+  // whichever is reached first. The others are kept with zero sizes. NTFS
+  // trees hold one entry per file anyway, so this only matters where names
+  // are listed, as when keeping directories only.
+  bool dedupe_hard_links;
+};
+
+// What a scan may use to run, which doesn't change what it finds. Scans of
+// several targets at once can share them.
+struct ScanResources {
+  ScanResources()
+      : io_budget(nullptr), scheduler(nullptr), throttle(nullptr) {}
+
+  // Caps the I/O requests in flight on the device of the target, or null for
+  // no cap.
+  IoBudget* io_budget;
+
+  // Runs the CPU-bound work of the scan, such as sorting and totaling, or
+  // null for a pool of the scan's own.
+  TaskScheduler* scheduler;
+
+  // Paces the I/O of the scan, which then runs in the background with as
+  // little impact on others as it can, or null to go at full speed.
+  Throttle* throttle;
+};
+
+// Sets the size and allocated size of every directory under |root| to the
+// totals of its children in a single bottom-up pass, plus any it already has,
+// such as those of files folded into it, and sorts the children of each with
+// SortChildren. Disjoint subtrees are reduced in parallel on |scheduler|.
+// Negative sizes are left out of the totals.
+void AggregateSizes(FileEntry* root, TaskScheduler* scheduler);
+
+// Puts the children of |directory| in the order they are shown in:
+// directories first, then the largest first, then by name.
+void SortChildren(FileEntry* directory);
+
+// Tallies every file under |directory| into |usage|, by the names and sizes
+// kept in the tree.
+void CountUsage(const FileEntry* directory, UsageHistogram* usage);
 
 class VolumeScanner {
  public:
@@ -36,17 +122,58 @@ class VolumeScanner {
     ScanEnd,
   };
 
+  // Receives the progress of a scan on the scanning thread.
+  class Listener {
+   public:
+    virtual void OnScanProgress(Messages message, HRESULT result) = 0;
+
+   protected:
+    ~Listener() {}
+  };
+
   VolumeScanner();
+  ~VolumeScanner();
 
+  HRESULT Scan(Listener* listener);
+#ifdef _WIN32
+  // Posts each progress notification to |hWnd| as WM_USER.
   HRESULT Scan(HWND hWnd);
+#endif
   void Cancel();
 
+  // Takes a snapshot of the counters of the current or last scan. Cheap
+  // enough to poll from a timer.
+  void GetProgress(ScanProgress* progress) const {
+    counters_.Read(progress);
+  }
+
   const std::wstring& GetTarget() const {
     return target_;
   }
 
+  // Changing the target drops the journal position of the last scan, so the
+  // next scan starts from scratch.
   void SetTarget(const wchar_t* target) {
-    target_ = target;
+    if (target_ != target) {
+      target_ = target;
+      cursor_ = JournalCursor();
+    }
+  }
+
+  const ScanOptions& GetOptions() const {
+    return options_;
+  }
+
+  // Changing the options drops the journal position of the last scan too,
+  // since its tree was built under the old ones.
+  void SetOptions(const ScanOptions& options) {
+    options_ = options;
+    cursor_ = JournalCursor();
+  }
+
+  // Must outlive any scan started with them.
+  void SetResources(const ScanResources& resources) {
+    resources_ = resources;
   }
 
   FileEntry* GetRoot() const {
@@ -56,22 +183,35 @@ class VolumeScanner {
       return roots_[0].get();
   }
 
- private:
-  struct Context;
-
-  static const size_t kBufferSize = 64 * 1024;
-
-  static DWORD CALLBACK Run(void* param);
-  HRESULT Enumerate(Context* context);
-  static DWORD CALLBACK SizeThread(void* param);
+  // The tallies of every file by extension and attribute class, as of the
+  // last scan. Empty if an update couldn't tell the extensions of the files.
+  const UsageHistogram& GetUsage() const {
+    return usage_;
+  }
 
-  SRWLOCK lock_;
-  CONDITION_VARIABLE done_;
-  bool cancel_;
-  HANDLE thread_;
+ private:
+#ifdef _WIN32
+  class WindowListener;
+#endif
+
+  void Run(Listener* listener);
+
+  std::mutex lock_;
+  std::condition_variable done_;
+  std::atomic<bool> cancel_;
+  ScanCounters counters_;
+  bool running_;
+  std::thread thread_;
+#ifdef _WIN32
+  std::unique_ptr<WindowListener> window_listener_;
+#endif
 
   std::wstring target_;
+  ScanOptions options_;
+  ScanResources resources_;
   std::vector<std::unique_ptr<FileEntry>> roots_;
+  UsageHistogram usage_;
+  JournalCursor cursor_;
 
   VolumeScanner(const VolumeScanner&) = delete;
   VolumeScanner& operator=(const VolumeScanner&) = delete;
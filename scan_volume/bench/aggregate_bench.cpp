@@ -0,0 +1,81 @@
+// Copyright (c) 2016 dacci.org
+
+// Times AggregateSizes on a bushy tree and on a deep, narrow one, by the
+// number of threads it runs on.
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+const int64_t kThreadCounts[] = {1, 2, 4, 8};
+
+// Zeroes the totals of the directories under |root|, so that they can be
+// taken again.
+void ClearTotals(FileEntry* root) {
+  std::vector<FileEntry*> stack(1, root);
+  while (!stack.empty()) {
+    auto directory = stack.back();
+    stack.pop_back();
+
+    directory->size.QuadPart = 0;
+    directory->allocated.QuadPart = 0;
+    for (auto& child : directory->children) {
+      if (child->attributes & FILE_ATTRIBUTE_DIRECTORY)
+        stack.push_back(child.get());
+    }
+  }
+}
+
+void Aggregate(benchmark::State& state,
+               const SyntheticVolumeOptions& options) {
+  auto& volume = GetVolume(static_cast<size_t>(state.range(0)), options);
+  auto root = BuildTree(volume);
+  TaskScheduler scheduler(static_cast<size_t>(state.range(1)));
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    ClearTotals(root.get());
+    state.ResumeTiming();
+
+    AggregateSizes(root.get(), &scheduler);
+  }
+
+  if (root->size.QuadPart != volume.total_size())
+    state.SkipWithError("the totals are wrong");
+
+  state.counters["depth"] = static_cast<double>(volume.depth());
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * volume.entries()));
+}
+
+void BM_AggregateBushy(benchmark::State& state) {
+  Aggregate(state, SyntheticVolumeOptions());
+}
+
+// Nearly every entry goes under one of the last few directories made, so
+// the tree is a few long chains, as under deep build trees.
+void BM_AggregateDeep(benchmark::State& state) {
+  SyntheticVolumeOptions options;
+  options.max_depth = 4096;
+  options.fan_out_skew = -0.9;
+  Aggregate(state, options);
+}
+
+void Arguments(benchmark::internal::Benchmark* benchmark) {
+  EntryCounts(benchmark, kThreadCounts,
+              sizeof(kThreadCounts) / sizeof(*kThreadCounts));
+}
+
+BENCHMARK(BM_AggregateBushy)->Apply(Arguments)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_AggregateDeep)->Apply(Arguments)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
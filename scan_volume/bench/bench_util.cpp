@@ -0,0 +1,109 @@
+// Copyright (c) 2016 dacci.org
+
+#include "bench/bench_util.h"
+
+#include <malloc.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "app/task_scheduler.h"
+#include "app/tree_builder.h"
+
+namespace {
+
+const size_t kBufferSize = 256 * 1024;
+
+const int64_t kEntryCounts[] = {
+    kSmokeEntries, 1000000, 10000000, 50000000,
+};
+
+bool operator==(const SyntheticVolumeOptions& a,
+                const SyntheticVolumeOptions& b) {
+  return a.entries == b.entries && a.max_depth == b.max_depth &&
+         a.directory_ratio == b.directory_ratio &&
+         a.fan_out_skew == b.fan_out_skew &&
+         a.min_name_length == b.min_name_length &&
+         a.max_name_length == b.max_name_length && a.v3_ratio == b.v3_ratio &&
+         a.wide_ids == b.wide_ids && a.seed == b.seed;
+}
+
+}  // namespace
+
+void EntryCounts(benchmark::internal::Benchmark* benchmark) {
+  for (auto entries : kEntryCounts)
+    benchmark->Arg(entries);
+}
+
+void EntryCounts(benchmark::internal::Benchmark* benchmark,
+                 const int64_t* others, size_t count) {
+  for (auto entries : kEntryCounts) {
+    for (size_t i = 0; i < count; ++i)
+      benchmark->Args({entries, others[i]});
+  }
+}
+
+const SyntheticVolume& GetVolume(size_t entries,
+                                 const SyntheticVolumeOptions& options) {
+  static SyntheticVolumeOptions last;
+  static std::unique_ptr<SyntheticVolume> volume;
+
+  auto wanted = options;
+  wanted.entries = entries;
+  if (volume == nullptr || !(wanted == last)) {
+    volume.reset();
+    volume = std::make_unique<SyntheticVolume>(wanted);
+    last = wanted;
+  }
+
+  return *volume;
+}
+
+std::unique_ptr<FileEntry> BuildTree(const SyntheticVolume& volume) {
+  TaskScheduler scheduler(std::max(1u, std::thread::hardware_concurrency()));
+  TreeBuilder builder;
+  builder.Reserve(static_cast<size_t>(volume.record_count()));
+
+  std::vector<char> buffer(kBufferSize);
+  TreeBuilder::Batch batch;
+  DWORDLONG next = 0;
+  for (size_t bytes; (bytes = volume.Enumerate(next, buffer.data(),
+                                               buffer.size())) > 0;) {
+    memcpy(&next, buffer.data(), sizeof(next));
+    TreeBuilder::Parse(buffer.data() + sizeof(next), bytes - sizeof(next), 0,
+                       MAXLONGLONG, TreeBuilder::NamedFiles, &batch);
+  }
+
+  builder.Append(&batch);
+  builder.Finish(L"C:\\", &scheduler);
+
+  for (auto record = SyntheticVolume::kFirstRecord;
+       record < volume.record_count(); ++record) {
+    auto entry = builder.Find(static_cast<size_t>(record));
+    entry->size.QuadPart = volume.size(record);
+    entry->allocated.QuadPart = volume.allocated(record);
+  }
+
+  std::vector<std::unique_ptr<FileEntry>> roots;
+  builder.TakeRoots(&roots);
+  AggregateSizes(roots.front().get(), &scheduler);
+
+  return std::move(roots.front());
+}
+
+size_t GetHeapInUse() {
+  auto info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+size_t GetPeakRss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
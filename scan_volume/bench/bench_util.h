@@ -0,0 +1,42 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_BENCH_BENCH_UTIL_H_
+#define SCAN_VOLUME_BENCH_BENCH_UTIL_H_
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "app/volume_scanner.h"
+#include "bench/synthetic_volume.h"
+
+// The volumes every benchmark is run on: a tiny one for the smoke runs of
+// ctest, then 1M, 10M and 50M entries.
+const int64_t kSmokeEntries = 10000;
+
+// Adds the entry counts above as the first argument of |benchmark|, followed
+// by each of the |count| values at |others| if given.
+void EntryCounts(benchmark::internal::Benchmark* benchmark);
+void EntryCounts(benchmark::internal::Benchmark* benchmark,
+                 const int64_t* others, size_t count);
+
+// Returns a volume of |entries| entries made with |options| otherwise. The
+// last one made is kept for the next call, and replaced by this one if it
+// differs, so that only one takes up memory at a time.
+const SyntheticVolume& GetVolume(
+    size_t entries,
+    const SyntheticVolumeOptions& options = SyntheticVolumeOptions());
+
+// Enumerates |volume| into a tree as a scan does, sizes its files from the
+// oracle of the volume and totals its directories.
+std::unique_ptr<FileEntry> BuildTree(const SyntheticVolume& volume);
+
+// The bytes the heap has handed out and not taken back.
+size_t GetHeapInUse();
+
+// The most memory the process has had resident at once.
+size_t GetPeakRss();
+
+#endif  // SCAN_VOLUME_BENCH_BENCH_UTIL_H_
@@ -0,0 +1,205 @@
+// Copyright (c) 2016 dacci.org
+
+// Compares FileIndex with the std::map it replaced, on the IDs enumerated
+// from synthetic volumes. The narrow volumes mix V2 and V3 records of NTFS
+// file reference numbers, which FileIndex addresses directly; the wide ones
+// carry 128-bit IDs, which go to its hash table.
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "app/file_index.h"
+#include "app/usn_record.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+const size_t kBufferSize = 256 * 1024;
+const int64_t kIdWidths[] = {0, 1};
+
+struct Link {
+  FileId id;
+  FileId parent;
+};
+
+// Parses the records of a volume of |entries| entries back out of its
+// enumeration buffers, once for each set of arguments.
+const std::vector<Link>& GetLinks(size_t entries, bool wide,
+                                  DWORDLONG* record_count) {
+  static size_t last_entries;
+  static bool last_wide;
+  static DWORDLONG last_record_count;
+  static std::vector<Link> links;
+
+  if (links.empty() || entries != last_entries || wide != last_wide) {
+    SyntheticVolumeOptions options;
+    options.v3_ratio = 0.5;
+    options.wide_ids = wide;
+    auto& volume = GetVolume(entries, options);
+
+    links.clear();
+    links.reserve(volume.entries());
+
+    std::vector<char> buffer(kBufferSize);
+    std::vector<UsnRecord> records;
+    DWORDLONG next = 0;
+    for (size_t bytes; (bytes = volume.Enumerate(next, buffer.data(),
+                                                 buffer.size())) > 0;) {
+      memcpy(&next, buffer.data(), sizeof(next));
+
+      records.clear();
+      ReadUsnRecords(buffer.data() + sizeof(next), bytes - sizeof(next),
+                     &records);
+      for (auto& record : records)
+        links.push_back(Link{record.id, record.parent});
+    }
+
+    last_entries = entries;
+    last_wide = wide;
+    last_record_count = volume.record_count();
+  }
+
+  *record_count = last_record_count;
+  return links;
+}
+
+void SetLabel(benchmark::State& state) {
+  state.SetLabel(state.range(1) ? "wide" : "narrow");
+}
+
+// Looks up or makes the parent and then the entry of every record, as the
+// scanner did while enumerating before it linked in two passes.
+void BM_FileIndexLink(benchmark::State& state) {
+  DWORDLONG record_count;
+  auto& links = GetLinks(static_cast<size_t>(state.range(0)),
+                         state.range(1) != 0, &record_count);
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    auto heap = GetHeapInUse();
+    FileIndex index;
+    index.Reserve(static_cast<size_t>(record_count));
+
+    for (auto& link : links) {
+      auto parent = index.Acquire(link.parent);
+      auto entry = index.Acquire(link.id);
+      entry->parent = parent;
+    }
+
+    state.PauseTiming();
+    bytes = GetHeapInUse() - heap;
+    index.ForEach([](FileEntry* entry) {
+      delete entry;
+      return true;
+    });
+    state.ResumeTiming();
+  }
+
+  SetLabel(state);
+  state.counters["bytes_per_entry"] =
+      static_cast<double>(bytes) / static_cast<double>(links.size());
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * links.size()));
+}
+
+void BM_MapLink(benchmark::State& state) {
+  DWORDLONG record_count;
+  auto& links = GetLinks(static_cast<size_t>(state.range(0)),
+                         state.range(1) != 0, &record_count);
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    auto heap = GetHeapInUse();
+    std::map<FileId, FileEntry*> index;
+
+    for (auto& link : links) {
+      auto& parent = index[link.parent];
+      if (parent == nullptr)
+        parent = new FileEntry();
+
+      auto& entry = index[link.id];
+      if (entry == nullptr)
+        entry = new FileEntry();
+
+      entry->parent = parent;
+    }
+
+    state.PauseTiming();
+    bytes = GetHeapInUse() - heap;
+    for (auto& pair : index)
+      delete pair.second;
+    index.clear();
+    state.ResumeTiming();
+  }
+
+  SetLabel(state);
+  state.counters["bytes_per_entry"] =
+      static_cast<double>(bytes) / static_cast<double>(links.size());
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * links.size()));
+}
+
+// Looks up the entry of every record in a full index, as replaying the
+// change journal does.
+void BM_FileIndexFind(benchmark::State& state) {
+  DWORDLONG record_count;
+  auto& links = GetLinks(static_cast<size_t>(state.range(0)),
+                         state.range(1) != 0, &record_count);
+
+  FileIndex index;
+  index.Reserve(static_cast<size_t>(record_count));
+  std::vector<std::unique_ptr<FileEntry>> entries;
+  for (auto& link : links) {
+    entries.push_back(std::make_unique<FileEntry>());
+    entries.back()->id = link.id;
+    index.Insert(entries.back().get());
+  }
+
+  for (auto _ : state) {
+    for (auto& link : links)
+      benchmark::DoNotOptimize(index.Find(link.id));
+  }
+
+  SetLabel(state);
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * links.size()));
+}
+
+void BM_MapFind(benchmark::State& state) {
+  DWORDLONG record_count;
+  auto& links = GetLinks(static_cast<size_t>(state.range(0)),
+                         state.range(1) != 0, &record_count);
+
+  std::map<FileId, FileEntry*> index;
+  std::vector<std::unique_ptr<FileEntry>> entries;
+  for (auto& link : links) {
+    entries.push_back(std::make_unique<FileEntry>());
+    index[link.id] = entries.back().get();
+  }
+
+  for (auto _ : state) {
+    for (auto& link : links)
+      benchmark::DoNotOptimize(index.find(link.id));
+  }
+
+  SetLabel(state);
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * links.size()));
+}
+
+void Arguments(benchmark::internal::Benchmark* benchmark) {
+  EntryCounts(benchmark, kIdWidths, sizeof(kIdWidths) / sizeof(*kIdWidths));
+}
+
+BENCHMARK(BM_FileIndexLink)->Apply(Arguments)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MapLink)->Apply(Arguments)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_FileIndexFind)->Apply(Arguments)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MapFind)->Apply(Arguments)->Unit(benchmark::kMillisecond);
+
+}  // namespace
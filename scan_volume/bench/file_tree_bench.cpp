@@ -0,0 +1,89 @@
+// Copyright (c) 2016 dacci.org
+
+// Measures the memory a scan takes up as a FileEntry tree and as a FileTree,
+// and how long each takes to walk in full.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+void BM_FileTreeBuild(benchmark::State& state) {
+  auto& volume = GetVolume(static_cast<size_t>(state.range(0)));
+
+  auto heap = GetHeapInUse();
+  auto root = BuildTree(volume);
+  auto entry_bytes = GetHeapInUse() - heap;
+
+  FileTree tree;
+  for (auto _ : state)
+    tree.Build(root.get());
+
+  auto count = static_cast<double>(tree.size());
+  state.counters["entry_bytes_per_entry"] = entry_bytes / count;
+  state.counters["tree_bytes_per_entry"] = tree.memory_usage() / count;
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_FileTreeBuild)->Apply(EntryCounts)->Unit(benchmark::kMillisecond);
+
+// Totals the files of the tree depth first, following the children of each
+// entry.
+void BM_EntryWalk(benchmark::State& state) {
+  auto root = BuildTree(GetVolume(static_cast<size_t>(state.range(0))));
+  std::vector<const FileEntry*> stack;
+  size_t count = 0;
+
+  for (auto _ : state) {
+    LONGLONG total = 0;
+    count = 0;
+
+    stack.push_back(root.get());
+    while (!stack.empty()) {
+      auto entry = stack.back();
+      stack.pop_back();
+      ++count;
+
+      if (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) {
+        for (auto& child : entry->children)
+          stack.push_back(child.get());
+      } else {
+        total += entry->size.QuadPart;
+      }
+    }
+
+    benchmark::DoNotOptimize(total);
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_EntryWalk)->Apply(EntryCounts)->Unit(benchmark::kMillisecond);
+
+// The same over a FileTree, whose nodes lie in one array.
+void BM_FileTreeWalk(benchmark::State& state) {
+  FileTree tree;
+  tree.Build(BuildTree(GetVolume(static_cast<size_t>(state.range(0)))).get());
+
+  for (auto _ : state) {
+    LONGLONG total = 0;
+    for (DWORD i = 0; i < tree.size(); ++i) {
+      auto& node = tree.node(i);
+      if (!(node.attributes & FILE_ATTRIBUTE_DIRECTORY))
+        total += node.size;
+    }
+
+    benchmark::DoNotOptimize(total);
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * tree.size()));
+}
+BENCHMARK(BM_FileTreeWalk)->Apply(EntryCounts)->Unit(benchmark::kMillisecond);
+
+}  // namespace
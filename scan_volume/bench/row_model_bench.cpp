@@ -0,0 +1,116 @@
+// Copyright (c) 2016 dacci.org
+
+// Measures RowModel over the trees of synthetic volumes: how long expanding
+// every directory takes and what it costs in memory, how fast rows are
+// looked up once everything is shown, as the list view does while scrolling,
+// and how long a saved snapshot takes to show in place.
+
+#include <benchmark/benchmark.h>
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "app/file_tree.h"
+#include "app/row_model.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+// The rows the list view shows at once.
+const size_t kPageRows = 50;
+
+// Expands each row in turn, so that every directory ends up expanded.
+void ExpandAll(RowModel* model) {
+  for (size_t row = 0; row < model->row_count(); ++row)
+    model->Expand(row);
+}
+
+void BM_RowModelExpandAll(benchmark::State& state) {
+  auto root = BuildTree(GetVolume(static_cast<size_t>(state.range(0))));
+  size_t bytes = 0, rows = 0;
+
+  for (auto _ : state) {
+    auto heap = GetHeapInUse();
+    EntryRowTree tree(root.get());
+    RowModel model(&tree);
+    ExpandAll(&model);
+
+    state.PauseTiming();
+    bytes = GetHeapInUse() - heap;
+    rows = model.row_count();
+    state.ResumeTiming();
+  }
+
+  state.counters["bytes_per_row"] =
+      static_cast<double>(bytes) / static_cast<double>(rows);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * rows));
+}
+BENCHMARK(BM_RowModelExpandAll)->Apply(EntryCounts)->Unit(
+    benchmark::kMillisecond);
+
+// Looks up a page of rows from a random place at a time.
+void BM_RowModelGetPage(benchmark::State& state) {
+  auto root = BuildTree(GetVolume(static_cast<size_t>(state.range(0))));
+  EntryRowTree tree(root.get());
+  RowModel model(&tree);
+  ExpandAll(&model);
+
+  std::mt19937_64 random(1);
+  std::uniform_int_distribution<size_t> first(0, model.row_count() - kPageRows);
+  size_t depth = 0;
+
+  for (auto _ : state) {
+    auto row = first(random);
+    for (auto last = row + kPageRows; row < last; ++row)
+      benchmark::DoNotOptimize(model.GetRow(row, &depth));
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * kPageRows));
+}
+BENCHMARK(BM_RowModelGetPage)->Apply(EntryCounts);
+
+// Maps a snapshot and shows the first page of its root, as opening one in the
+// window does. Nothing is read beyond the rows shown.
+void BM_RowModelOpenSnapshot(benchmark::State& state) {
+  auto path = "/tmp/row_model_bench." + std::to_string(getpid());
+  {
+    auto root = BuildTree(GetVolume(static_cast<size_t>(state.range(0))));
+    FileTree tree;
+    tree.Build(root.get());
+    if (FAILED(tree.Save(path.c_str()))) {
+      state.SkipWithError("cannot save the snapshot");
+      return;
+    }
+  }
+
+  std::wstring name;
+  for (auto _ : state) {
+    FileTree tree;
+    if (FAILED(tree.Load(path.c_str()))) {
+      state.SkipWithError("cannot load the snapshot");
+      break;
+    }
+
+    SnapshotRowTree nodes(&tree);
+    RowModel model(&nodes);
+    model.Expand(0);
+    for (size_t row = 0; row < kPageRows && row < model.row_count(); ++row) {
+      name.clear();
+      nodes.AppendName(model.GetRow(row, nullptr), &name);
+      benchmark::DoNotOptimize(name.data());
+    }
+  }
+
+  unlink(path.c_str());
+}
+BENCHMARK(BM_RowModelOpenSnapshot)->Apply(EntryCounts)->Unit(
+    benchmark::kMicrosecond);
+
+}  // namespace
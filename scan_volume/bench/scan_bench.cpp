@@ -0,0 +1,109 @@
+// Copyright (c) 2016 dacci.org
+
+// Runs a scan end to end on synthetic volumes: the enumeration buffers are
+// parsed, linked into a tree, sized from the oracle of the volume, totaled
+// and freed, as NtfsBackend does with a real one.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "app/task_scheduler.h"
+#include "app/tree_builder.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const size_t kBufferSize = 256 * 1024;
+
+double Seconds(Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+void BM_Scan(benchmark::State& state) {
+  SyntheticVolumeOptions options;
+  options.v3_ratio = 0.5;
+  auto& volume = GetVolume(static_cast<size_t>(state.range(0)), options);
+
+  TaskScheduler scheduler(std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<char> buffer(kBufferSize);
+  double parse_seconds = 0.0, build_seconds = 0.0, teardown_seconds = 0.0;
+  double bytes_per_entry = 0.0;
+
+  for (auto _ : state) {
+    auto heap = GetHeapInUse();
+    std::vector<std::unique_ptr<FileEntry>> roots;
+
+    // Only the parsing is timed, not the making up of the buffers.
+    Clock::duration parse{};
+    TreeBuilder::Batch batch;
+    DWORDLONG next = 0;
+    for (size_t bytes; (bytes = volume.Enumerate(next, buffer.data(),
+                                                 buffer.size())) > 0;) {
+      memcpy(&next, buffer.data(), sizeof(next));
+
+      auto start = Clock::now();
+      TreeBuilder::Parse(buffer.data() + sizeof(next), bytes - sizeof(next),
+                         0, MAXLONGLONG, TreeBuilder::NamedFiles, &batch);
+      parse += Clock::now() - start;
+    }
+
+    auto start = Clock::now();
+    {
+      TreeBuilder builder;
+      builder.Reserve(static_cast<size_t>(volume.record_count()));
+      builder.Append(&batch);
+      builder.Finish(L"C:\\", &scheduler);
+
+      for (auto record = SyntheticVolume::kFirstRecord;
+           record < volume.record_count(); ++record) {
+        auto entry = builder.Find(static_cast<size_t>(record));
+        entry->size.QuadPart = volume.size(record);
+        entry->allocated.QuadPart = volume.allocated(record);
+      }
+
+      builder.TakeRoots(&roots);
+    }
+    AggregateSizes(roots.front().get(), &scheduler);
+    auto built = Clock::now();
+
+    if (roots.size() != 1 ||
+        roots.front()->size.QuadPart != volume.total_size()) {
+      state.SkipWithError("the totals are wrong");
+      break;
+    }
+
+    bytes_per_entry = static_cast<double>(GetHeapInUse() - heap) /
+                      static_cast<double>(volume.entries());
+
+    roots.clear();
+    auto freed = Clock::now();
+
+    state.SetIterationTime(Seconds(parse + (freed - start)));
+    parse_seconds += Seconds(parse);
+    build_seconds += Seconds(built - start);
+    teardown_seconds += Seconds(freed - built);
+  }
+
+  auto iterations = static_cast<double>(state.iterations());
+  auto records = static_cast<double>(volume.entries()) * iterations;
+  state.counters["records_per_second"] = records / parse_seconds;
+  state.counters["build_seconds"] = build_seconds / iterations;
+  state.counters["teardown_seconds"] = teardown_seconds / iterations;
+  state.counters["bytes_per_entry"] = bytes_per_entry;
+  state.counters["peak_rss"] = static_cast<double>(GetPeakRss());
+  state.SetItemsProcessed(static_cast<int64_t>(records));
+}
+BENCHMARK(BM_Scan)->Apply(EntryCounts)->UseManualTime()->Unit(
+    benchmark::kMillisecond);
+
+}  // namespace
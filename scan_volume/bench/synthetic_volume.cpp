@@ -0,0 +1,283 @@
+// Copyright (c) 2016 dacci.org
+
+#include "bench/synthetic_volume.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+namespace {
+
+const DWORDLONG kRecordNumberMask = 0x0000FFFFFFFFFFFF;
+const size_t kMaxNameLength = 255;
+const LONGLONG kClusterSize = 4096;
+
+// Files this small live in their MFT records and take no clusters.
+const LONGLONG kResidentSize = 512;
+
+// Sizes are spread evenly over the powers of two up to this one.
+const int kMaxSizeBits = 28;
+
+const char kNameCharacters[] = "abcdefghijklmnopqrstuvwxyz0123456789_-";
+const char* const kExtensions[] = {
+    "txt", "log", "dll", "exe", "jpg", "png", "cpp", "h", "pdf", "zip",
+};
+
+enum Salt {
+  SequenceSalt = 1,
+  VersionSalt,
+  LengthSalt,
+  ExtensionSalt,
+  SizeSalt,
+  HighSalt,
+  NameSalt,
+};
+
+uint64_t Gcd(uint64_t a, uint64_t b) {
+  while (b != 0) {
+    auto remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+
+  return a;
+}
+
+uint64_t Mix(uint64_t value) {
+  value += 0x9E3779B97F4A7C15;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EB;
+  return value ^ (value >> 31);
+}
+
+template <typename T>
+void Put(uint8_t* pointer, T value) {
+  memcpy(pointer, &value, sizeof(value));
+}
+
+size_t NameOffset(int version) {
+  return version == 2 ? 0x3C : 0x4C;
+}
+
+size_t RecordLength(int version, size_t name_length) {
+  return (NameOffset(version) + name_length * 2 + 7) & ~size_t{7};
+}
+
+// Writes a record of RecordLength() bytes at |output|.
+void WriteRecord(int version, const FileId& id, const FileId& parent,
+                 DWORD reason, DWORD attributes, const uint16_t* name,
+                 size_t name_length, uint8_t* output) {
+  auto length = RecordLength(version, name_length);
+  auto name_offset = NameOffset(version);
+  memset(output, 0, length);
+
+  Put<DWORD>(output, static_cast<DWORD>(length));
+  Put<WORD>(output + 0x04, static_cast<WORD>(version));
+
+  if (version == 2) {
+    Put<DWORDLONG>(output + 0x08, id.low());
+    Put<DWORDLONG>(output + 0x10, parent.low());
+    Put<DWORD>(output + 0x28, reason);
+    Put<DWORD>(output + 0x34, attributes);
+  } else {
+    memcpy(output + 0x08, id.data(), id.size());
+    memcpy(output + 0x18, parent.data(), parent.size());
+    Put<DWORD>(output + 0x38, reason);
+    Put<DWORD>(output + 0x44, attributes);
+  }
+
+  Put<WORD>(output + name_offset - 4, static_cast<WORD>(name_length * 2));
+  Put<WORD>(output + name_offset - 2, static_cast<WORD>(name_offset));
+  memcpy(output + name_offset, name, name_length * 2);
+}
+
+}  // namespace
+
+SyntheticVolume::SyntheticVolume(const SyntheticVolumeOptions& options)
+    : options_(options),
+      parents_(options.entries),
+      directories_(options.entries),
+      directory_count_(0),
+      depth_(0),
+      total_size_(0),
+      total_allocated_(0) {
+  auto count = parents_.size();
+  if (count == 0)
+    return;
+
+  std::mt19937_64 random(options_.seed);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  // Entries are made parents first, and placed at records a stride apart,
+  // which scatters them while visiting every record once.
+  auto stride = static_cast<DWORDLONG>(count * 0.6180339887) | 1;
+  while (Gcd(stride, count) != 1)
+    stride += 2;
+  auto offset = random() % count;
+
+  // The directories that may take children, the root first, and the depth
+  // of each entry.
+  std::vector<uint32_t> open(1, kNoParent);
+  std::vector<uint16_t> depths(count);
+  auto max_depth = std::min<size_t>(std::max<size_t>(options_.max_depth, 1),
+                                    UINT16_MAX);
+
+  for (DWORDLONG i = 0; i < count; ++i) {
+    auto index = static_cast<uint32_t>((i * stride + offset) % count);
+
+    // Raising the draw to a power leans toward the directories made first.
+    auto draw = std::pow(uniform(random), 1.0 + options_.fan_out_skew);
+    auto pick = std::min(static_cast<size_t>(draw * open.size()),
+                         open.size() - 1);
+    auto parent = open[pick];
+    size_t depth = (parent == kNoParent ? 0 : depths[parent]) + 1;
+
+    parents_[index] = parent;
+    depths[index] = static_cast<uint16_t>(depth);
+    depth_ = std::max<size_t>(depth_, depth);
+
+    if (uniform(random) < options_.directory_ratio) {
+      directories_[index] = true;
+      ++directory_count_;
+      if (depth < max_depth)
+        open.push_back(index);
+    } else {
+      total_size_ += size(kFirstRecord + index);
+      total_allocated_ += allocated(kFirstRecord + index);
+    }
+  }
+}
+
+size_t SyntheticVolume::Enumerate(DWORDLONG start, void* buffer,
+                                  size_t size) const {
+  auto output = static_cast<uint8_t*>(buffer);
+  auto record = std::max(start & kRecordNumberMask, kFirstRecord);
+  size_t offset = sizeof(DWORDLONG);
+  if (size < offset || record >= record_count())
+    return 0;
+
+  uint16_t name[kMaxNameLength];
+  for (; record < record_count(); ++record) {
+    auto version = options_.wide_ids ||
+                           Hash(record, VersionSalt) % 1024 <
+                               options_.v3_ratio * 1024
+                       ? 3
+                       : 2;
+
+    auto text = this->name(record);
+    for (size_t i = 0; i < text.size(); ++i)
+      name[i] = static_cast<uint16_t>(text[i]);
+
+    auto length = RecordLength(version, text.size());
+    if (offset + length > size)
+      break;
+
+    WriteRecord(version, id(record), id(parent(record)), 0,
+                directory(record) ? FILE_ATTRIBUTE_DIRECTORY
+                                  : FILE_ATTRIBUTE_ARCHIVE,
+                name, text.size(), output + offset);
+    offset += length;
+  }
+
+  if (offset == sizeof(DWORDLONG))
+    return 0;
+
+  Put<DWORDLONG>(output, record);
+  return offset;
+}
+
+FileId SyntheticVolume::id(DWORDLONG record) const {
+  // The root keeps the sequence number it has on every real volume.
+  auto sequence = record == kRootRecord
+                      ? kRootRecord
+                      : Hash(record, SequenceSalt) % 0xFFFF + 1;
+
+  FileId id(record | sequence << 48);
+  if (options_.wide_ids) {
+    auto high = Hash(record, HighSalt) | 1;
+    memcpy(id.data() + sizeof(high), &high, sizeof(high));
+  }
+
+  return id;
+}
+
+std::wstring SyntheticVolume::name(DWORDLONG record) const {
+  size_t length = options_.min_name_length;
+  if (options_.max_name_length > length) {
+    auto range = options_.max_name_length - length + 1;
+    length += Hash(record, LengthSalt) % range;
+  }
+  length = std::min<size_t>(std::max<size_t>(length, 1), kMaxNameLength);
+
+  std::string extension;
+  if (!directory(record)) {
+    extension = kExtensions[Hash(record, ExtensionSalt) %
+                            (sizeof(kExtensions) / sizeof(*kExtensions))];
+    if (length < extension.size() + 2)
+      extension.clear();
+  }
+
+  auto base = length - (extension.empty() ? 0 : extension.size() + 1);
+  std::wstring name;
+  name.reserve(length);
+
+  uint64_t bits = 0;
+  for (size_t i = 0; i < base; ++i) {
+    // Each hash gives ten characters.
+    if (i % 10 == 0)
+      bits = Hash(record, NameSalt + i);
+
+    name.push_back(kNameCharacters[bits % (sizeof(kNameCharacters) - 1)]);
+    bits /= sizeof(kNameCharacters) - 1;
+  }
+
+  if (!extension.empty()) {
+    name.push_back(L'.');
+    name.append(extension.begin(), extension.end());
+  }
+
+  return name;
+}
+
+LONGLONG SyntheticVolume::size(DWORDLONG record) const {
+  if (directory(record))
+    return 0;
+
+  auto hash = Hash(record, SizeSalt);
+  auto bits = hash % (kMaxSizeBits + 1);
+  return static_cast<LONGLONG>((hash >> 8) & ((1ULL << bits) - 1));
+}
+
+LONGLONG SyntheticVolume::allocated(DWORDLONG record) const {
+  auto bytes = size(record);
+  if (bytes <= kResidentSize)
+    return 0;
+
+  return (bytes + kClusterSize - 1) / kClusterSize * kClusterSize;
+}
+
+uint64_t SyntheticVolume::Hash(DWORDLONG record, uint64_t salt) const {
+  return Mix(Mix(record ^ static_cast<uint64_t>(options_.seed) << 48) + salt);
+}
+
+void AppendUsnRecord(int version, const FileId& id, const FileId& parent,
+                     DWORD reason, DWORD attributes, const std::wstring& name,
+                     std::vector<BYTE>* buffer) {
+  std::vector<uint16_t> units;
+  for (auto character : name) {
+    auto code = static_cast<uint32_t>(character);
+    if (code >= 0x10000) {
+      code -= 0x10000;
+      units.push_back(static_cast<uint16_t>(0xD800 + (code >> 10)));
+      code = 0xDC00 + (code & 0x3FF);
+    }
+
+    units.push_back(static_cast<uint16_t>(code));
+  }
+
+  auto offset = buffer->size();
+  buffer->resize(offset + RecordLength(version, units.size()));
+  WriteRecord(version, id, parent, reason, attributes, units.data(),
+              units.size(), buffer->data() + offset);
+}
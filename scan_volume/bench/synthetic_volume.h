@@ -0,0 +1,146 @@
+// Copyright (c) 2016 dacci.org
+
+#ifndef SCAN_VOLUME_BENCH_SYNTHETIC_VOLUME_H_
+#define SCAN_VOLUME_BENCH_SYNTHETIC_VOLUME_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "app/file_id.h"
+#include "app/port.h"
+
+struct SyntheticVolumeOptions {
+  SyntheticVolumeOptions()
+      : entries(1000000),
+        max_depth(24),
+        directory_ratio(0.1),
+        fan_out_skew(1.0),
+        min_name_length(4),
+        max_name_length(24),
+        v3_ratio(0.0),
+        wide_ids(false),
+        seed(1) {}
+
+  // The files and directories under the root.
+  size_t entries;
+  size_t max_depth;
+  double directory_ratio;
+
+  // How unevenly entries spread over directories. Zero spreads them evenly,
+  // positive values pile them up on fewer directories nearer the root, and
+  // negative ones, down to -1, on the directories made last, which makes for
+  // deep and narrow trees.
+  double fan_out_skew;
+
+  size_t min_name_length;
+  size_t max_name_length;
+
+  // The share of records enumerated as USN_RECORD_V3 rather than V2.
+  double v3_ratio;
+
+  // Gives every entry a 128-bit ID, as ReFS does, and enumerates every
+  // record as V3.
+  bool wide_ids;
+
+  uint32_t seed;
+};
+
+// Makes up the MFT of an NTFS volume, so that enumeration and everything
+// after it can be measured without one. Only the parent of each entry is
+// kept; names, IDs, versions and sizes are derived from a hash of its record
+// number whenever asked for, so that tens of millions of entries fit in
+// memory. Entries are spread over the records at random, so that parents
+// often come after their children, as on real volumes.
+class SyntheticVolume {
+ public:
+  static const DWORDLONG kRootRecord = 5;
+  static const DWORDLONG kFirstRecord = 24;
+
+  explicit SyntheticVolume(const SyntheticVolumeOptions& options);
+
+  // Fills the |size| bytes at |buffer| as FSCTL_ENUM_USN_DATA does: with the
+  // file reference number to go on from, followed by as many records from
+  // MFT record |start| on as fit. Returns the bytes filled, or zero past the
+  // last record. Safe to call from several threads at once.
+  size_t Enumerate(DWORDLONG start, void* buffer, size_t size) const;
+
+  // Returns the ID of the entry at MFT record |record|.
+  FileId id(DWORDLONG record) const;
+
+  // Returns the MFT record of the parent of the entry at |record|.
+  DWORDLONG parent(DWORDLONG record) const {
+    auto index = parents_[record - kFirstRecord];
+    return index == kNoParent ? kRootRecord : kFirstRecord + index;
+  }
+
+  bool directory(DWORDLONG record) const {
+    return directories_[record - kFirstRecord];
+  }
+
+  std::wstring name(DWORDLONG record) const;
+
+  // The sizes the entry at |record| takes up, as read from the $MFT. Zero
+  // for directories.
+  LONGLONG size(DWORDLONG record) const;
+  LONGLONG allocated(DWORDLONG record) const;
+
+  FileId root_id() const {
+    return id(kRootRecord);
+  }
+
+  // One past the highest MFT record in use.
+  DWORDLONG record_count() const {
+    return kFirstRecord + parents_.size();
+  }
+
+  size_t entries() const {
+    return parents_.size();
+  }
+
+  size_t directories() const {
+    return directory_count_;
+  }
+
+  size_t depth() const {
+    return depth_;
+  }
+
+  // The sum of size() and allocated() over every entry.
+  LONGLONG total_size() const {
+    return total_size_;
+  }
+
+  LONGLONG total_allocated() const {
+    return total_allocated_;
+  }
+
+ private:
+  static const uint32_t kNoParent = UINT32_MAX;
+
+  uint64_t Hash(DWORDLONG record, uint64_t salt) const;
+
+  const SyntheticVolumeOptions options_;
+
+  // By record, starting from kFirstRecord.
+  std::vector<uint32_t> parents_;
+  std::vector<bool> directories_;
+
+  size_t directory_count_;
+  size_t depth_;
+  LONGLONG total_size_;
+  LONGLONG total_allocated_;
+
+  SyntheticVolume(const SyntheticVolume&) = delete;
+  SyntheticVolume& operator=(const SyntheticVolume&) = delete;
+};
+
+// Appends a USN_RECORD_V2 or V3 to |buffer|, padded to 8 bytes as the
+// records of FSCTL_ENUM_USN_DATA and FSCTL_READ_USN_JOURNAL are. V2 records
+// take the low half of the IDs alone.
+void AppendUsnRecord(int version, const FileId& id, const FileId& parent,
+                     DWORD reason, DWORD attributes, const std::wstring& name,
+                     std::vector<BYTE>* buffer);
+
+#endif  // SCAN_VOLUME_BENCH_SYNTHETIC_VOLUME_H_
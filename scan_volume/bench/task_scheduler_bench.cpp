@@ -0,0 +1,90 @@
+// Copyright (c) 2016 dacci.org
+
+// Sizes the files of synthetic volumes through TaskScheduler a directory a
+// task, as NtfsBackend does, by the number of threads, and reports how
+// often workers stole and how long they sat idle.
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+const int64_t kThreadCounts[] = {1, 2, 4, 8};
+const DWORDLONG kRecordNumberMask = 0x0000FFFFFFFFFFFF;
+
+void SizeDirectory(TaskScheduler* scheduler, const SyntheticVolume* volume,
+                   FileEntry* directory) {
+  for (auto& child : directory->children) {
+    auto entry = child.get();
+    if (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) {
+      scheduler->Post([scheduler, volume, entry]() {
+        SizeDirectory(scheduler, volume, entry);
+      });
+    } else {
+      auto record = entry->id.low() & kRecordNumberMask;
+      entry->size.QuadPart = volume->size(record);
+      entry->allocated.QuadPart = volume->allocated(record);
+    }
+  }
+}
+
+void Size(benchmark::State& state, const SyntheticVolumeOptions& options) {
+  auto& volume = GetVolume(static_cast<size_t>(state.range(0)), options);
+  auto root = BuildTree(volume);
+  auto threads = static_cast<size_t>(state.range(1));
+  TaskScheduler scheduler(threads);
+
+  auto before = scheduler.GetMetrics();
+  auto start = std::chrono::steady_clock::now();
+
+  for (auto _ : state) {
+    scheduler.Post([&scheduler, &volume, &root]() {
+      SizeDirectory(&scheduler, &volume, root.get());
+    });
+    scheduler.Wait();
+  }
+
+  auto elapsed = std::chrono::duration<double, std::micro>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  auto after = scheduler.GetMetrics();
+  auto executed = static_cast<double>(after.executed - before.executed);
+
+  state.counters["tasks"] = executed / state.iterations();
+  state.counters["steals_per_task"] = (after.steals - before.steals) / executed;
+  state.counters["idle_share"] =
+      (after.idle_microseconds - before.idle_microseconds) /
+      (elapsed * scheduler.concurrency());
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * volume.entries()));
+}
+
+void BM_SizeBushy(benchmark::State& state) {
+  Size(state, SyntheticVolumeOptions());
+}
+
+// A few long chains of directories, which leave little to steal.
+void BM_SizeDeep(benchmark::State& state) {
+  SyntheticVolumeOptions options;
+  options.max_depth = 4096;
+  options.fan_out_skew = -0.9;
+  Size(state, options);
+}
+
+void Arguments(benchmark::internal::Benchmark* benchmark) {
+  EntryCounts(benchmark, kThreadCounts,
+              sizeof(kThreadCounts) / sizeof(*kThreadCounts));
+}
+
+BENCHMARK(BM_SizeBushy)->Apply(Arguments)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK(BM_SizeDeep)->Apply(Arguments)->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
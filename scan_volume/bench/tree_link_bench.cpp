@@ -0,0 +1,152 @@
+// Copyright (c) 2016 dacci.org
+
+// Compares the two-pass linking of TreeBuilder, which groups the records by
+// parent before making any entry, with linking each record as it comes, as
+// the scanner did before. Both start from the same parsed records, and
+// neither the parsing nor the freeing of the tree is timed.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "app/file_index.h"
+#include "app/task_scheduler.h"
+#include "app/tree_builder.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+const size_t kBufferSize = 256 * 1024;
+const int64_t kLargeEntries = 20000000;
+
+// Parses the records of a volume of |entries| entries, once for each size.
+const TreeBuilder::Batch& GetBatch(size_t entries, DWORDLONG* record_count) {
+  static size_t last_entries;
+  static DWORDLONG last_record_count;
+  static TreeBuilder::Batch batch;
+
+  if (batch.records.empty() || entries != last_entries) {
+    SyntheticVolumeOptions options;
+    options.v3_ratio = 0.5;
+    auto& volume = GetVolume(entries, options);
+
+    batch = TreeBuilder::Batch();
+    std::vector<char> buffer(kBufferSize);
+    DWORDLONG next = 0;
+    for (size_t bytes; (bytes = volume.Enumerate(next, buffer.data(),
+                                                 buffer.size())) > 0;) {
+      memcpy(&next, buffer.data(), sizeof(next));
+      TreeBuilder::Parse(buffer.data() + sizeof(next), bytes - sizeof(next),
+                         0, MAXLONGLONG, TreeBuilder::NamedFiles, &batch);
+    }
+
+    last_entries = entries;
+    last_record_count = volume.record_count();
+  }
+
+  *record_count = last_record_count;
+  return batch;
+}
+
+void SetCounters(benchmark::State& state, size_t records, size_t bytes) {
+  state.counters["bytes_per_entry"] =
+      static_cast<double>(bytes) / static_cast<double>(records);
+  state.counters["peak_rss"] = static_cast<double>(GetPeakRss());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * records));
+}
+
+void BM_TwoPassLink(benchmark::State& state) {
+  DWORDLONG record_count;
+  auto& parsed = GetBatch(static_cast<size_t>(state.range(0)), &record_count);
+
+  TaskScheduler scheduler(std::max(1u, std::thread::hardware_concurrency()));
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto heap = GetHeapInUse();
+    auto batch = parsed;
+    std::vector<std::unique_ptr<FileEntry>> roots;
+    state.ResumeTiming();
+
+    {
+      TreeBuilder builder;
+      builder.Reserve(static_cast<size_t>(record_count));
+      builder.Append(&batch);
+      builder.Finish(L"C:\\", &scheduler);
+      builder.TakeRoots(&roots);
+    }
+
+    state.PauseTiming();
+    bytes = GetHeapInUse() - heap;
+    roots.clear();
+    state.ResumeTiming();
+  }
+
+  SetCounters(state, parsed.records.size(), bytes);
+}
+
+// Makes the parent and then the entry of every record in turn, and appends
+// the entry to the children of its parent one at a time.
+void BM_IncrementalLink(benchmark::State& state) {
+  DWORDLONG record_count;
+  auto& parsed = GetBatch(static_cast<size_t>(state.range(0)), &record_count);
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto heap = GetHeapInUse();
+    std::vector<std::unique_ptr<FileEntry>> roots;
+    state.ResumeTiming();
+
+    {
+      FileIndex entries;
+      entries.Reserve(static_cast<size_t>(record_count));
+
+      for (auto& record : parsed.records) {
+        auto parent = entries.Acquire(record.parent);
+        auto entry = entries.Acquire(record.id);
+
+        entry->parent = parent;
+        entry->attributes = record.attributes;
+        entry->name.assign(parsed.names.data() + record.name_offset,
+                           record.name_length);
+
+        parent->children.push_back(std::unique_ptr<FileEntry>(entry));
+      }
+
+      entries.ForEach([&roots](FileEntry* entry) {
+        if (entry->parent == nullptr) {
+          roots.push_back(std::unique_ptr<FileEntry>(entry));
+          roots.back()->attributes = FILE_ATTRIBUTE_DIRECTORY;
+          roots.back()->name = L"C:\\";
+        }
+        return true;
+      });
+    }
+
+    state.PauseTiming();
+    bytes = GetHeapInUse() - heap;
+    roots.clear();
+    state.ResumeTiming();
+  }
+
+  SetCounters(state, parsed.records.size(), bytes);
+}
+
+void Arguments(benchmark::internal::Benchmark* benchmark) {
+  benchmark->Arg(kSmokeEntries)->Arg(1000000)->Arg(10000000)->Arg(
+      kLargeEntries);
+}
+
+BENCHMARK(BM_TwoPassLink)->Apply(Arguments)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_IncrementalLink)->Apply(Arguments)->Unit(
+    benchmark::kMillisecond);
+
+}  // namespace
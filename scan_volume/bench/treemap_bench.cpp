@@ -0,0 +1,83 @@
+// Copyright (c) 2016 dacci.org
+
+// Measures TreemapLayout over the trees of synthetic volumes with no window
+// to draw in: indexing a scan, laying it out at the size of a full HD screen
+// with the smallest cell worth showing taken from the second argument, and
+// finding the cell under a point.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <random>
+
+#include "app/treemap_layout.h"
+#include "app/volume_scanner.h"
+#include "bench/bench_util.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+const float kWidth = 1920.0f;
+const float kHeight = 1080.0f;
+const unsigned kMaxDepth = 64;
+
+const int64_t kMinSizes[] = {1, 4, 16};
+
+void BM_TreemapIndex(benchmark::State& state) {
+  auto& volume = GetVolume(static_cast<size_t>(state.range(0)));
+  auto root = BuildTree(volume);
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    auto heap = GetHeapInUse();
+    TreemapLayout layout(root.get());
+
+    state.PauseTiming();
+    bytes = GetHeapInUse() - heap;
+    state.ResumeTiming();
+  }
+
+  state.counters["bytes_per_entry"] =
+      static_cast<double>(bytes) / static_cast<double>(volume.entries());
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * volume.entries()));
+}
+BENCHMARK(BM_TreemapIndex)->Apply(EntryCounts)->Unit(benchmark::kMillisecond);
+
+void BM_TreemapLayout(benchmark::State& state) {
+  auto root = BuildTree(GetVolume(static_cast<size_t>(state.range(0))));
+  TreemapLayout layout(root.get());
+  auto min_size = static_cast<float>(state.range(1));
+
+  for (auto _ : state)
+    layout.Layout(root.get(), kWidth, kHeight, min_size, kMaxDepth);
+
+  state.counters["cells"] = static_cast<double>(layout.cells().size());
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * layout.cells().size()));
+}
+
+void BM_TreemapHitTest(benchmark::State& state) {
+  auto root = BuildTree(GetVolume(static_cast<size_t>(state.range(0))));
+  TreemapLayout layout(root.get());
+  layout.Layout(root.get(), kWidth, kHeight,
+                static_cast<float>(state.range(1)), kMaxDepth);
+
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> x(0.0f, kWidth), y(0.0f, kHeight);
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(layout.HitTest(x(random), y(random)));
+
+  state.counters["cells"] = static_cast<double>(layout.cells().size());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+void Arguments(benchmark::internal::Benchmark* benchmark) {
+  EntryCounts(benchmark, kMinSizes, sizeof(kMinSizes) / sizeof(*kMinSizes));
+}
+
+BENCHMARK(BM_TreemapLayout)->Apply(Arguments)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_TreemapHitTest)->Apply(Arguments);
+
+}  // namespace
@@ -8,14 +8,16 @@
 #define IDC_DRIVE_COMBO                 1001
 #define IDC_MESSAGE                     1001
 #define IDC_PROGRESS                    1002
+#define IDC_RATE                        1003
+#define ID_FILE_OPEN_SNAPSHOT           40001
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        104
-#define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1003
+#define _APS_NEXT_COMMAND_VALUE         40002
+#define _APS_NEXT_CONTROL_VALUE         1004
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
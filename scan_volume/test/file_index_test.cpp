@@ -0,0 +1,90 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include "app/file_index.h"
+#include "app/volume_scanner.h"
+
+namespace {
+
+FileId Frn(DWORDLONG record, WORD sequence) {
+  return FileId(static_cast<DWORDLONG>(sequence) << 48 | record);
+}
+
+class FileIndexTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    index_.Reserve(64);
+  }
+
+  void TearDown() override {
+    index_.ForEach([](FileEntry* entry) {
+      delete entry;
+      return true;
+    });
+  }
+
+  FileIndex index_;
+};
+
+TEST_F(FileIndexTest, KeepsReusedRecordsApart) {
+  auto old_entry = index_.Acquire(Frn(17, 1));
+  auto new_entry = index_.Acquire(Frn(17, 2));
+
+  ASSERT_NE(old_entry, new_entry);
+  EXPECT_EQ(Frn(17, 1), old_entry->id);
+  EXPECT_EQ(Frn(17, 2), new_entry->id);
+  EXPECT_EQ(2u, index_.size());
+
+  EXPECT_EQ(old_entry, index_.Acquire(Frn(17, 1)));
+  EXPECT_EQ(new_entry, index_.Acquire(Frn(17, 2)));
+  EXPECT_EQ(old_entry, index_.Find(Frn(17, 1)));
+  EXPECT_EQ(new_entry, index_.Find(Frn(17, 2)));
+  EXPECT_EQ(nullptr, index_.Find(Frn(17, 3)));
+  EXPECT_EQ(old_entry, index_.Find(static_cast<size_t>(17)));
+}
+
+TEST_F(FileIndexTest, InsertReplacesOnlyTheSameId) {
+  auto old_entry = index_.Acquire(Frn(17, 1));
+
+  auto new_entry = new FileEntry();
+  new_entry->id = Frn(17, 2);
+  index_.Insert(new_entry);
+  EXPECT_EQ(old_entry, index_.Find(Frn(17, 1)));
+  EXPECT_EQ(new_entry, index_.Find(Frn(17, 2)));
+
+  std::unique_ptr<FileEntry> replaced(new FileEntry());
+  replaced->id = Frn(17, 2);
+  index_.Insert(replaced.get());
+  EXPECT_EQ(replaced.get(), index_.Find(Frn(17, 2)));
+  EXPECT_EQ(2u, index_.size());
+
+  // The index doesn't own what it was given.
+  index_.Remove(Frn(17, 2));
+  delete new_entry;
+}
+
+TEST_F(FileIndexTest, RemovesEitherHolderOfARecord) {
+  auto old_entry = index_.Acquire(Frn(17, 1));
+  auto new_entry = index_.Acquire(Frn(17, 2));
+
+  index_.Remove(Frn(17, 1));
+  EXPECT_EQ(nullptr, index_.Find(Frn(17, 1)));
+  EXPECT_EQ(new_entry, index_.Find(Frn(17, 2)));
+  EXPECT_EQ(1u, index_.size());
+  delete old_entry;
+
+  // The hashed entry is still found once the record is free again, rather
+  // than made anew in it.
+  EXPECT_EQ(new_entry, index_.Acquire(Frn(17, 2)));
+  EXPECT_EQ(1u, index_.size());
+
+  index_.Remove(Frn(17, 2));
+  EXPECT_TRUE(index_.empty());
+  delete new_entry;
+}
+
+}  // namespace
@@ -0,0 +1,214 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/volume_scanner.h"
+
+namespace {
+
+// Where the header of a snapshot keeps the size of a unit of its names, and
+// the offset of its nodes.
+const size_t kNameUnitField = 20;
+const size_t kNodeOffsetField = 32;
+
+FileEntry* AddChild(FileEntry* parent, const std::wstring& name,
+                    DWORD attributes, LONGLONG size) {
+  parent->children.push_back(std::make_unique<FileEntry>());
+  auto child = parent->children.back().get();
+  child->parent = parent;
+  child->id = FileId(static_cast<DWORDLONG>(parent->children.size() + 100));
+  child->name = name;
+  child->attributes = attributes;
+  child->size.QuadPart = size;
+  child->allocated.QuadPart = size + 4096;
+  return child;
+}
+
+std::vector<char> ReadFile(const std::string& path) {
+  std::vector<char> bytes;
+  auto file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return bytes;
+
+  char buffer[4096];
+  for (size_t read; (read = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+    bytes.insert(bytes.end(), buffer, buffer + read);
+  fclose(file);
+
+  return bytes;
+}
+
+void WriteFile(const std::string& path, const std::vector<char>& bytes) {
+  auto file = fopen(path.c_str(), "wb");
+  ASSERT_NE(nullptr, file);
+  fwrite(bytes.data(), 1, bytes.size(), file);
+  fclose(file);
+}
+
+class FileTreeTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    root_.name = L"C:\\";
+    root_.attributes = FILE_ATTRIBUTE_DIRECTORY;
+    root_.size.QuadPart = 300;
+    auto docs = AddChild(&root_, L"docs", FILE_ATTRIBUTE_DIRECTORY, 200);
+    AddChild(&root_, L"boot.ini", 0, 100);
+    AddChild(docs, L"a.txt", 0, 200);
+
+    tree_.Build(&root_);
+    path_ = testing::TempDir() + "file_tree_test.snapshot";
+  }
+
+  void TearDown() override {
+    unlink(path_.c_str());
+    rmdir((path_ + ".tmp").c_str());
+  }
+
+  // Writes |value| over the field |offset| bytes into node |index| of the
+  // snapshot at |path_|.
+  void Patch(DWORD index, size_t offset, DWORD value) {
+    auto bytes = ReadFile(path_);
+    DWORDLONG node_offset;
+    memcpy(&node_offset, bytes.data() + kNodeOffsetField, sizeof(node_offset));
+    memcpy(bytes.data() + node_offset + index * sizeof(FileTree::Node) +
+               offset,
+           &value, sizeof(value));
+    WriteFile(path_, bytes);
+  }
+
+  FileEntry root_;
+  FileTree tree_;
+  std::string path_;
+};
+
+TEST_F(FileTreeTest, RoundTripsThroughASnapshot) {
+  ASSERT_EQ(S_OK, tree_.Save(path_.c_str()));
+  EXPECT_EQ(0, access(path_.c_str(), F_OK));
+  EXPECT_NE(0, access((path_ + ".tmp").c_str(), F_OK));
+
+  FileTree loaded;
+  ASSERT_EQ(S_OK, loaded.Load(path_.c_str()));
+  ASSERT_EQ(tree_.size(), loaded.size());
+
+  for (DWORD i = 0; i < loaded.size(); ++i) {
+    auto& expected = tree_.node(i);
+    auto& actual = loaded.node(i);
+    EXPECT_EQ(expected.parent, actual.parent);
+    EXPECT_EQ(expected.first_child, actual.first_child);
+    EXPECT_EQ(expected.child_count, actual.child_count);
+    EXPECT_EQ(expected.size, actual.size);
+    EXPECT_EQ(expected.allocated, actual.allocated);
+    EXPECT_EQ(expected.id, actual.id);
+    EXPECT_EQ(tree_.name(expected), loaded.name(actual));
+  }
+}
+
+TEST_F(FileTreeTest, KeepsNamesInUtf16) {
+  // U+1F4C1, beyond the BMP, takes two units whatever the size of wchar_t.
+  std::wstring name = L"x";
+  name.append(sizeof(wchar_t) == 2 ? L"\xD83D\xDCC1" : L"\U0001F4C1");
+  AddChild(&root_, name, 0, 1);
+  tree_.Build(&root_);
+  ASSERT_EQ(S_OK, tree_.Save(path_.c_str()));
+
+  auto bytes = ReadFile(path_);
+  DWORD name_unit;
+  memcpy(&name_unit, bytes.data() + kNameUnitField, sizeof(name_unit));
+  EXPECT_EQ(2u, name_unit);
+
+  FileTree loaded;
+  ASSERT_EQ(S_OK, loaded.Load(path_.c_str()));
+  auto& node = loaded.node(3);
+  EXPECT_EQ(3u, node.name_length);
+  EXPECT_EQ(name, loaded.name(node));
+  EXPECT_EQ(name, loaded.Restore()->children[2]->name);
+}
+
+TEST_F(FileTreeTest, ReadsDamagedNodesAsInvalid) {
+  ASSERT_EQ(S_OK, tree_.Save(path_.c_str()));
+
+  // Node 1 is made its own parent, and node 2 given children past the end.
+  Patch(1, offsetof(FileTree::Node, parent), 1);
+  Patch(2, offsetof(FileTree::Node, child_count), 100);
+
+  FileTree loaded;
+  ASSERT_EQ(S_OK, loaded.Load(path_.c_str()));
+  ASSERT_EQ(4u, loaded.size());
+
+  EXPECT_EQ(L"C:\\", loaded.name(loaded.node(0)));
+  const DWORD none = FileTree::kNone;
+  for (DWORD i : {1u, 2u, 4u}) {
+    auto& node = loaded.node(i);
+    EXPECT_EQ(none, node.parent) << i;
+    EXPECT_EQ(0u, node.child_count) << i;
+    EXPECT_EQ(L"", loaded.name(node)) << i;
+  }
+
+  EXPECT_EQ(L"a.txt", loaded.name(loaded.node(3)));
+
+  // Neither child of the root points back at it any more.
+  auto restored = loaded.Restore();
+  ASSERT_NE(nullptr, restored);
+  EXPECT_TRUE(restored->children.empty());
+}
+
+TEST_F(FileTreeTest, RestoresTheEntryTree) {
+  ASSERT_EQ(S_OK, tree_.Save(path_.c_str()));
+
+  FileTree loaded;
+  ASSERT_EQ(S_OK, loaded.Load(path_.c_str()));
+  auto root = loaded.Restore();
+  ASSERT_NE(nullptr, root);
+
+  EXPECT_EQ(L"C:\\", root->name);
+  EXPECT_EQ(300, root->size.QuadPart);
+  ASSERT_EQ(2u, root->children.size());
+
+  auto docs = root->children[0].get();
+  EXPECT_EQ(root.get(), docs->parent);
+  EXPECT_EQ(L"docs", docs->name);
+  EXPECT_EQ(root_.children[0]->id, docs->id);
+  EXPECT_NE(0u, docs->attributes & FILE_ATTRIBUTE_DIRECTORY);
+  EXPECT_EQ(L"boot.ini", root->children[1]->name);
+
+  ASSERT_EQ(1u, docs->children.size());
+  EXPECT_EQ(L"a.txt", docs->children[0]->name);
+  EXPECT_EQ(200, docs->children[0]->size.QuadPart);
+  EXPECT_EQ(4296, docs->children[0]->allocated.QuadPart);
+  EXPECT_EQ(docs, docs->children[0]->parent);
+}
+
+TEST_F(FileTreeTest, RejectsTruncatedSnapshots) {
+  ASSERT_EQ(S_OK, tree_.Save(path_.c_str()));
+  auto bytes = ReadFile(path_);
+  bytes.resize(bytes.size() / 2);
+  WriteFile(path_, bytes);
+
+  FileTree loaded;
+  EXPECT_TRUE(FAILED(loaded.Load(path_.c_str())));
+  EXPECT_TRUE(loaded.empty());
+}
+
+TEST_F(FileTreeTest, KeepsTheLastSnapshotWhenSavingFails) {
+  ASSERT_EQ(S_OK, tree_.Save(path_.c_str()));
+  auto saved = ReadFile(path_);
+
+  // The file written first can't be made, so nothing is moved over.
+  ASSERT_EQ(0, mkdir((path_ + ".tmp").c_str(), 0755));
+  FileTree empty;
+  EXPECT_TRUE(FAILED(empty.Save(path_.c_str())));
+  EXPECT_EQ(saved, ReadFile(path_));
+}
+
+}  // namespace
@@ -0,0 +1,220 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/journal_replayer.h"
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+#include "bench/synthetic_volume.h"
+
+namespace {
+
+const DWORD kDataExtend = 0x00000002;
+const DWORD kFileCreate = 0x00000100;
+const DWORD kFileDelete = 0x00000200;
+const DWORD kRenameOldName = 0x00001000;
+const DWORD kRenameNewName = 0x00002000;
+const DWORD kClose = 0x80000000;
+
+FileId Frn(DWORDLONG record, WORD sequence) {
+  return FileId(static_cast<DWORDLONG>(sequence) << 48 | record);
+}
+
+// Writes out the names and sizes of a tree, children in order.
+std::wstring Dump(const FileEntry* entry) {
+  auto text = entry->name + L':' + std::to_wstring(entry->size.QuadPart) +
+              L'/' + std::to_wstring(entry->allocated.QuadPart);
+  if (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) {
+    text += L'(';
+    for (auto& child : entry->children)
+      text += Dump(child.get()) + L' ';
+    text += L')';
+  }
+
+  return text;
+}
+
+// The tree the journals below are replayed onto:
+//
+//   C:\        record 5
+//     a\       16
+//       f      17, 100 bytes
+//     b\       18
+//       g      19, 50 bytes
+//
+// Its records are dense enough to be addressed directly.
+class JournalReplayerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    roots_.push_back(std::make_unique<FileEntry>());
+    auto root = roots_.back().get();
+    root->id = Frn(5, 5);
+    root->name = L"C:\\";
+    root->attributes = FILE_ATTRIBUTE_DIRECTORY;
+
+    a_ = Add(root, Frn(16, 1), L"a", FILE_ATTRIBUTE_DIRECTORY, 0);
+    f_ = Add(a_, Frn(17, 1), L"f", 0, 100);
+    b_ = Add(root, Frn(18, 2), L"b", FILE_ATTRIBUTE_DIRECTORY, 0);
+    g_ = Add(b_, Frn(19, 1), L"g", 0, 50);
+
+    TaskScheduler scheduler(1);
+    AggregateSizes(root, &scheduler);
+    scanned_ = Dump(root);
+  }
+
+  FileEntry* Add(FileEntry* parent, const FileId& id, const wchar_t* name,
+                 DWORD attributes, LONGLONG size) {
+    parent->children.push_back(std::make_unique<FileEntry>());
+    auto entry = parent->children.back().get();
+    entry->parent = parent;
+    entry->id = id;
+    entry->name = name;
+    entry->attributes = attributes;
+    entry->size.QuadPart = size;
+    entry->allocated.QuadPart = size;
+    return entry;
+  }
+
+  void Append(const FileId& id, const FileId& parent, DWORD reason,
+              DWORD attributes, const wchar_t* name, int version = 2) {
+    AppendUsnRecord(version, id, parent, reason, attributes, name, &journal_);
+  }
+
+  HRESULT Replay(JournalReplayer* replayer) {
+    return replayer->Apply(journal_.data(), journal_.size());
+  }
+
+  FileEntry* root() const {
+    return roots_.front().get();
+  }
+
+  std::vector<std::unique_ptr<FileEntry>> roots_;
+  FileEntry* a_;
+  FileEntry* f_;
+  FileEntry* b_;
+  FileEntry* g_;
+  std::wstring scanned_;
+  std::vector<BYTE> journal_;
+};
+
+TEST_F(JournalReplayerTest, CreatesAndSizesFiles) {
+  Append(Frn(40, 1), b_->id, kFileCreate, 0, L"h");
+  Append(Frn(40, 1), b_->id, kFileCreate | kDataExtend | kClose, 0, L"h", 3);
+
+  JournalReplayer replayer(roots_);
+  ASSERT_EQ(S_OK, Replay(&replayer));
+
+  size_t calls = 0;
+  replayer.Resize([&calls](const FileEntry* entry, LARGE_INTEGER* size,
+                           LARGE_INTEGER* allocated) {
+    ++calls;
+    EXPECT_EQ(L"h", entry->name);
+    size->QuadPart = 70;
+    allocated->QuadPart = 4096;
+  });
+  replayer.Reorder();
+  replayer.Commit();
+
+  EXPECT_EQ(1u, calls);
+  EXPECT_EQ(L"C:\\:220/4246(b:120/4146(h:70/4096 g:50/50 ) "
+            L"a:100/100(f:100/100 ) )",
+            Dump(root()));
+}
+
+TEST_F(JournalReplayerTest, MovesAndRenames) {
+  Append(f_->id, a_->id, kRenameOldName, 0, L"f");
+  Append(f_->id, b_->id, kRenameNewName, 0, L"e");
+
+  JournalReplayer replayer(roots_);
+  ASSERT_EQ(S_OK, Replay(&replayer));
+  replayer.Reorder();
+  replayer.Commit();
+
+  EXPECT_EQ(L"C:\\:150/150(b:150/150(e:100/100 g:50/50 ) a:0/0() )",
+            Dump(root()));
+}
+
+TEST_F(JournalReplayerTest, DeletesSubtrees) {
+  Append(a_->id, root()->id, kFileDelete | kClose, FILE_ATTRIBUTE_DIRECTORY,
+         L"a");
+
+  JournalReplayer replayer(roots_);
+  ASSERT_EQ(S_OK, Replay(&replayer));
+  replayer.Reorder();
+  replayer.Commit();
+
+  EXPECT_EQ(L"C:\\:50/50(b:50/50(g:50/50 ) )", Dump(root()));
+}
+
+TEST_F(JournalReplayerTest, RollsBackWhenARecordDoesNotFit) {
+  Append(Frn(40, 1), a_->id, kFileCreate, FILE_ATTRIBUTE_DIRECTORY, L"c");
+  Append(Frn(41, 1), Frn(40, 1), kFileCreate, 0, L"i");
+  Append(g_->id, Frn(40, 1), kRenameNewName, 0, L"j");
+  Append(b_->id, root()->id, kFileDelete, FILE_ATTRIBUTE_DIRECTORY, L"b");
+  Append(f_->id, a_->id, kRenameNewName | kDataExtend, 0, L"k");
+
+  // A parent never seen means the journal and the tree have parted ways.
+  Append(Frn(42, 1), Frn(99, 1), kFileCreate, 0, L"l");
+
+  {
+    JournalReplayer replayer(roots_);
+    ASSERT_EQ(E_FAIL, Replay(&replayer));
+    EXPECT_NE(scanned_, Dump(root()));
+  }
+
+  EXPECT_EQ(scanned_, Dump(root()));
+  EXPECT_EQ(a_, f_->parent);
+  EXPECT_EQ(b_, g_->parent);
+}
+
+TEST_F(JournalReplayerTest, RollsBackWithoutCommit) {
+  Append(g_->id, a_->id, kRenameNewName | kDataExtend, 0, L"g");
+  Append(f_->id, a_->id, kFileDelete, 0, L"f");
+
+  {
+    JournalReplayer replayer(roots_);
+    ASSERT_EQ(S_OK, Replay(&replayer));
+    replayer.Resize([](const FileEntry* /*entry*/, LARGE_INTEGER* size,
+                       LARGE_INTEGER* allocated) {
+      size->QuadPart = 1000;
+      allocated->QuadPart = 1024;
+    });
+    replayer.Reorder();
+    EXPECT_EQ(L"C:\\:1000/1024(a:1000/1024(g:1000/1024 ) b:0/0() )",
+              Dump(root()));
+  }
+
+  EXPECT_EQ(scanned_, Dump(root()));
+}
+
+TEST_F(JournalReplayerTest, TellsReusedRecordsApart) {
+  // Changes to a file that used to be in the record of f don't touch it.
+  Append(Frn(17, 7), a_->id, kFileDelete, 0, L"old");
+
+  JournalReplayer replayer(roots_);
+  ASSERT_EQ(S_OK, Replay(&replayer));
+  EXPECT_EQ(scanned_, Dump(root()));
+
+  // A file made in it means f is gone.
+  journal_.clear();
+  Append(Frn(17, 2), b_->id, kFileCreate, 0, L"n");
+  ASSERT_EQ(S_OK, Replay(&replayer));
+  replayer.Reorder();
+  replayer.Commit();
+
+  EXPECT_EQ(L"C:\\:50/50(b:50/50(g:50/50 n:0/0 ) a:0/0() )", Dump(root()));
+}
+
+TEST_F(JournalReplayerTest, RejectsMalformedRecords) {
+  Append(Frn(40, 1), b_->id, kFileCreate, 0, L"h");
+  journal_.resize(journal_.size() - 8);
+
+  JournalReplayer replayer(roots_);
+  EXPECT_EQ(E_INVALIDARG, Replay(&replayer));
+}
+
+}  // namespace
@@ -0,0 +1,401 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "app/io_budget.h"
+#include "app/mft_reader.h"
+
+namespace {
+
+const uint32_t kSectorSize = 512;
+const uint32_t kClusterSize = 4096;
+const uint32_t kRecordSize = 1024;
+const uint32_t kRecordsPerCluster = kClusterSize / kRecordSize;
+const uint64_t kMftCluster = 4;
+const uint64_t kImageClusters = 40;
+
+const uint32_t kStandardInformation = 0x10;
+const uint32_t kAttributeList = 0x20;
+const uint32_t kFileName = 0x30;
+const uint32_t kData = 0x80;
+
+const uint16_t kInUse = 0x0001;
+const uint16_t kDirectory = 0x0002;
+
+const uint8_t kWin32Namespace = 1;
+const uint8_t kDosNamespace = 2;
+
+typedef std::vector<uint8_t> Bytes;
+
+template <typename T>
+void Put(Bytes* bytes, size_t offset, T value) {
+  if (bytes->size() < offset + sizeof(value))
+    bytes->resize(offset + sizeof(value));
+  memcpy(bytes->data() + offset, &value, sizeof(value));
+}
+
+void Pad(Bytes* bytes) {
+  bytes->resize((bytes->size() + 7) & ~size_t{7});
+}
+
+Bytes Resident(uint32_t type, const Bytes& value) {
+  Bytes attribute(0x18);
+  Put<uint32_t>(&attribute, 0x00, type);
+  Put<uint32_t>(&attribute, 0x10, static_cast<uint32_t>(value.size()));
+  Put<uint16_t>(&attribute, 0x14, 0x18);
+  attribute.insert(attribute.end(), value.begin(), value.end());
+  Pad(&attribute);
+  Put<uint32_t>(&attribute, 0x04, static_cast<uint32_t>(attribute.size()));
+  return attribute;
+}
+
+// |runs| are the encoded mapping pairs, terminator included. A nonzero
+// |compressed| adds the compressed size field.
+Bytes NonResident(uint32_t type, uint64_t first_vcn, uint64_t last_vcn,
+                  uint64_t allocated, uint64_t size, const Bytes& runs,
+                  uint16_t flags = 0, uint64_t compressed = 0) {
+  size_t runs_offset = compressed != 0 ? 0x48 : 0x40;
+  Bytes attribute(runs_offset);
+  Put<uint32_t>(&attribute, 0x00, type);
+  attribute[0x08] = 1;
+  Put<uint16_t>(&attribute, 0x0A, static_cast<uint16_t>(runs_offset));
+  Put<uint16_t>(&attribute, 0x0C, flags);
+  Put<uint64_t>(&attribute, 0x10, first_vcn);
+  Put<uint64_t>(&attribute, 0x18, last_vcn);
+  Put<uint16_t>(&attribute, 0x20, static_cast<uint16_t>(runs_offset));
+  Put<uint64_t>(&attribute, 0x28, allocated);
+  Put<uint64_t>(&attribute, 0x30, size);
+  Put<uint64_t>(&attribute, 0x38, size);
+  if (compressed != 0)
+    Put<uint64_t>(&attribute, 0x40, compressed);
+  attribute.insert(attribute.end(), runs.begin(), runs.end());
+  Pad(&attribute);
+  Put<uint32_t>(&attribute, 0x04, static_cast<uint32_t>(attribute.size()));
+  return attribute;
+}
+
+Bytes StandardInformation(uint32_t attributes) {
+  Bytes value(0x48);
+  Put<uint32_t>(&value, 0x20, attributes);
+  return Resident(kStandardInformation, value);
+}
+
+Bytes FileName(uint64_t parent, const std::wstring& name,
+               uint8_t name_space = kWin32Namespace) {
+  Bytes value(0x42);
+  Put<uint64_t>(&value, 0x00, parent | 1ull << 48);
+  value[0x40] = static_cast<uint8_t>(name.size());
+  value[0x41] = name_space;
+  for (size_t i = 0; i < name.size(); ++i)
+    Put<uint16_t>(&value, 0x42 + i * 2, static_cast<uint16_t>(name[i]));
+  return Resident(kFileName, value);
+}
+
+struct ListEntry {
+  uint32_t type;
+  uint64_t record;
+  uint64_t first_vcn;
+};
+
+// An attribute list naming the record that holds each attribute.
+Bytes AttributeList(const std::vector<ListEntry>& entries) {
+  Bytes value;
+  for (auto& entry : entries) {
+    auto offset = value.size();
+    Put<uint32_t>(&value, offset + 0x00, entry.type);
+    Put<uint16_t>(&value, offset + 0x04, 0x20);
+    Put<uint64_t>(&value, offset + 0x08, entry.first_vcn);
+    Put<uint64_t>(&value, offset + 0x10, entry.record | 1ull << 48);
+    Put<uint16_t>(&value, offset + 0x18, 0);
+    value.resize(offset + 0x20);
+  }
+  return Resident(kAttributeList, value);
+}
+
+// Lays out a file record with its update sequence array applied, so that
+// the last two bytes of each sector hold the sequence number.
+Bytes Record(uint16_t flags, const std::vector<Bytes>& attributes,
+             uint64_t base = 0) {
+  Bytes record(kRecordSize);
+  memcpy(record.data(), "FILE", 4);
+  Put<uint16_t>(&record, 0x04, 0x30);
+  Put<uint16_t>(&record, 0x06, kRecordSize / kSectorSize + 1);
+  Put<uint16_t>(&record, 0x14, 0x38);
+  Put<uint16_t>(&record, 0x16, flags);
+  Put<uint32_t>(&record, 0x1C, kRecordSize);
+  Put<uint64_t>(&record, 0x20, base != 0 ? base | 1ull << 48 : 0);
+
+  size_t offset = 0x38;
+  for (auto& attribute : attributes) {
+    memcpy(&record[offset], attribute.data(), attribute.size());
+    offset += attribute.size();
+  }
+  Put<uint32_t>(&record, offset, 0xFFFFFFFF);
+  Put<uint32_t>(&record, 0x18, static_cast<uint32_t>(offset + 8));
+
+  const uint16_t kSequence = 0x0042;
+  Put<uint16_t>(&record, 0x30, kSequence);
+  for (uint32_t i = 1; i <= kRecordSize / kSectorSize; ++i) {
+    auto tail = i * kSectorSize - 2;
+    memcpy(&record[0x30 + i * 2], &record[tail], 2);
+    Put<uint16_t>(&record, tail, kSequence);
+  }
+
+  return record;
+}
+
+// A 160 KiB volume whose $MFT of 24 records lies in three extents, out of
+// order on disk. Record 0 maps the first, and names record 3 in its
+// attribute list for the other two.
+class MftImage {
+ public:
+  // Where each run of two clusters of the $MFT lies on disk.
+  static const uint64_t kExtents[3];
+
+  MftImage() : image_(kImageClusters * kClusterSize) {
+    memcpy(&image_[3], "NTFS    ", 8);
+    Put<uint16_t>(&image_, 0x0B, kSectorSize);
+    image_[0x0D] = kClusterSize / kSectorSize;
+    Put<uint64_t>(&image_, 0x30, kMftCluster);
+    image_[0x40] = static_cast<uint8_t>(-10);  // 1 KiB records
+  }
+
+  ~MftImage() {
+    if (!path_.empty())
+      unlink(path_.c_str());
+  }
+
+  void SetRecord(uint64_t number, const Bytes& record) {
+    auto vcn = number / kRecordsPerCluster;
+    auto lcn = kExtents[vcn / 2] + vcn % 2;
+    auto offset =
+        lcn * kClusterSize + number % kRecordsPerCluster * kRecordSize;
+    memcpy(&image_[offset], record.data(), record.size());
+  }
+
+  void Corrupt(size_t offset) {
+    image_[offset] ^= 0xFF;
+  }
+
+  // Writes the image out, and returns its path.
+  std::string Write() {
+    path_ = testing::TempDir() + "mft_reader_test.img";
+    auto file = fopen(path_.c_str(), "wb");
+    EXPECT_NE(nullptr, file);
+    fwrite(image_.data(), 1, image_.size(), file);
+    fclose(file);
+    return path_;
+  }
+
+ private:
+  Bytes image_;
+  std::string path_;
+};
+
+const uint64_t MftImage::kExtents[3] = {kMftCluster, 30, 12};
+
+const uint64_t kMftSize = 6 * kClusterSize;
+
+// A volume with the files the tests look at.
+class MftReaderTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    // The runs are 0x11 pairs: a byte of length, then a byte of offset from
+    // the last run.
+    image_.SetRecord(
+        0, Record(kInUse, {StandardInformation(0x06),
+                           AttributeList({{kStandardInformation, 0, 0},
+                                          {kFileName, 0, 0},
+                                          {kData, 0, 0},
+                                          {kData, 3, 2}}),
+                           FileName(5, L"$MFT"),
+                           NonResident(kData, 0, 1, kMftSize, kMftSize,
+                                       {0x11, 0x02, 0x04, 0x00})}));
+    image_.SetRecord(
+        3, Record(kInUse, {NonResident(kData, 2, 5, 0, 0,
+                                       {0x11, 0x02, 0x1E, 0x11, 0x02, 0xEE,
+                                        0x00})}));
+    image_.SetRecord(5, Record(kInUse | kDirectory,
+                               {StandardInformation(0x06), FileName(5, L".")}));
+
+    image_.SetRecord(16, Record(kInUse | kDirectory, {StandardInformation(0),
+                                                      FileName(5, L"docs")}));
+    image_.SetRecord(17, Record(kInUse, {StandardInformation(0x20),
+                                         FileName(16, L"a.txt"),
+                                         Resident(kData, Bytes(100, 'a'))}));
+
+    // The DOS name comes first and is passed over. The long name runs past
+    // the end of the first sector, whose last bytes the fixup restores.
+    long_name_.assign(120, L'x');
+    long_name_ += L"-end";
+    image_.SetRecord(
+        18, Record(kInUse, {StandardInformation(0x20),
+                            FileName(16, L"XXXXXX~1", kDosNamespace),
+                            FileName(16, long_name_),
+                            NonResident(kData, 0, 2, 12288, 10000,
+                                        {0x11, 0x03, 0x20, 0x00})}));
+
+    image_.SetRecord(
+        19, Record(kInUse, {StandardInformation(0x800),
+                            FileName(16, L"packed.bin"),
+                            NonResident(kData, 0, 15, 65536, 60000,
+                                        {0x11, 0x10, 0x21, 0x00}, 0x0001,
+                                        8192)}));
+
+    // Record 20 keeps its data in record 21.
+    image_.SetRecord(
+        20, Record(kInUse, {StandardInformation(0x20),
+                            AttributeList({{kStandardInformation, 20, 0},
+                                           {kFileName, 20, 0},
+                                           {kData, 21, 0}}),
+                            FileName(16, L"split.dat")}));
+    image_.SetRecord(21, Record(kInUse,
+                                {NonResident(kData, 0, 1, 8192, 5000,
+                                             {0x11, 0x02, 0x22, 0x00})},
+                                20));
+
+    image_.SetRecord(22, Record(0, {FileName(16, L"deleted.txt")}));
+    image_.SetRecord(23, Record(kInUse, {FileName(16, L"torn.txt")}));
+  }
+
+  bool Read(std::vector<MftReader::Record>* records) {
+    MftReader reader;
+    return reader.Open(image_.Write().c_str()) && reader.Read(records);
+  }
+
+  MftImage image_;
+  std::wstring long_name_;
+};
+
+TEST_F(MftReaderTest, ReadsEveryRecordOfFragmentedMft) {
+  MftReader reader;
+  ASSERT_TRUE(reader.Open(image_.Write().c_str()));
+  EXPECT_EQ(kRecordSize, reader.bytes_per_record());
+
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(reader.Read(&records));
+  ASSERT_EQ(kMftSize / kRecordSize, records.size());
+
+  EXPECT_TRUE(records[0].in_use);
+  EXPECT_EQ(L"$MFT", records[0].name);
+  EXPECT_EQ(kMftSize, records[0].size);
+
+  // Records 8 and up lie in the extents mapped by extension record 3, the
+  // last of them before the first on disk.
+  EXPECT_TRUE(records[16].in_use);
+  EXPECT_EQ(L"docs", records[16].name);
+  EXPECT_EQ(L"a.txt", records[17].name);
+}
+
+TEST_F(MftReaderTest, DecodesNamesParentsAndSizes) {
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(Read(&records));
+
+  auto& root = records[5];
+  EXPECT_TRUE(root.directory);
+  EXPECT_EQ(5u, root.parent);
+
+  auto& docs = records[16];
+  EXPECT_TRUE(docs.directory);
+  EXPECT_NE(0u, docs.attributes & 0x10);
+  EXPECT_EQ(5u, docs.parent);
+
+  auto& resident = records[17];
+  EXPECT_FALSE(resident.directory);
+  EXPECT_EQ(16u, resident.parent);
+  EXPECT_EQ(0x20u, resident.attributes);
+  EXPECT_EQ(100u, resident.size);
+  EXPECT_EQ(104u, resident.allocated_size);
+
+  auto& nonresident = records[18];
+  EXPECT_EQ(long_name_, nonresident.name);
+  EXPECT_EQ(10000u, nonresident.size);
+  EXPECT_EQ(12288u, nonresident.allocated_size);
+}
+
+TEST_F(MftReaderTest, KeepsExtensionsAlone) {
+  MftReader reader(MftReader::Extensions);
+  ASSERT_TRUE(reader.Open(image_.Write().c_str()));
+
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(reader.Read(&records));
+
+  EXPECT_EQ(L"", records[16].name);
+  EXPECT_EQ(5u, records[16].parent);
+  EXPECT_EQ(L".txt", records[17].name);
+  EXPECT_EQ(L"", records[18].name);
+  EXPECT_EQ(16u, records[18].parent);
+  EXPECT_EQ(L".bin", records[19].name);
+  EXPECT_EQ(L".dat", records[20].name);
+}
+
+TEST_F(MftReaderTest, TakesCompressedSizeAsAllocated) {
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(Read(&records));
+
+  EXPECT_EQ(60000u, records[19].size);
+  EXPECT_EQ(8192u, records[19].allocated_size);
+}
+
+TEST_F(MftReaderTest, FoldsExtensionRecordsIntoTheirBase) {
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(Read(&records));
+
+  EXPECT_EQ(L"split.dat", records[20].name);
+  EXPECT_EQ(5000u, records[20].size);
+  EXPECT_EQ(8192u, records[20].allocated_size);
+  EXPECT_FALSE(records[21].in_use);
+}
+
+TEST_F(MftReaderTest, SkipsFreeAndTornRecords) {
+  // Tear the second sector of record 23, the last of the third extent.
+  image_.Corrupt((MftImage::kExtents[2] + 1) * kClusterSize +
+                 3 * kRecordSize + 2 * kSectorSize - 2);
+
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(Read(&records));
+
+  EXPECT_FALSE(records[22].in_use);
+  EXPECT_TRUE(records[22].name.empty());
+  EXPECT_FALSE(records[23].in_use);
+  EXPECT_TRUE(records[23].name.empty());
+}
+
+TEST_F(MftReaderTest, RejectsOtherFileSystems) {
+  image_.Corrupt(3);
+
+  MftReader reader;
+  EXPECT_FALSE(reader.Open(image_.Write().c_str()));
+}
+
+TEST_F(MftReaderTest, TakesTheBudgetAChunkAtATime) {
+  MftReader reader;
+  ASSERT_TRUE(reader.Open(image_.Write().c_str()));
+
+  IoBudget budget(1);
+  std::vector<MftReader::Record> records;
+  ASSERT_TRUE(reader.Read(&records, nullptr, nullptr, &budget));
+  EXPECT_EQ(L"a.txt", records[17].name);
+
+  // Blocks for good if a slot was left taken.
+  IoBudget::Slot slot(&budget);
+}
+
+TEST_F(MftReaderTest, StopsOnceCanceled) {
+  MftReader reader;
+  ASSERT_TRUE(reader.Open(image_.Write().c_str()));
+
+  std::atomic<bool> cancel(true);
+  std::vector<MftReader::Record> records;
+  EXPECT_FALSE(reader.Read(&records, &cancel));
+}
+
+}  // namespace
@@ -0,0 +1,232 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "app/query_engine.h"
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+
+namespace {
+
+// Collects the names of the matches it is passed, stopping the query after
+// |limit| batches.
+class Collector : public QueryEngine::Listener {
+ public:
+  explicit Collector(size_t limit = SIZE_MAX) : limit_(limit), batches_(0) {}
+
+  bool OnMatches(const std::vector<const FileEntry*>& matches) override {
+    for (auto entry : matches)
+      names_.push_back(entry->name);
+
+    return ++batches_ < limit_;
+  }
+
+  // Returns the names collected, sorted.
+  std::vector<std::wstring> names() const {
+    auto names = names_;
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  size_t batches() const {
+    return batches_;
+  }
+
+ private:
+  const size_t limit_;
+  size_t batches_;
+  std::vector<std::wstring> names_;
+
+  Collector(const Collector&) = delete;
+  Collector& operator=(const Collector&) = delete;
+};
+
+Query Substring(const std::wstring& substring) {
+  Query query;
+  query.substring = substring;
+  return query;
+}
+
+Query Glob(const std::wstring& glob) {
+  Query query;
+  query.glob = glob;
+  return query;
+}
+
+std::vector<std::wstring> Sorted(std::vector<std::wstring> names) {
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+class QueryEngineTest : public testing::Test {
+ protected:
+  QueryEngineTest() : scheduler_(2) {
+    root_.attributes = FILE_ATTRIBUTE_DIRECTORY;
+  }
+
+  void Add(const std::wstring& name) {
+    root_.children.push_back(std::make_unique<FileEntry>());
+    auto child = root_.children.back().get();
+    child->parent = &root_;
+    child->name = name;
+  }
+
+  void Add(const std::vector<std::wstring>& names) {
+    for (auto& name : names)
+      Add(name);
+  }
+
+  // Returns the names matching |query|, sorted.
+  std::vector<std::wstring> Run(const Query& query) {
+    QueryEngine engine(&root_, &scheduler_);
+    Collector collector;
+    EXPECT_EQ(S_OK, engine.Run(query, &collector, nullptr));
+    return collector.names();
+  }
+
+  TaskScheduler scheduler_;
+  FileEntry root_;
+};
+
+TEST_F(QueryEngineTest, FindsNeedlesAtEitherEndOfNames) {
+  Add({L"report.txt", L"txtreport", L"rep", L"re", L"xreportx"});
+
+  EXPECT_EQ(Sorted({L"rep", L"report.txt", L"txtreport", L"xreportx"}),
+            Run(Substring(L"rep")));
+  EXPECT_EQ(Sorted({L"report.txt", L"txtreport"}), Run(Substring(L"txt")));
+  EXPECT_EQ(std::vector<std::wstring>{L"txtreport"},
+            Run(Substring(L"txtreport")));
+}
+
+TEST_F(QueryEngineTest, FindsNeedlesStraddlingBlocks) {
+  // The names run on from each other, so the needles start at every offset
+  // of a 16-byte block, and so do near misses that share their first and
+  // last bytes.
+  std::vector<std::wstring> expected;
+  for (size_t i = 0; i < 48; ++i) {
+    auto name = std::wstring(i, L'x') + L"needle" + std::wstring(i % 5, L'y');
+    Add(name);
+    expected.push_back(name);
+    Add(std::wstring(i % 7, L'x') + L"neexle" + std::wstring(i, L'y'));
+  }
+
+  EXPECT_EQ(Sorted(expected), Run(Substring(L"needle")));
+  EXPECT_EQ(Sorted(expected), Run(Substring(L"NEEDLE")));
+}
+
+TEST_F(QueryEngineTest, AgreesWithAPlainSearch) {
+  std::mt19937 random(7);
+  std::vector<std::wstring> names;
+  for (size_t i = 0; i < 2000; ++i) {
+    std::wstring name(1 + random() % 40, L'a');
+    for (auto& c : name)
+      c = random() % 2 == 0 ? L'a' : L'b';
+    names.push_back(name);
+  }
+
+  Add(names);
+
+  for (auto needle : {L"b", L"ab", L"abba", L"babab", L"aaaaaaaa",
+                      L"abababababababab", L"bbbbbbbbbbbbbbbbb"}) {
+    std::vector<std::wstring> expected;
+    for (auto& name : names) {
+      if (name.find(needle) != std::wstring::npos)
+        expected.push_back(name);
+    }
+
+    EXPECT_EQ(Sorted(expected), Run(Substring(needle))) << needle;
+  }
+}
+
+TEST_F(QueryEngineTest, SearchesNamesShorterThanABlock) {
+  // Even all of them together are shorter than one.
+  Add({L"a", L"ab", L"bc"});
+
+  EXPECT_EQ(Sorted({L"ab", L"bc"}), Run(Substring(L"b")));
+  EXPECT_EQ(std::vector<std::wstring>{L"bc"}, Run(Substring(L"bc")));
+  EXPECT_TRUE(Run(Substring(L"abc")).empty());
+  EXPECT_TRUE(Run(Substring(L"abcdefghijklmnopqrstuvwxyz")).empty());
+}
+
+TEST_F(QueryEngineTest, TakesWholeCharactersForQuestionMarks) {
+  // Two, three and four bytes long in UTF-8.
+  const std::wstring cafe = L"caf\u00E9";
+  const std::wstring nihon = L"\u65E5\u672C";
+  const std::wstring smile = L"\U0001F600";
+  Add({cafe, L"cafe", cafe + L's', nihon, smile});
+
+  EXPECT_EQ(Sorted({L"cafe", cafe}), Run(Glob(L"caf?")));
+  EXPECT_EQ(std::vector<std::wstring>{cafe + L's'}, Run(Glob(L"caf??")));
+  EXPECT_EQ(std::vector<std::wstring>{nihon}, Run(Glob(L"??")));
+  EXPECT_EQ(std::vector<std::wstring>{nihon}, Run(Glob(L"\u65E5?")));
+  EXPECT_EQ(std::vector<std::wstring>{smile}, Run(Glob(L"?")));
+}
+
+TEST_F(QueryEngineTest, BacktracksStars) {
+  Add({L"aab", L"ab", L"aba", L"abbbc", L"acb", L"axbyc", L"a.txt.txt",
+       L"a.txt.bak"});
+
+  EXPECT_EQ(Sorted({L"aab", L"ab"}), Run(Glob(L"*ab")));
+  EXPECT_EQ(Sorted({L"abbbc", L"axbyc"}), Run(Glob(L"a*b*c")));
+  EXPECT_EQ(std::vector<std::wstring>{L"aba"}, Run(Glob(L"a*a")));
+  EXPECT_EQ(std::vector<std::wstring>{L"a.txt.txt"}, Run(Glob(L"*.txt")));
+  EXPECT_EQ(Sorted({L"a.txt.bak", L"a.txt.txt"}), Run(Glob(L"*.txt*")));
+  EXPECT_EQ(Sorted({L"aab", L"acb"}), Run(Glob(L"a*?b")));
+}
+
+TEST_F(QueryEngineTest, SearchesEveryChunk) {
+  // Enough entries for three chunks, with matches at the edges of each.
+  const size_t kEntries = 150000;
+  std::vector<std::wstring> expected;
+  for (size_t i = 0; i < kEntries; ++i) {
+    auto hit = i % 1000 == 0 || i == 65535 || i == 65536 ||
+               i == kEntries - 1;
+    auto name = (hit ? L"hit" : L"file") + std::to_wstring(i);
+    Add(name);
+    if (hit)
+      expected.push_back(name);
+  }
+
+  QueryEngine engine(&root_, &scheduler_);
+  EXPECT_EQ(kEntries, engine.entry_count());
+
+  Collector collector;
+  EXPECT_EQ(S_OK, engine.Run(Substring(L"hit"), &collector, nullptr));
+  EXPECT_EQ(Sorted(expected), collector.names());
+  EXPECT_EQ(3u, collector.batches());
+}
+
+TEST_F(QueryEngineTest, StopsWhenTheListenerDeclines) {
+  for (size_t i = 0; i < 150000; ++i)
+    Add(std::to_wstring(i));
+
+  QueryEngine engine(&root_, &scheduler_);
+  Collector collector(1);
+  EXPECT_EQ(E_ABORT, engine.Run(Query(), &collector, nullptr));
+  EXPECT_EQ(1u, collector.batches());
+}
+
+TEST_F(QueryEngineTest, StopsWhenCanceled) {
+  for (size_t i = 0; i < 150000; ++i)
+    Add(std::to_wstring(i));
+
+  QueryEngine engine(&root_, &scheduler_);
+  std::atomic<bool> cancel(true);
+  Collector collector;
+  EXPECT_EQ(E_ABORT, engine.Run(Query(), &collector, &cancel));
+  EXPECT_EQ(0u, collector.batches());
+
+  cancel = false;
+  EXPECT_EQ(S_OK, engine.Run(Query(), &collector, &cancel));
+  EXPECT_EQ(3u, collector.batches());
+}
+
+}  // namespace
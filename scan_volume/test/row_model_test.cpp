@@ -0,0 +1,289 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/row_model.h"
+#include "app/volume_scanner.h"
+
+namespace {
+
+FileEntry* AddChild(FileEntry* parent, const std::wstring& name,
+                    bool directory) {
+  parent->children.push_back(std::make_unique<FileEntry>());
+  auto child = parent->children.back().get();
+  child->parent = parent;
+  child->name = name;
+  child->attributes = directory ? FILE_ATTRIBUTE_DIRECTORY : 0;
+  return child;
+}
+
+// Makes a tree of |count| entries below the root, each placed under a
+// directory picked at random.
+std::unique_ptr<FileEntry> MakeTree(size_t count, uint32_t seed) {
+  std::mt19937 random(seed);
+  auto root = std::make_unique<FileEntry>();
+  root->attributes = FILE_ATTRIBUTE_DIRECTORY;
+
+  std::vector<FileEntry*> directories{root.get()};
+  for (size_t i = 0; i < count; ++i) {
+    auto parent = directories[random() % directories.size()];
+    auto directory = random() % 3 == 0;
+    auto child = AddChild(parent, std::to_wstring(i), directory);
+    if (directory)
+      directories.push_back(child);
+  }
+
+  return root;
+}
+
+// The rows of the outline, worked out from scratch by walking the tree.
+class Outline {
+ public:
+  explicit Outline(const FileEntry* root) : root_(root) {}
+
+  std::vector<std::pair<const FileEntry*, size_t>> Rows() const {
+    std::vector<std::pair<const FileEntry*, size_t>> rows;
+    Walk(root_, 0, &rows);
+    return rows;
+  }
+
+  std::set<const FileEntry*> expanded;
+
+ private:
+  void Walk(const FileEntry* entry, size_t depth,
+            std::vector<std::pair<const FileEntry*, size_t>>* rows) const {
+    rows->push_back(std::make_pair(entry, depth));
+    if (expanded.count(entry) == 0)
+      return;
+
+    for (auto& child : entry->children)
+      Walk(child.get(), depth + 1, rows);
+  }
+
+  const FileEntry* const root_;
+};
+
+// Returns the entry shown at |row| of a model over an EntryRowTree, or nullptr
+// if there is none.
+const FileEntry* GetEntry(const RowModel& model, size_t row,
+                          size_t* depth = nullptr) {
+  auto item = model.GetRow(row, depth);
+  return item != RowModel::kNoItem ? EntryRowTree::entry(item) : nullptr;
+}
+
+void ExpectSame(const RowModel& model, const Outline& outline) {
+  auto rows = outline.Rows();
+  ASSERT_EQ(rows.size(), model.row_count());
+
+  for (size_t row = 0; row < rows.size(); ++row) {
+    size_t depth = 0;
+    EXPECT_EQ(rows[row].first, GetEntry(model, row, &depth)) << "row " << row;
+    EXPECT_EQ(rows[row].second, depth) << "row " << row;
+    EXPECT_EQ(outline.expanded.count(rows[row].first) != 0,
+              model.IsExpanded(row))
+        << "row " << row;
+  }
+}
+
+TEST(RowModelTest, ShowsOnlyTheRootAtFirst) {
+  auto root = MakeTree(20, 1);
+  EntryRowTree tree(root.get());
+  RowModel model(&tree);
+
+  EXPECT_EQ(1u, model.row_count());
+  size_t depth = 1;
+  EXPECT_EQ(root.get(), GetEntry(model, 0, &depth));
+  EXPECT_EQ(0u, depth);
+  EXPECT_FALSE(model.IsExpanded(0));
+  const auto none = RowModel::kNoItem;
+  EXPECT_EQ(none, model.GetRow(1, nullptr));
+}
+
+TEST(RowModelTest, ExpandsChildrenInStoredOrder) {
+  FileEntry root;
+  auto a = AddChild(&root, L"a", true);
+  auto b = AddChild(&root, L"b", false);
+  auto c = AddChild(a, L"c", false);
+
+  EntryRowTree tree(&root);
+  RowModel model(&tree);
+  ASSERT_TRUE(model.Expand(0));
+  ASSERT_EQ(3u, model.row_count());
+  EXPECT_EQ(a, GetEntry(model, 1));
+  EXPECT_EQ(b, GetEntry(model, 2));
+
+  ASSERT_TRUE(model.Expand(1));
+  ASSERT_EQ(4u, model.row_count());
+  size_t depth = 0;
+  EXPECT_EQ(c, GetEntry(model, 2, &depth));
+  EXPECT_EQ(2u, depth);
+  EXPECT_EQ(b, GetEntry(model, 3));
+}
+
+TEST(RowModelTest, RejectsRowsWithNothingToChange) {
+  FileEntry root;
+  auto empty = AddChild(&root, L"empty", true);
+  AddChild(&root, L"file", false);
+
+  EntryRowTree tree(&root);
+  RowModel model(&tree);
+  EXPECT_FALSE(model.Collapse(0));
+  ASSERT_TRUE(model.Expand(0));
+  EXPECT_FALSE(model.Expand(0));
+
+  // Neither an empty directory nor a file has rows to show.
+  EXPECT_EQ(empty, GetEntry(model, 1));
+  EXPECT_FALSE(model.Expand(1));
+  EXPECT_FALSE(model.Expand(2));
+  EXPECT_FALSE(model.Collapse(2));
+  EXPECT_FALSE(model.Expand(3));
+  EXPECT_EQ(3u, model.row_count());
+}
+
+TEST(RowModelTest, KeepsNestedExpansionWhileCollapsed) {
+  FileEntry root;
+  auto a = AddChild(&root, L"a", true);
+  auto b = AddChild(a, L"b", true);
+  AddChild(b, L"c", false);
+  AddChild(b, L"d", false);
+  AddChild(&root, L"e", false);
+
+  EntryRowTree tree(&root);
+  RowModel model(&tree);
+  ASSERT_TRUE(model.Expand(0));
+  ASSERT_TRUE(model.Expand(1));
+  ASSERT_TRUE(model.Expand(2));
+  ASSERT_EQ(6u, model.row_count());
+
+  ASSERT_TRUE(model.Collapse(1));
+  ASSERT_EQ(3u, model.row_count());
+  EXPECT_EQ(a, GetEntry(model, 1));
+  EXPECT_FALSE(model.IsExpanded(1));
+
+  // |b| comes back expanded along with |a|.
+  ASSERT_TRUE(model.Expand(1));
+  ASSERT_EQ(6u, model.row_count());
+  EXPECT_TRUE(model.IsExpanded(2));
+}
+
+TEST(RowModelTest, MatchesAFullWalkUnderRandomChanges) {
+  auto root = MakeTree(500, 2);
+  EntryRowTree tree(root.get());
+  RowModel model(&tree);
+  Outline outline(root.get());
+  std::mt19937 random(3);
+
+  for (int step = 0; step < 400; ++step) {
+    auto row = random() % model.row_count();
+    auto entry = GetEntry(model, row);
+    auto expanded = outline.expanded.count(entry) != 0;
+
+    if (random() % 4 == 0) {
+      EXPECT_EQ(expanded, model.Collapse(row));
+      outline.expanded.erase(entry);
+    } else {
+      auto expandable = !expanded && !entry->children.empty();
+      EXPECT_EQ(expandable, model.Expand(row));
+      if (!entry->children.empty())
+        outline.expanded.insert(entry);
+    }
+
+    ExpectSame(model, outline);
+    if (HasFatalFailure())
+      return;
+  }
+}
+
+TEST(RowModelTest, ShowsASnapshotInPlace) {
+  auto root = MakeTree(300, 4);
+  EntryRowTree entries(root.get());
+  RowModel expected(&entries);
+
+  FileTree snapshot;
+  snapshot.Build(root.get());
+  SnapshotRowTree nodes(&snapshot);
+  RowModel actual(&nodes);
+
+  std::mt19937 random(5);
+  for (int step = 0; step < 200; ++step) {
+    auto row = random() % expected.row_count();
+    auto expand = random() % 4 != 0;
+    ASSERT_EQ(expand ? expected.Expand(row) : expected.Collapse(row),
+              expand ? actual.Expand(row) : actual.Collapse(row));
+  }
+
+  ASSERT_EQ(expected.row_count(), actual.row_count());
+  for (size_t row = 0; row < expected.row_count(); ++row) {
+    size_t expected_depth = 0, actual_depth = 1;
+    auto expected_item = expected.GetRow(row, &expected_depth);
+    auto actual_item = actual.GetRow(row, &actual_depth);
+
+    std::wstring expected_name, actual_name;
+    entries.AppendName(expected_item, &expected_name);
+    nodes.AppendName(actual_item, &actual_name);
+    EXPECT_EQ(expected_name, actual_name) << "row " << row;
+    EXPECT_EQ(expected_depth, actual_depth) << "row " << row;
+    EXPECT_EQ(entries.attributes(expected_item), nodes.attributes(actual_item))
+        << "row " << row;
+    EXPECT_EQ(expected.IsExpanded(row), actual.IsExpanded(row))
+        << "row " << row;
+  }
+}
+
+TEST(RowModelTest, ShowsChildrenOfAnotherParentAsBlankRows) {
+  FileEntry root;
+  root.attributes = FILE_ATTRIBUTE_DIRECTORY;
+  auto a = AddChild(&root, L"a", true);
+  AddChild(&root, L"b", false);
+  AddChild(a, L"c", false);
+
+  FileTree tree;
+  tree.Build(&root);
+  auto path = testing::TempDir() + "row_model_test.snapshot";
+  ASSERT_EQ(S_OK, tree.Save(path.c_str()));
+
+  // Make "c", node 3, claim "b", node 2, as its parent.
+  auto file = fopen(path.c_str(), "r+b");
+  ASSERT_NE(nullptr, file);
+  DWORDLONG node_offset;
+  fseek(file, 32, SEEK_SET);
+  ASSERT_EQ(1u, fread(&node_offset, sizeof(node_offset), 1, file));
+  DWORD parent = 2;
+  fseek(file, static_cast<long>(node_offset + 3 * sizeof(FileTree::Node) +
+                                offsetof(FileTree::Node, parent)),
+        SEEK_SET);
+  fwrite(&parent, sizeof(parent), 1, file);
+  fclose(file);
+
+  FileTree loaded;
+  ASSERT_EQ(S_OK, loaded.Load(path.c_str()));
+  unlink(path.c_str());
+
+  SnapshotRowTree nodes(&loaded);
+  RowModel model(&nodes);
+  ASSERT_TRUE(model.Expand(0));
+  ASSERT_TRUE(model.Expand(1));
+  ASSERT_EQ(4u, model.row_count());
+
+  std::wstring name;
+  auto item = model.GetRow(2, nullptr);
+  nodes.AppendName(item, &name);
+  EXPECT_EQ(L"", name);
+  EXPECT_EQ(0u, nodes.child_count(item));
+  EXPECT_FALSE(model.Expand(2));
+}
+
+}  // namespace
@@ -0,0 +1,117 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "app/file_tree.h"
+#include "app/scan_diff.h"
+#include "app/task_scheduler.h"
+#include "app/volume_scanner.h"
+
+namespace {
+
+FileEntry* AddChild(FileEntry* parent, DWORDLONG id, const std::wstring& name,
+                    DWORD attributes, LONGLONG size, LONGLONG allocated) {
+  parent->children.push_back(std::make_unique<FileEntry>());
+  auto child = parent->children.back().get();
+  child->parent = parent;
+  child->id = FileId(id);
+  child->name = name;
+  child->attributes = attributes;
+  child->size.QuadPart = size;
+  child->allocated.QuadPart = allocated;
+  return child;
+}
+
+std::unique_ptr<FileEntry> MakeRoot() {
+  auto root = std::make_unique<FileEntry>();
+  root->id = FileId(static_cast<DWORDLONG>(5));
+  root->name = L"C:\\";
+  root->attributes = FILE_ATTRIBUTE_DIRECTORY;
+  return root;
+}
+
+class ScanDiffTest : public testing::Test {
+ protected:
+  ScanDiffTest() : scheduler_(1) {}
+
+  void Compare(const FileEntry* before, const FileEntry* after) {
+    before_.Build(before);
+    after_.Build(after);
+    diff_.Compare(before_, after_, &scheduler_);
+  }
+
+  std::wstring Name(const ScanDiff::Change& change) const {
+    return change.after != FileTree::kNone
+               ? after_.name(after_.node(change.after))
+               : before_.name(before_.node(change.before));
+  }
+
+  TaskScheduler scheduler_;
+  FileTree before_;
+  FileTree after_;
+  ScanDiff diff_;
+};
+
+TEST_F(ScanDiffTest, PairsHardLinksByParentAndName) {
+  auto before = MakeRoot();
+  auto a = AddChild(before.get(), 10, L"a", FILE_ATTRIBUTE_DIRECTORY, 0, 0);
+  auto b = AddChild(before.get(), 11, L"b", FILE_ATTRIBUTE_DIRECTORY, 0, 0);
+  AddChild(a, 50, L"x", 0, 100, 4096);
+  AddChild(b, 50, L"y", 0, 100, 4096);
+
+  // The link in |a| is gone and another made in |b|, and the directories
+  // are listed the other way around.
+  auto after = MakeRoot();
+  b = AddChild(after.get(), 11, L"b", FILE_ATTRIBUTE_DIRECTORY, 0, 0);
+  a = AddChild(after.get(), 10, L"a", FILE_ATTRIBUTE_DIRECTORY, 0, 0);
+  AddChild(b, 50, L"y", 0, 100, 4096);
+  AddChild(b, 50, L"z", 0, 100, 4096);
+
+  Compare(before.get(), after.get());
+
+  // Changes of the same size come in the order of the nodes after, the
+  // removed ones last.
+  ASSERT_EQ(2u, diff_.files().size());
+  EXPECT_EQ(ScanDiff::Added, diff_.files()[0].kind);
+  EXPECT_EQ(L"z", Name(diff_.files()[0]));
+  EXPECT_EQ(ScanDiff::Removed, diff_.files()[1].kind);
+  EXPECT_EQ(L"x", Name(diff_.files()[1]));
+}
+
+TEST_F(ScanDiffTest, ReportsAllocationChanges) {
+  auto before = MakeRoot();
+  AddChild(before.get(), 20, L"sparse", 0, 1 << 20, 4096);
+  AddChild(before.get(), 21, L"same", 0, 10, 4096);
+  before->allocated.QuadPart = 8192;
+
+  auto after = MakeRoot();
+  AddChild(after.get(), 20, L"sparse", 0, 1 << 20, 1 << 20);
+  AddChild(after.get(), 21, L"same", 0, 10, 4096);
+  after->allocated.QuadPart = (1 << 20) + 4096;
+
+  Compare(before.get(), after.get());
+
+  ASSERT_EQ(1u, diff_.files().size());
+  auto& change = diff_.files()[0];
+  EXPECT_EQ(ScanDiff::Resized, change.kind);
+  EXPECT_EQ(L"sparse", Name(change));
+  EXPECT_EQ(0, change.growth);
+  EXPECT_EQ((1 << 20) - 4096, change.allocated_growth);
+  EXPECT_EQ((1 << 20) - 4096, diff_.allocated_growth());
+}
+
+TEST_F(ScanDiffTest, LeavesUnknownAllocationsAlone) {
+  auto before = MakeRoot();
+  AddChild(before.get(), 20, L"f", 0, 10, -1);
+
+  auto after = MakeRoot();
+  AddChild(after.get(), 20, L"f", 0, 10, 4096);
+
+  Compare(before.get(), after.get());
+  EXPECT_TRUE(diff_.files().empty());
+}
+
+}  // namespace
@@ -0,0 +1,96 @@
+// Copyright (c) 2016 dacci.org
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "app/throttle.h"
+
+namespace {
+
+// As in app/throttle.cpp.
+const auto kWindow = std::chrono::milliseconds(250);
+const double kScaleStep = 1.0 / 16;
+
+double SecondsSince(Throttle::Clock::time_point start) {
+  return std::chrono::duration<double>(Throttle::Clock::now() - start).count();
+}
+
+// Completes an operation that took |latency| once the current window is
+// over, so that it closes the window.
+void CloseWindow(Throttle* throttle, std::chrono::milliseconds latency) {
+  std::this_thread::sleep_for(kWindow + std::chrono::milliseconds(10));
+  throttle->Complete(Throttle::Clock::now() - latency, 0);
+}
+
+TEST(ThrottleTest, LimitsOperations) {
+  Throttle throttle(100.0, 0.0);
+
+  // The bucket starts empty, so each operation waits its turn.
+  auto start = Throttle::Clock::now();
+  for (int i = 0; i < 20; ++i)
+    Throttle::Operation operation(&throttle, nullptr);
+
+  auto elapsed = SecondsSince(start);
+  EXPECT_GE(elapsed, 0.19);
+  EXPECT_LT(elapsed, 0.7);
+  EXPECT_EQ(1.0, throttle.scale());
+}
+
+TEST(ThrottleTest, LimitsBytes) {
+  Throttle throttle(0.0, 1000000.0);
+
+  // Bytes are charged once an operation completes, so the first one doesn't
+  // wait and each of the others waits for the one before.
+  auto start = Throttle::Clock::now();
+  for (int i = 0; i < 5; ++i) {
+    Throttle::Operation operation(&throttle, nullptr);
+    operation.set_bytes(100000);
+  }
+
+  auto elapsed = SecondsSince(start);
+  EXPECT_GE(elapsed, 0.39);
+  EXPECT_LT(elapsed, 0.9);
+}
+
+TEST(ThrottleTest, HalvesRatesWhileLatencyRises) {
+  Throttle throttle(1000.0, 0.0);
+  throttle.Complete(Throttle::Clock::now() - std::chrono::milliseconds(1), 0);
+
+  CloseWindow(&throttle, std::chrono::milliseconds(20));
+  EXPECT_DOUBLE_EQ(0.5, throttle.scale());
+
+  CloseWindow(&throttle, std::chrono::milliseconds(20));
+  EXPECT_DOUBLE_EQ(0.25, throttle.scale());
+
+  CloseWindow(&throttle, std::chrono::milliseconds(1));
+  EXPECT_DOUBLE_EQ(0.25 + kScaleStep, throttle.scale());
+
+  CloseWindow(&throttle, std::chrono::milliseconds(1));
+  EXPECT_DOUBLE_EQ(0.25 + 2 * kScaleStep, throttle.scale());
+}
+
+TEST(ThrottleTest, StopsWaitingWhenCanceled) {
+  // Each operation would wait a second.
+  Throttle throttle(1.0, 0.0);
+
+  std::atomic<bool> cancel(true);
+  auto start = Throttle::Clock::now();
+  throttle.Acquire(&cancel);
+  EXPECT_LT(SecondsSince(start), 0.1);
+
+  cancel = false;
+  std::thread canceler([&cancel]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    cancel = true;
+  });
+
+  start = Throttle::Clock::now();
+  throttle.Acquire(&cancel);
+  canceler.join();
+  EXPECT_LT(SecondsSince(start), 0.5);
+}
+
+}  // namespace
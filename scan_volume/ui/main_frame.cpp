@@ -4,48 +4,89 @@
 
 #include <atlstr.h>
 
+#include <atldlgs.h>
+
+#include "app/file_tree.h"
 #include "ui/drive_dialog.h"
 #include "ui/progress_dialog.h"
 
-struct MainFrame::ItemData {
-  FileEntry* entry;
-  bool opened;
-};
-
-MainFrame::MainFrame() {}
-
-HTREEITEM MainFrame::InsertItem(HTREEITEM parent, FileEntry* entry) {
-  TVINSERTSTRUCT insert{parent};
-  auto& new_item = insert.item;
-  new_item.mask =
-      TVIF_TEXT | TVIF_IMAGE | TVIF_SELECTEDIMAGE | TVIF_CHILDREN | TVIF_PARAM;
-  new_item.pszText = LPSTR_TEXTCALLBACK;
-  new_item.iImage = (entry->attributes & FILE_ATTRIBUTE_DIRECTORY) ? 0 : 1;
-  new_item.iSelectedImage = new_item.iImage;
-  new_item.cChildren = entry->children.empty() ? 0 : 1;
-  new_item.lParam = reinterpret_cast<LPARAM>(new ItemData{entry, false});
-
-  return tree_.InsertItem(&insert);
+namespace {
+
+const wchar_t kSnapshotFilter[] =
+    L"Snapshots (*.scan)\0*.scan\0All Files (*.*)\0*.*\0";
+
+}  // namespace
+
+MainFrame::MainFrame() : cache_first_(0) {}
+
+void MainFrame::UpdateLayout(BOOL resize_bars) {
+  CFrameWindowImpl::UpdateLayout(resize_bars);
+
+  if (list_.IsWindow()) {
+    RECT rect;
+    list_.GetClientRect(&rect);
+    list_.SetColumnWidth(0, rect.right - rect.left);
+  }
 }
 
-int CALLBACK MainFrame::SortChildren(LPARAM left, LPARAM right, LPARAM param) {
-#pragma warning(suppress : 4189)
-  auto self = reinterpret_cast<MainFrame*>(param);
-  auto a = reinterpret_cast<ItemData*>(left);
-  auto b = reinterpret_cast<ItemData*>(right);
+void MainFrame::FormatRow(int index, Row* row) const {
+  size_t depth = 0;
+  auto item = rows_->GetRow(index, &depth);
+  auto directory = (tree_->attributes(item) & FILE_ATTRIBUTE_DIRECTORY) != 0;
 
-  auto a_dir = a->entry->attributes & FILE_ATTRIBUTE_DIRECTORY;
-  auto b_dir = b->entry->attributes & FILE_ATTRIBUTE_DIRECTORY;
-  if (a_dir != b_dir)
-    return b_dir - a_dir;
+  row->image = directory ? 0 : 1;
+  row->indent = static_cast<int>(depth);
 
-  if (a->entry->size.QuadPart < b->entry->size.QuadPart)
-    return 1;
+  row->text.clear();
+  if (tree_->child_count(item) > 0)
+    row->text.append(rows_->IsExpanded(index) ? L"\x25BE " : L"\x25B8 ");
+  tree_->AppendName(item, &row->text);
 
-  if (a->entry->size.QuadPart > b->entry->size.QuadPart)
-    return -1;
+  LONGLONG size = tree_->size(item);
+  if (size < 0)
+    return;
+
+  int unit = -1;
+  while (size > 1024) {
+    size /= 1024;
+    ++unit;
+  }
+
+  wchar_t buffer[32];
+  swprintf_s(buffer, L" (%lld ", size);
+  row->text.append(buffer);
+
+  if (unit >= 0)
+    row->text.append(L"Ki\0Mi\0Gi\0Ti\0Pi\0Ei\0Zi\0Yi\0" + unit * 3);
 
-  return a->entry->name.compare(b->entry->name);
+  row->text.append(L"B)");
+}
+
+void MainFrame::Toggle(int index, bool expand) {
+  if (rows_ == nullptr || index < 0)
+    return;
+
+  if (expand ? rows_->Expand(index) : rows_->Collapse(index))
+    ShowRows();
+}
+
+void MainFrame::ShowRows() {
+  cache_.clear();
+
+  auto count = rows_ != nullptr ? rows_->row_count() : 0;
+  list_.SetItemCountEx(static_cast<int>(count), LVSICF_NOSCROLL);
+  list_.Invalidate();
+}
+
+void MainFrame::ShowTree(std::unique_ptr<RowTree> tree) {
+  rows_.reset();
+  tree_ = std::move(tree);
+  if (tree_ != nullptr) {
+    rows_ = std::make_unique<RowModel>(tree_.get());
+    rows_->Expand(0);
+  }
+
+  ShowRows();
 }
 
 int MainFrame::OnCreate(CREATESTRUCT* /*create_struct*/) {
@@ -72,82 +113,89 @@ int MainFrame::OnCreate(CREATESTRUCT* /*create_struct*/) {
 
   FreeLibrary(shell32);
 
-  m_hWndClient = tree_.Create(
+  // Only the rows on screen are ever asked for.
+  m_hWndClient = list_.Create(
       m_hWnd, nullptr, nullptr,
-      WS_CHILD | WS_VISIBLE | WS_CLIPCHILDREN | WS_CLIPSIBLINGS |
-          TVS_HASBUTTONS | TVS_HASLINES | TVS_LINESATROOT |
-          TVS_DISABLEDRAGDROP | TVS_SHOWSELALWAYS | TVS_FULLROWSELECT,
-      TVS_EX_DOUBLEBUFFER | TVS_EX_NOINDENTSTATE);
-  if (!tree_.IsWindow())
+      WS_CHILD | WS_VISIBLE | WS_CLIPCHILDREN | WS_CLIPSIBLINGS | LVS_REPORT |
+          LVS_OWNERDATA | LVS_SINGLESEL | LVS_SHOWSELALWAYS |
+          LVS_NOCOLUMNHEADER | LVS_SHAREIMAGELISTS);
+  if (!list_.IsWindow())
     return -1;
 
-  tree_.SetImageList(icons_);
+  list_.SetExtendedListViewStyle(LVS_EX_FULLROWSELECT | LVS_EX_DOUBLEBUFFER);
+  list_.InsertColumn(0, L"", LVCFMT_LEFT, 0);
+  list_.SetImageList(icons_, LVSIL_SMALL);
 
   return 0;
 }
 
 LRESULT MainFrame::OnGetDispInfo(NMHDR* header) {
-  auto disp_info = reinterpret_cast<NMTVDISPINFO*>(header);
+  auto disp_info = reinterpret_cast<NMLVDISPINFO*>(header);
   auto& item = disp_info->item;
-  auto data = reinterpret_cast<ItemData*>(item.lParam);
-
-  if (item.mask & LVIF_TEXT) {
-    LONGLONG size = data->entry->size.QuadPart;
-    if (size < 0) {
-      wcscpy_s(item.pszText, item.cchTextMax, data->entry->name.c_str());
-    } else {
-      int index = -1;
-      while (size > 1024) {
-        size /= 1024;
-        ++index;
-      }
-
-      swprintf_s(item.pszText, item.cchTextMax, L"%s (%lld ",
-                 data->entry->name.c_str(), size);
-
-      if (index >= 0) {
-        auto prefix = L"Ki\0Mi\0Gi\0Ti\0Pi\0Ei\0Zi\0Yi\0" + index * 3;
-        wcscat_s(item.pszText, item.cchTextMax, prefix);
-      }
-
-      wcscat_s(item.pszText, item.cchTextMax, L"B)");
-    }
-  }
+  if (rows_ == nullptr)
+    return 0;
+
+  Row formatted;
+  const Row* row = &formatted;
+  auto offset = static_cast<size_t>(item.iItem - cache_first_);
+  if (item.iItem >= cache_first_ && offset < cache_.size())
+    row = &cache_[offset];
+  else
+    FormatRow(item.iItem, &formatted);
+
+  if (item.mask & LVIF_TEXT)
+    wcsncpy_s(item.pszText, item.cchTextMax, row->text.c_str(), _TRUNCATE);
+
+  if (item.mask & LVIF_IMAGE)
+    item.iImage = row->image;
 
-  item.mask |= TVIF_DI_SETITEM;
+  if (item.mask & LVIF_INDENT)
+    item.iIndent = row->indent;
 
   return 0;
 }
 
-LRESULT MainFrame::OnItemExpanding(NMHDR* header) {
-  auto tree_view = reinterpret_cast<NMTREEVIEW*>(header);
-  auto& item = tree_view->itemNew;
-  auto data = reinterpret_cast<ItemData*>(item.lParam);
-
-  if (tree_view->action != TVE_EXPAND || data->opened)
+// Formats the rows about to be shown at once, so each is looked up in the
+// model only once however often it is painted.
+LRESULT MainFrame::OnCacheHint(NMHDR* header) {
+  auto cache_hint = reinterpret_cast<NMLVCACHEHINT*>(header);
+  if (rows_ == nullptr || cache_hint->iTo < cache_hint->iFrom)
     return 0;
 
-  data->opened = true;
+  cache_first_ = cache_hint->iFrom;
+  cache_.resize(cache_hint->iTo - cache_hint->iFrom + 1);
+  for (size_t i = 0; i < cache_.size(); ++i)
+    FormatRow(cache_first_ + static_cast<int>(i), &cache_[i]);
 
-  tree_.SetRedraw(FALSE);
+  return 0;
+}
 
-  for (auto& child : data->entry->children)
-    InsertItem(tree_view->itemNew.hItem, child.get());
+LRESULT MainFrame::OnKeyDown(NMHDR* header) {
+  auto key_down = reinterpret_cast<NMLVKEYDOWN*>(header);
+  auto index = list_.GetNextItem(-1, LVNI_FOCUSED);
 
-  TVSORTCB sort_cb{item.hItem, SortChildren};
-  tree_.SortChildrenCB(&sort_cb, FALSE);
+  switch (key_down->wVKey) {
+    case VK_RIGHT:
+      Toggle(index, true);
+      break;
 
-  tree_.SetRedraw();
-  tree_.RedrawWindow(nullptr, nullptr,
-                     RDW_INVALIDATE | RDW_ERASE | RDW_ALLCHILDREN | RDW_FRAME);
+    case VK_LEFT:
+      Toggle(index, false);
+      break;
+
+    case VK_RETURN:
+      if (rows_ != nullptr && index >= 0)
+        Toggle(index, !rows_->IsExpanded(index));
+      break;
+  }
 
   return 0;
 }
 
-LRESULT MainFrame::OnDeleteItem(NMHDR* header) {
-  auto tree_view = reinterpret_cast<NMTREEVIEW*>(header);
-
-  delete reinterpret_cast<ItemData*>(tree_view->itemOld.lParam);
+LRESULT MainFrame::OnDoubleClick(NMHDR* header) {
+  auto activate = reinterpret_cast<NMITEMACTIVATE*>(header);
+  if (rows_ != nullptr && activate->iItem >= 0)
+    Toggle(activate->iItem, !rows_->IsExpanded(activate->iItem));
 
   return 0;
 }
@@ -160,18 +208,68 @@ void MainFrame::OnFileOpen(UINT /*notify_code*/, int /*id*/,
 
   scanner_.SetTarget(drive_dialog.selected_drive());
 
+  // A rescan updates the tree in place, so the view must let go of it first.
+  ShowTree(nullptr);
+  snapshot_.Clear();
+
+  // A scan that failed or was canceled may leave the tree of the target
+  // scanned before behind, so the view is only filled once one succeeds.
   ProgressDialog progress_dialog(&scanner_);
-  if (progress_dialog.DoModal(m_hWnd) != IDOK)
+  if (progress_dialog.DoModal(m_hWnd) == IDOK &&
+      scanner_.GetRoot() != nullptr)
+    ShowTree(std::make_unique<EntryRowTree>(scanner_.GetRoot()));
+}
+
+void MainFrame::OnFileOpenSnapshot(UINT /*notify_code*/, int /*id*/,
+                                   CWindow /*control*/) {
+  CFileDialog dialog(TRUE, L"scan", nullptr,
+                     OFN_HIDEREADONLY | OFN_FILEMUSTEXIST, kSnapshotFilter,
+                     m_hWnd);
+  if (dialog.DoModal() != IDOK)
     return;
 
-  tree_.SetRedraw(FALSE);
+  // The snapshot is shown where it is mapped, and stays mapped while shown,
+  // so the view lets go of the one before first.
+  ShowTree(nullptr);
+  HRESULT result = snapshot_.Load(dialog.m_szFileName);
+  if (FAILED(result) || snapshot_.empty()) {
+    snapshot_.Clear();
 
-  tree_.DeleteAllItems();
-  InsertItem(TVI_ROOT, scanner_.GetRoot());
+    CString message;
+    message.Format(L"Cannot open %s: 0x%08X", dialog.m_szFileName, result);
+    AtlMessageBox(m_hWnd, message.GetString(), IDR_MAIN, MB_ICONERROR);
+    return;
+  }
+
+  ShowTree(std::make_unique<SnapshotRowTree>(&snapshot_));
+}
+
+void MainFrame::OnFileSaveAs(UINT /*notify_code*/, int /*id*/,
+                             CWindow /*control*/) {
+  // Only the tree on show is saved, never one left from an earlier scan.
+  if (rows_ == nullptr)
+    return;
 
-  tree_.SetRedraw();
-  tree_.RedrawWindow(nullptr, nullptr,
-                     RDW_INVALIDATE | RDW_ERASE | RDW_ALLCHILDREN | RDW_FRAME);
+  CFileDialog dialog(FALSE, L"scan", nullptr,
+                     OFN_HIDEREADONLY | OFN_OVERWRITEPROMPT, kSnapshotFilter,
+                     m_hWnd);
+  if (dialog.DoModal() != IDOK)
+    return;
+
+  HRESULT result;
+  if (!snapshot_.empty()) {
+    result = snapshot_.Save(dialog.m_szFileName);
+  } else {
+    FileTree tree;
+    tree.Build(scanner_.GetRoot());
+    result = tree.Save(dialog.m_szFileName);
+  }
+
+  if (FAILED(result)) {
+    CString message;
+    message.Format(L"Cannot save %s: 0x%08X", dialog.m_szFileName, result);
+    AtlMessageBox(m_hWnd, message.GetString(), IDR_MAIN, MB_ICONERROR);
+  }
 }
 
 void MainFrame::OnAppExit(UINT /*notify_code*/, int /*id*/,
@@ -10,6 +10,12 @@
 #include <atlctrls.h>
 #include <atlframe.h>
 
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "app/file_tree.h"
+#include "app/row_model.h"
 #include "app/volume_scanner.h"
 #include "res/resource.h"
 
@@ -19,37 +25,63 @@ class MainFrame : public CFrameWindowImpl<MainFrame> {
 
   DECLARE_FRAME_WND_CLASS(nullptr, IDR_MAIN)
 
+  void UpdateLayout(BOOL resize_bars = TRUE);
+
  private:
-  struct ItemData;
+  // A row formatted ahead of being shown.
+  struct Row {
+    std::wstring text;
+    int image;
+    int indent;
+  };
 
   BEGIN_MSG_MAP(MainFrame)
     MSG_WM_CREATE(OnCreate)
 
-    NOTIFY_HANDLER_EX(0, TVN_GETDISPINFO, OnGetDispInfo)
-    NOTIFY_HANDLER_EX(0, TVN_ITEMEXPANDING, OnItemExpanding)
-    NOTIFY_HANDLER_EX(0, TVN_DELETEITEM, OnDeleteItem)
+    NOTIFY_HANDLER_EX(0, LVN_GETDISPINFO, OnGetDispInfo)
+    NOTIFY_HANDLER_EX(0, LVN_ODCACHEHINT, OnCacheHint)
+    NOTIFY_HANDLER_EX(0, LVN_KEYDOWN, OnKeyDown)
+    NOTIFY_HANDLER_EX(0, NM_DBLCLK, OnDoubleClick)
 
     COMMAND_ID_HANDLER_EX(ID_FILE_OPEN, OnFileOpen)
+    COMMAND_ID_HANDLER_EX(ID_FILE_OPEN_SNAPSHOT, OnFileOpenSnapshot)
+    COMMAND_ID_HANDLER_EX(ID_FILE_SAVE_AS, OnFileSaveAs)
     COMMAND_ID_HANDLER_EX(ID_APP_EXIT, OnAppExit)
 
     CHAIN_MSG_MAP(CFrameWindowImpl)
   END_MSG_MAP()
 
-  HTREEITEM InsertItem(HTREEITEM parent, FileEntry* entry);
-  static int CALLBACK SortChildren(LPARAM left, LPARAM right, LPARAM param);
+  void FormatRow(int index, Row* row) const;
+  void Toggle(int index, bool expand);
+  void ShowRows();
+  void ShowTree(std::unique_ptr<RowTree> tree);
 
   int OnCreate(CREATESTRUCT* create_struct);
 
   LRESULT OnGetDispInfo(NMHDR* header);
-  LRESULT OnItemExpanding(NMHDR* header);
-  LRESULT OnDeleteItem(NMHDR* header);
+  LRESULT OnCacheHint(NMHDR* header);
+  LRESULT OnKeyDown(NMHDR* header);
+  LRESULT OnDoubleClick(NMHDR* header);
 
   void OnFileOpen(UINT notify_code, int id, CWindow control);
+  void OnFileOpenSnapshot(UINT notify_code, int id, CWindow control);
+  void OnFileSaveAs(UINT notify_code, int id, CWindow control);
   void OnAppExit(UINT notify_code, int id, CWindow control);
 
   VolumeScanner scanner_;
+
+  // The snapshot opened last, shown where it is mapped instead of the
+  // scanner's tree.
+  FileTree snapshot_;
+
+  std::unique_ptr<RowTree> tree_;
+  std::unique_ptr<RowModel> rows_;
   CImageList icons_;
-  CTreeViewCtrl tree_;
+  CListViewCtrl list_;
+
+  // The rows the list view said it is about to show, from |cache_first_| on.
+  std::vector<Row> cache_;
+  int cache_first_;
 
   MainFrame(const MainFrame&) = delete;
   MainFrame& operator=(const MainFrame&) = delete;
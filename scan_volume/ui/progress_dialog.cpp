@@ -4,27 +4,104 @@
 
 #include "app/volume_scanner.h"
 
-ProgressDialog::ProgressDialog(VolumeScanner* scanner) : scanner_(scanner) {}
+namespace {
+
+// The weight of the latest sample in the smoothed rate.
+const double kRateSmoothing = 0.3;
+
+}  // namespace
+
+ProgressDialog::ProgressDialog(VolumeScanner* scanner)
+    : scanner_(scanner),
+      sizing_(false),
+      marquee_(false),
+      last_done_(0),
+      last_tick_(0),
+      rate_per_second_(0.0) {}
 
 BOOL ProgressDialog::OnInitDialog(CWindow /*focus*/, LPARAM /*init_param*/) {
   CenterWindow();
 
   DoDataExchange(DDX_LOAD);
 
-  progress_.SetMarquee(TRUE);
+  progress_.SetRange32(0, kProgressRange);
+  SetMarquee(true);
 
   HRESULT result = scanner_->Scan(m_hWnd);
-  if (FAILED(result))
+  if (FAILED(result)) {
     EndDialog(IDABORT);
+    return TRUE;
+  }
+
+  last_tick_ = GetTickCount64();
+  SetTimer(kTimerId, kTimerInterval);
 
   return TRUE;
 }
 
+void ProgressDialog::OnTimer(UINT_PTR timer_id) {
+  if (timer_id != kTimerId) {
+    SetMsgHandled(FALSE);
+    return;
+  }
+
+  ScanProgress progress;
+  scanner_->GetProgress(&progress);
+
+  // Enumeration is measured against the records the volume holds, and
+  // sizing against the files enumerated.
+  DWORDLONG done, total;
+  if (sizing_) {
+    done = progress.files_sized + progress.size_failures;
+    total = progress.files_found;
+  } else {
+    done = progress.records_parsed;
+    total = progress.records_expected;
+  }
+
+  auto tick = GetTickCount64();
+  if (tick > last_tick_ && done >= last_done_) {
+    auto rate = (done - last_done_) * 1000.0 / (tick - last_tick_);
+    rate_per_second_ += (rate - rate_per_second_) * kRateSmoothing;
+  }
+
+  last_done_ = done;
+  last_tick_ = tick;
+
+  if (total == 0 || done > total) {
+    SetMarquee(true);
+    rate_.Format(L"%.0f items/s", rate_per_second_);
+  } else {
+    SetMarquee(false);
+    progress_.SetPos(static_cast<int>(done * kProgressRange / total));
+
+    if (rate_per_second_ >= 1.0) {
+      auto seconds =
+          static_cast<DWORDLONG>((total - done) / rate_per_second_);
+      rate_.Format(L"%.0f items/s, %I64u:%02I64u left", rate_per_second_,
+                   seconds / 60, seconds % 60);
+    } else {
+      rate_.Format(L"%.0f items/s", rate_per_second_);
+    }
+  }
+
+  if (progress.size_failures > 0) {
+    CString failures;
+    failures.Format(L", %I64u failed", progress.size_failures);
+    rate_ += failures;
+  }
+
+  DoDataExchange(DDX_LOAD, IDC_RATE);
+}
+
 LRESULT ProgressDialog::OnScanProgress(UINT /*message*/, WPARAM wParam,
                                        LPARAM lParam) {
   switch (wParam) {
     case VolumeScanner::EnumBegin:
       message_ = L"enumerating . . .";
+      sizing_ = false;
+      last_done_ = 0;
+      rate_per_second_ = 0.0;
       break;
 
     case VolumeScanner::EnumEnd:
@@ -33,6 +110,9 @@ LRESULT ProgressDialog::OnScanProgress(UINT /*message*/, WPARAM wParam,
 
     case VolumeScanner::SizeBegin:
       message_ = L"sizing . . .";
+      sizing_ = true;
+      last_done_ = 0;
+      rate_per_second_ = 0.0;
       break;
 
     case VolumeScanner::SizeEnd:
@@ -40,11 +120,12 @@ LRESULT ProgressDialog::OnScanProgress(UINT /*message*/, WPARAM wParam,
       break;
 
     case VolumeScanner::ScanEnd:
+      KillTimer(kTimerId);
       EndDialog(SUCCEEDED(lParam) ? IDOK : IDABORT);
       return 0;
   }
 
-  DoDataExchange(DDX_LOAD);
+  DoDataExchange(DDX_LOAD, IDC_MESSAGE);
 
   return 0;
 }
@@ -53,3 +134,18 @@ void ProgressDialog::OnCancel(UINT /*notify_code*/, int /*id*/,
                               CWindow /*control*/) {
   scanner_->Cancel();
 }
+
+void ProgressDialog::SetMarquee(bool marquee) {
+  if (marquee == marquee_)
+    return;
+
+  if (marquee) {
+    progress_.ModifyStyle(0, PBS_MARQUEE);
+    progress_.SetMarquee(TRUE);
+  } else {
+    progress_.SetMarquee(FALSE);
+    progress_.ModifyStyle(PBS_MARQUEE, 0);
+  }
+
+  marquee_ = marquee;
+}
@@ -26,6 +26,7 @@ class ProgressDialog : public CDialogImpl<ProgressDialog>,
  private:
   BEGIN_MSG_MAP(ProgressDialog)
     MSG_WM_INITDIALOG(OnInitDialog)
+    MSG_WM_TIMER(OnTimer)
     MESSAGE_HANDLER_EX(WM_USER, OnScanProgress)
 
     COMMAND_ID_HANDLER_EX(IDCANCEL, OnCancel)
@@ -34,16 +35,34 @@ class ProgressDialog : public CDialogImpl<ProgressDialog>,
   BEGIN_DDX_MAP(ProgressDialog)
     DDX_TEXT(IDC_MESSAGE, message_)
     DDX_CONTROL_HANDLE(IDC_PROGRESS, progress_)
+    DDX_TEXT(IDC_RATE, rate_)
   END_DDX_MAP()
 
+  static const UINT_PTR kTimerId = 1;
+  static const UINT kTimerInterval = 250;
+  static const int kProgressRange = 1000;
+
   BOOL OnInitDialog(CWindow focus, LPARAM init_param);
+  void OnTimer(UINT_PTR timer_id);
   LRESULT OnScanProgress(UINT message, WPARAM wParam, LPARAM lParam);
 
   void OnCancel(UINT notify_code, int id, CWindow control);
 
+  void SetMarquee(bool marquee);
+
   VolumeScanner* const scanner_;
   CString message_;
   CProgressBarCtrl progress_;
+  CString rate_;
+
+  // Whether the scan is past enumeration and into sizing.
+  bool sizing_;
+  bool marquee_;
+
+  // The work done as of the last tick, and the smoothed rate of it.
+  DWORDLONG last_done_;
+  ULONGLONG last_tick_;
+  double rate_per_second_;
 
   ProgressDialog(const ProgressDialog&) = delete;
   ProgressDialog& operator=(const ProgressDialog&) = delete;